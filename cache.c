@@ -0,0 +1,227 @@
+//
+// Description: 编译输出缓存，以预处理之后的token、编译选项和编译器本身为键，把编译得到的输出文件保存在缓存目录中。
+// 之后预处理结果相同的编译直接从缓存复制输出，跳过语法分析和代码生成
+// Created by kery on 2024/3/26.
+//
+#include "compiler.h"
+#include "helpers/fingerprint.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * 缓存目录的结构
+ *   <目录>/<键的前两个十六进制字符>/<键的其余字符>
+ * 每个文件就是一次编译的完整输出。文件先写入同一目录下带进程号的临时文件再重命名，
+ * 并行的编译进程同时读写同一个缓存项时只会看到完整的文件，重复写入的结果相同，后写入的覆盖先写入的。
+ * token的表示方式或者输出与token的关系改变时修改COMPILE_CACHE_VERSION，旧的缓存项随之失效
+ */
+#define COMPILE_CACHE_VERSION 1
+#define COMPILE_CACHE_COPY_CHUNK 65536
+
+/**
+ * 编译输出缓存的状态，由命令行驱动在每次运行开始时设置
+ * dir: 缓存目录，NULL表示不使用缓存
+ * compiler_id: 编译器可执行文件的大小和修改时间，重新构建编译器之后旧的缓存项不会被使用
+ * stats: 本次运行的命中统计
+ */
+static struct compile_cache
+{
+    const char* dir;
+    uint64_t compiler_id[2];
+    struct compile_cache_stats stats;
+} compile_cache;
+
+/**
+ * @brief 设置缓存目录，目录不存在时创建它，同时清空命中统计
+ * @param dir 缓存目录，NULL表示不使用缓存
+ * @return 缓存目录是否可用，不可用时不使用缓存
+ */
+bool compile_cache_set_dir(const char* dir)
+{
+    memset(&compile_cache.stats, 0, sizeof(compile_cache.stats));
+    compile_cache.dir = NULL;
+    if (!dir)
+    {
+        return true;
+    }
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (stat("/proc/self/exe", &st) == 0)
+    {
+        compile_cache.compiler_id[0] = st.st_size;
+        compile_cache.compiler_id[1] = st.st_mtime;
+    }
+    compile_cache.dir = dir;
+    return true;
+}
+
+/**
+ * @brief 是否设置了缓存目录
+ */
+bool compile_cache_enabled()
+{
+    return compile_cache.dir != NULL;
+}
+
+/**
+ * @brief 获取本次运行的命中统计
+ */
+void compile_cache_stats_get(struct compile_cache_stats* stats)
+{
+    *stats = compile_cache.stats;
+}
+
+/**
+ * @brief 计算一次编译的缓存键
+ * 预处理之后的token已经包含了头文件、-D和-I的全部影响，因此不需要另外加入它们。
+ * 代码生成输出了输入文件的路径，路径也是键的一部分；token的位置目前不影响输出，不参与计算
+ * @param process 编译过程，已经完成预处理
+ * @param key 保存计算结果
+ */
+void compile_cache_key(struct compile_process* process, struct fingerprint* key)
+{
+    struct fingerprint state;
+    fingerprint_init(&state);
+    fingerprint_update_u64(&state, COMPILE_CACHE_VERSION);
+    fingerprint_update_u64(&state, compile_cache.compiler_id[0]);
+    fingerprint_update_u64(&state, compile_cache.compiler_id[1]);
+    // 这些选项不影响输出
+    fingerprint_update_u64(&state, process->flags & ~(COMPILE_PROCESS_FLAG_MEMORY_REPORT | COMPILE_PROCESS_FLAG_SKIP_UNCHANGED));
+    fingerprint_update_str(&state, process->cfile.abs_path);
+
+    size_t count = segmented_vector_count(process->token_vec);
+    fingerprint_update_u64(&state, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct token* token = segmented_vector_at(process->token_vec, i);
+        fingerprint_update_u64(&state, (uint64_t) token->type | ((uint64_t) token->whitespace << 16));
+        switch (token->type)
+        {
+            case TOKEN_TYPE_IDENTIFIER:
+            case TOKEN_TYPE_KEYWORD:
+            case TOKEN_TYPE_OPERATOR:
+            case TOKEN_TYPE_STRING:
+            case TOKEN_TYPE_COMMENT:
+                fingerprint_update_str(&state, token->sval);
+                break;
+            case TOKEN_TYPE_NUMBER:
+                fingerprint_update_u64(&state, token->llnum);
+                fingerprint_update_u64(&state, token->num.type);
+                break;
+            case TOKEN_TYPE_SYMBOL:
+                fingerprint_update_u64(&state, (unsigned char) token->cval);
+                break;
+        }
+    }
+    *key = fingerprint_finish(&state);
+}
+
+/**
+ * @brief 获取缓存项的路径
+ * @param key 缓存键
+ * @param path 保存路径，长度至少为PATH_MAX
+ * @param make_dir 是否创建缓存项所在的子目录
+ * @return 路径是否可用
+ */
+static bool compile_cache_path(struct fingerprint* key, char* path, bool make_dir)
+{
+    char hex[FINGERPRINT_HEX_LENGTH + 1];
+    fingerprint_format(key, hex);
+    if (snprintf(path, PATH_MAX, "%s/%.2s", compile_cache.dir, hex) >= PATH_MAX)
+    {
+        return false;
+    }
+    if (make_dir && mkdir(path, 0777) != 0 && errno != EEXIST)
+    {
+        return false;
+    }
+    return snprintf(path, PATH_MAX, "%s/%.2s/%s", compile_cache.dir, hex, &hex[2]) < PATH_MAX;
+}
+
+/**
+ * @brief 复制文件，先写入目标旁边带进程号的临时文件再重命名，目标文件要么不变要么是完整的副本
+ * @param from 源文件
+ * @param to 目标文件
+ * @return 是否复制成功
+ */
+static bool compile_cache_copy(const char* from, const char* to)
+{
+    FILE* in = fopen(from, "rb");
+    if (!in)
+    {
+        return false;
+    }
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", to, (long) getpid()) >= (int) sizeof(tmp_path))
+    {
+        fclose(in);
+        return false;
+    }
+    FILE* out = fopen(tmp_path, "wb");
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+
+    char chunk[COMPILE_CACHE_COPY_CHUNK];
+    size_t len;
+    bool ok = true;
+    while (ok && (len = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    {
+        ok = fwrite(chunk, 1, len, out) == len;
+    }
+    ok = ok && !ferror(in);
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_path, to) != 0)
+    {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 查找缓存项，找到时把它复制到输出文件
+ * @param key 缓存键
+ * @param out_filename 输出文件
+ * @return 是否命中
+ */
+bool compile_cache_fetch(struct fingerprint* key, const char* out_filename)
+{
+    char path[PATH_MAX];
+    if (compile_cache_path(key, path, false) && compile_cache_copy(path, out_filename))
+    {
+        compile_cache.stats.hits++;
+        return true;
+    }
+    compile_cache.stats.misses++;
+    return false;
+}
+
+/**
+ * @brief 编译成功后把输出文件保存为缓存项，保存失败只影响之后的命中率，不影响这次编译
+ * @param key 缓存键
+ * @param out_filename 输出文件，已经写完
+ */
+void compile_cache_store(struct fingerprint* key, const char* out_filename)
+{
+    char path[PATH_MAX];
+    if (compile_cache_path(key, path, true) && compile_cache_copy(out_filename, path))
+    {
+        compile_cache.stats.stores++;
+    }
+    else
+    {
+        compile_cache.stats.errors++;
+    }
+}
@@ -0,0 +1,120 @@
+//
+// Description: 编译服务的客户端，把命令行参数和工作目录发送给常驻的编译服务，退出码表示编译是否成功
+// 用法: kclient [--socket PATH] ARGS...，ARGS和main的命令行参数相同，但不能使用标准输入和标准输出
+// Created by kery on 2024/3/18.
+//
+#include "compiler.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * @brief 写入恰好len个字节
+ */
+static bool client_write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t res = write(fd, data, len);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (res <= 0)
+        {
+            return false;
+        }
+        data += res;
+        len -= res;
+    }
+    return true;
+}
+
+/**
+ * @brief 发送请求的长度，同时把stderr发送给服务
+ */
+static bool client_send_header(int fd, uint32_t len)
+{
+    int err_fd = STDERR_FILENO;
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = {.iov_base = &len, .iov_len = sizeof(len)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &err_fd, sizeof(int));
+    // 长度只有4个字节，和文件描述符一起一次发送完
+    return sendmsg(fd, &msg, 0) == sizeof(len);
+}
+
+int main(int argc, char** argv)
+{
+    const char* socket_path = getenv("KCOMPILER_SOCKET");
+    int first = 1;
+    if (argc > 2 && S_EQ(argv[1], "--socket"))
+    {
+        socket_path = argv[2];
+        first = 3;
+    }
+    if (!socket_path)
+    {
+        socket_path = COMPILE_SERVER_DEFAULT_SOCKET;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        perror("getcwd");
+        return 1;
+    }
+
+    // 请求为以0结尾的工作目录和参数
+    size_t len = strlen(cwd) + 1;
+    for (int i = first; i < argc; i++)
+    {
+        len += strlen(argv[i]) + 1;
+    }
+    if (len > COMPILE_SERVER_MAX_REQUEST)
+    {
+        fprintf(stderr, "Too many arguments for the compile server\n");
+        return 1;
+    }
+    char* data = malloc(len);
+    char* ptr = stpcpy(data, cwd) + 1;
+    for (int i = first; i < argc; i++)
+    {
+        ptr = stpcpy(ptr, argv[i]) + 1;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "Cannot connect to the compile server at %s\n", socket_path);
+        return 1;
+    }
+
+    int32_t res;
+    if (!client_send_header(fd, len) || !client_write_all(fd, data, len)
+        || read(fd, &res, sizeof(res)) != sizeof(res))
+    {
+        fprintf(stderr, "The compile server closed the connection\n");
+        return 1;
+    }
+    close(fd);
+    free(data);
+    return res == 0 ? 0 : 1;
+}
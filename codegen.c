@@ -0,0 +1,137 @@
+//
+// Description: 代码生成，输出GNU汇编器格式的x86-64汇编。
+// 限制：还没有语法分析和语法树，目前只输出文件的开头和结尾(.file、.text和.note.GNU-stack)，不为源代码生成任何指令
+// Created by kery on 2024/3/17.
+//
+#include "compiler.h"
+#include "helpers/buffer.h"
+#include "helpers/alloc.h"
+#include <stdlib.h>
+#include <stdarg.h>
+
+// 汇编先写入内存中的缓冲区，超过这个大小才一次性写入输出文件
+#define CODEGEN_FLUSH_THRESHOLD (1024 * 1024)
+
+/**
+ * @brief 创建代码生成器
+ * @param compiler 编译过程，汇编输出到它的ofile中
+ * @return 代码生成器
+ */
+struct codegen* codegen_create(struct compile_process* compiler)
+{
+    struct codegen* codegen = mem_calloc(1, sizeof(struct codegen));
+    codegen->compiler = compiler;
+    codegen->out = buffer_create();
+    return codegen;
+}
+
+/**
+ * @brief 把缓冲区中的汇编写入输出文件
+ * @param codegen 代码生成器
+ */
+void codegen_flush(struct codegen* codegen)
+{
+    struct buffer* out = codegen->out;
+    if (out->len == 0)
+    {
+        return;
+    }
+    if (fwrite(out->data, 1, out->len, codegen->compiler->ofile) != out->len)
+    {
+        compiler_error(codegen->compiler, "Failed to write the assembly output");
+    }
+    out->len = 0;
+}
+
+/**
+ * @brief 缓冲区足够大时写入输出文件，每输出一行之后调用
+ */
+static void codegen_maybe_flush(struct codegen* codegen)
+{
+    if (codegen->out->len >= CODEGEN_FLUSH_THRESHOLD)
+    {
+        codegen_flush(codegen);
+    }
+}
+
+/**
+ * @brief 输出一条缩进的汇编指令或伪指令，自动换行
+ * @param codegen 代码生成器
+ * @param fmt 格式字符串
+ * @param ...
+ */
+void codegen_emit(struct codegen* codegen, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    buffer_write(codegen->out, '\t');
+    buffer_vprintf(codegen->out, fmt, args);
+    buffer_write(codegen->out, '\n');
+    va_end(args);
+    codegen_maybe_flush(codegen);
+}
+
+/**
+ * @brief 输出.file伪指令，文件名中的引号、反斜杠和控制字符按照字符串常量的规则转义
+ * @param codegen 代码生成器
+ * @param path 源文件路径
+ */
+static void codegen_emit_file(struct codegen* codegen, const char* path)
+{
+    struct buffer* out = codegen->out;
+    buffer_write_str(out, "\t.file \"");
+    for (const char* c = path; *c; c++)
+    {
+        token_write_escaped(out, *c);
+    }
+    buffer_write_n(out, "\"\n", 2);
+    codegen_maybe_flush(codegen);
+}
+
+/**
+ * @brief 切换到另一个段，已经在这个段中时不输出
+ * @param codegen 代码生成器
+ * @param section 段名，例如".text"
+ */
+void codegen_section(struct codegen* codegen, const char* section)
+{
+    if (S_EQ(codegen->section, section))
+    {
+        return;
+    }
+    codegen->section = section;
+    codegen_emit(codegen, ".section %s", section);
+}
+
+/**
+ * @brief 释放代码生成器，不会写入缓冲区中剩下的汇编
+ */
+void codegen_free(struct codegen* codegen)
+{
+    buffer_free(codegen->out);
+    mem_free(codegen);
+}
+
+/**
+ * @brief 为一个编译过程生成汇编并写入它的输出文件
+ * 目前还没有语法分析，只输出文件的开头和结尾，语法树的节点在这两者之间输出
+ * @param process 编译过程
+ * @return 代码生成结果
+ */
+int codegen(struct compile_process* process)
+{
+    if (!process->ofile)
+    {
+        return CODEGEN_ALL_OK;
+    }
+
+    struct codegen* codegen = codegen_create(process);
+    codegen_emit_file(codegen, process->cfile.abs_path);
+    codegen_section(codegen, ".text");
+
+    // 标记栈不可执行，否则链接器会给出警告
+    codegen_section(codegen, ".note.GNU-stack,\"\",@progbits");
+    codegen_flush(codegen);
+    codegen_free(codegen);
+    return fflush(process->ofile) == 0 ? CODEGEN_ALL_OK : CODEGEN_FAILED;
+}
@@ -2,15 +2,20 @@
 // Created by kery on 2024/2/24.
 //
 #include "compiler.h"
+#include "helpers/alloc.h"
+#include "helpers/fingerprint.h"
 #include <stdarg.h>
 #include <stdlib.h>
 /**
- * @brief 在此处三个函数指针分别被赋值为三个具体的函数，之后可以用这三个函数指针来调用这三个函数
+ * @brief 在此处函数指针分别被赋值为具体的函数，之后可以用这些函数指针来调用这些函数
+ * 词法分析通过next_span批量读取文件，另外三个函数供逐个字符读取的使用者使用
  */
 struct lex_process_functions compiler_lex_functions = {
         .next_char = compile_process_next_char,
         .peek_char = compile_process_peek_char,
-        .push_char = compile_process_push_char
+        .push_char = compile_process_push_char,
+        .next_span = compile_process_next_span,
+        .advance = compile_process_advance
 };
 
 /**
@@ -44,6 +49,122 @@ void compiler_warning(struct compile_process* compiler, const char* msg, ...)
     fprintf(stderr, " on line %i, col %i in file %s\n", compiler->pos.line, compiler->pos.col, compiler->pos.filename);
 }
 
+/**
+ * @brief 依次进行词法分析、预处理和代码生成，每个阶段的内存分配计入对应的阶段
+ * 跳过没有改动的文件或者使用编译输出缓存时，输出文件在确定需要重新生成之后才打开：
+ * 输入文件和头文件的指纹都没有变化时在词法分析之后返回，保留上次的输出；
+ * 缓存中有预处理结果相同的编译的输出时在预处理之后返回，输出从缓存复制
+ * @param process 编译过程
+ * @param lex_process 从编译过程的输入文件中读取的词法分析过程
+ * @param deferred_output 还没有打开的输出文件名，输出文件已经在创建编译过程时打开或者没有输出时为NULL
+ * @return 编译结果
+ */
+static int compile_process_run(struct compile_process* process, struct lex_process* lex_process, const char* deferred_output)
+{
+    // lexical analysis
+    memory_set_phase(MEMORY_PHASE_LEX);
+    if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    bool skip_unchanged = process->flags & COMPILE_PROCESS_FLAG_SKIP_UNCHANGED;
+    struct fingerprint fingerprint;
+    if (skip_unchanged)
+    {
+        token_fingerprint(lex_process->token_vec, &fingerprint);
+        if (compile_fingerprint_unchanged(process, &fingerprint, deferred_output))
+        {
+            return COMPILER_FILE_COMPILED_OK;
+        }
+    }
+
+    // preprocessing
+    // 预处理之后的token保存在process->token_vec中
+    memory_set_phase(MEMORY_PHASE_PREPROCESS);
+    if (preprocessor_run(process, lex_process->token_vec) != PREPROCESSOR_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+    // 相邻的字符串常量在预处理之后连接
+    token_concatenate_strings(process->token_vec);
+
+    if (skip_unchanged)
+    {
+        // 输出将被改写，旧的指纹在新的输出写完之前不再有效
+        compile_fingerprint_invalidate(deferred_output);
+    }
+    bool use_cache = deferred_output && compile_cache_enabled();
+    struct fingerprint cache_key;
+    if (use_cache)
+    {
+        compile_cache_key(process, &cache_key);
+        if (compile_cache_fetch(&cache_key, deferred_output))
+        {
+            if (skip_unchanged)
+            {
+                compile_fingerprint_store(process, &fingerprint, deferred_output);
+            }
+            return COMPILER_FILE_COMPILED_OK;
+        }
+    }
+    if (deferred_output && !compile_process_open_output(process, deferred_output))
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    //parsing
+    memory_set_phase(MEMORY_PHASE_PARSE);
+
+    //code generation
+    // 汇编写入process->ofile
+    memory_set_phase(MEMORY_PHASE_CODEGEN);
+    if (codegen(process) != CODEGEN_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+    // 缓存项和指纹文件在输出写完之后再保存，写入输出时失败不会留下与之不符的缓存项或指纹
+    if (deferred_output)
+    {
+        fflush(process->ofile);
+    }
+    if (use_cache)
+    {
+        compile_cache_store(&cache_key, deferred_output);
+    }
+    if (skip_unchanged)
+    {
+        compile_fingerprint_store(process, &fingerprint, deferred_output);
+    }
+    return COMPILER_FILE_COMPILED_OK;
+}
+
+/**
+ * @brief 输出编译一个文件时的内存使用情况(-fmem-report)
+ * 泄漏的字节数是编译结束时仍然存活、而编译开始时还不存在的字节数，包括编译之间共享的缓存
+ * @param file_name 编译的文件名
+ * @param before 编译开始时的内存统计
+ */
+static void compile_file_memory_report(const char* file_name, struct memory_stats* before)
+{
+    struct memory_stats after;
+    memory_stats_get(&after);
+    fprintf(stderr, "Memory for %s: peak %zu bytes, live %zu bytes, %zu allocations, leaked %zu bytes\n",
+            file_name, after.peak, after.live, after.allocations - before->allocations,
+            after.live > before->live ? after.live - before->live : 0);
+    for (int i = 0; i < MEMORY_PHASE_COUNT; i++)
+    {
+        size_t allocations = after.phases[i].allocations - before->phases[i].allocations;
+        if (allocations == 0)
+        {
+            continue;
+        }
+        fprintf(stderr, "  %-10s %zu allocations, %zu bytes allocated, %zu bytes freed\n", memory_phase_name(i),
+                allocations, after.phases[i].allocated - before->phases[i].allocated,
+                after.phases[i].freed - before->phases[i].freed);
+    }
+}
+
 /**
  *  编译文件的起始函数
  *
@@ -54,27 +175,41 @@ void compiler_warning(struct compile_process* compiler, const char* msg, ...)
  */
 int compile_file(const char* file_name, const char* out_filename, int flags)
 {
-    struct compile_process* process = compile_process_create(file_name, out_filename, flags);
+    if (flags & COMPILE_PROCESS_FLAG_SYNTAX_ONLY)
+    {
+        out_filename = NULL;
+    }
+    // 只有写入文件的输出可以保留到下次编译
+    if (!out_filename || S_EQ(out_filename, COMPILE_PROCESS_STDIO_NAME))
+    {
+        flags &= ~COMPILE_PROCESS_FLAG_SKIP_UNCHANGED;
+    }
+    else if (!(flags & COMPILE_PROCESS_FLAG_SKIP_UNCHANGED))
+    {
+        compile_fingerprint_invalidate(out_filename);
+    }
+    struct memory_stats before;
+    memory_stats_get(&before);
+    memory_stats_reset_peak();
+
+    // 跳过没有改动的文件或者从缓存复制输出时不能提前清空上次的输出，由compile_process_run打开输出文件
+    bool deferred = (flags & COMPILE_PROCESS_FLAG_SKIP_UNCHANGED) ||
+                    (out_filename && !S_EQ(out_filename, COMPILE_PROCESS_STDIO_NAME) && compile_cache_enabled());
+    const char* deferred_output = deferred ? out_filename : NULL;
+    struct compile_process* process = compile_process_create(file_name, deferred ? NULL : out_filename, flags);
     if(!process)
     {
         return COMPILER_FAILED_WITH_ERRORS;
     }
-    // lexical analysis
     // 传入了一个指针结构体，相当于传入了三个函数
     struct lex_process* lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
-    if (!lex_process)
-    {
-        return COMPILER_FAILED_WITH_ERRORS;
-    }
-    if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    int res = compile_process_run(process, lex_process, deferred_output);
+    memory_set_phase(MEMORY_PHASE_OTHER);
+    lex_process_free(lex_process);
+    compile_process_free(process);
+    if ((flags & COMPILE_PROCESS_FLAG_MEMORY_REPORT) && memory_tracking_enabled())
     {
-        return COMPILER_FAILED_WITH_ERRORS;
+        compile_file_memory_report(file_name, &before);
     }
-    process->token_vec = lex_process->token_vec;
-
-    //parsing
-
-    //code generation
-
-    return COMPILER_FILE_COMPILED_OK;
-}
\ No newline at end of file
+    return res;
+}
@@ -8,6 +8,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include "helpers/typed_vector.h"
+#include "helpers/segmented_vector.h"
 
 #define S_EQ(str, str2) \
         (str && str2 && (strcmp(str, str2) == 0))
@@ -103,6 +105,17 @@ enum
     TOKEN_TYPE_NEWLINE
 };
 
+/**
+ * token的标志枚举
+ * TOKEN_FLAG_ANGLE_BRACKETS: 字符串是由<>包围的，即#include <xxx>的形式
+ * TOKEN_FLAG_LINE_START: 不产生换行token时，token之前有换行，即token位于一行的开头
+ */
+enum
+{
+    TOKEN_FLAG_ANGLE_BRACKETS = 0b00000001,
+    TOKEN_FLAG_LINE_START = 0b00000010
+};
+
 enum
 {
     NUMBER_TYPE_NORMAl,
@@ -123,6 +136,7 @@ enum
  * llnum: token的长长整数值
  * any: token的一个任意指针
  * whitespace: token之间的空格
+ * hideset: 宏展开的隐藏集合
  * between_brackets: 一个指向括号之间的字符串的指针，如果token在一个括号之间，则指向左括号之后的位置
  * e.g. 对于(10+20+30)，每个token的该指针都指向“1”所在的位置
  */
@@ -150,6 +164,24 @@ struct token
     bool whitespace;
 
     const char* between_brackets;
+
+    // 宏展开得到的token不能再展开的宏名集合，不同的token共享同一个集合
+    struct preprocessor_hideset* hideset;
+};
+
+// token_vector_*操作元素为struct token的向量，token_ptr_vector_*操作元素为struct token*的向量
+DEFINE_VECTOR(token, struct token)
+DEFINE_VECTOR(token_ptr, struct token*)
+
+/**
+ * 宏展开的隐藏集合，是一个不可变的链表，新的集合总是在已有的集合之前加入节点，因此可以共享尾部
+ * name: 宏名，是驻留的字符串，可以直接比较指针
+ * next: 集合中的下一个宏名
+ */
+struct preprocessor_hideset
+{
+    const char* name;
+    struct preprocessor_hideset* next;
 };
 
 
@@ -159,30 +191,46 @@ struct lex_process;
  * 注意，此时只确定了函数指针类型，并确定了每种指针类型的参数结构，还需要依据此类型建立出具体的函数指针。
  * @param lex_process 词法分析进程
  */
-typedef char (*LEX_PROCESS_NEXT_CHAR)(struct lex_process* process);     //函数指针
-typedef char (*LEX_PROCESS_PEEK_CHAR)(struct lex_process* process);
-typedef void (*LEX_PROCESS_PUSH_CHAR)(struct lex_process* process, char c);
+typedef int (*LEX_PROCESS_NEXT_CHAR)(struct lex_process* process);     //函数指针
+typedef int (*LEX_PROCESS_PEEK_CHAR)(struct lex_process* process);
+typedef void (*LEX_PROCESS_PUSH_CHAR)(struct lex_process* process, int c);
+typedef const char* (*LEX_PROCESS_NEXT_SPAN)(struct lex_process* process, size_t* len);
+typedef void (*LEX_PROCESS_ADVANCE)(struct lex_process* process, size_t len);
 
 /**
- * @brief 词法分析进程函数指针结构体，在此处声明了三个函数指针，分别属于上面所说的三种指针类型
+ * @brief 词法分析进程函数指针结构体，在此处声明了输入源需要提供的函数指针，分别属于上面所说的几种指针类型
+ * 字符以unsigned char的值返回，输入结束时返回EOF，推回EOF没有效果
  * next_char: 下一个字符
  * peek_char: 查看下一个字符
  * push_char: 推回一个字符
+ * next_span: 获取从读取位置开始的一段连续输入，不移动读取位置，长度为0表示输入结束。
+ *            返回的内容在下一次调用这个输入源的任何函数之前有效。为NULL时词法分析逐个字符调用上面三个函数
+ * advance: 把读取位置向后移动len个字节，len不超过上一次next_span返回的长度
  */
 struct lex_process_functions
 {
     LEX_PROCESS_NEXT_CHAR next_char;
     LEX_PROCESS_PEEK_CHAR peek_char;
     LEX_PROCESS_PUSH_CHAR push_char;
+    LEX_PROCESS_NEXT_SPAN next_span;
+    LEX_PROCESS_ADVANCE advance;
 };
 
+// 从编译过程的输入文件中读取字符的函数指针结构体
+extern struct lex_process_functions compiler_lex_functions;
+
 /**
  * @brief 词法分析进程结构体，保存了词法分析过程中的一些信息
  * pos: 位置
  * token_vec: 存储token向量
  * compiler: 指向编译过程的指针
  * current_expression_count: 当前表达式的数量，即有几层括号
- * parentheses_buffer: 括号缓冲区
+ * parentheses_buffer: 括号缓冲区，最外层的括号结束后被驻留并释放
+ * parentheses_start: 最外层括号开始时token_vec中的token数量
+ * window: 输入源支持批量读取时，当前正在读取的一段输入
+ * window_len: window的长度
+ * window_index: window中下一个要读取的字符，之前的部分还没有通过advance告诉输入源
+ * line_start: 不产生换行token时，是否读取到了换行，下一个token需要加上TOKEN_FLAG_LINE_START
  * function: 函数指针结构体指针
  * private: 指向一些只有使用者可以理解的私人数据
  */
@@ -194,6 +242,11 @@ struct lex_process
 
     int current_expression_count;
     struct buffer* parentheses_buffer;
+    size_t parentheses_start;
+    const char* window;
+    size_t window_len;
+    size_t window_index;
+    bool line_start;
     struct lex_process_functions* function;
 
     //指向一些lexer无法理解的私人数据
@@ -211,6 +264,49 @@ enum
     COMPILER_FILE_COMPILED_OK
 };
 
+/**
+ * 编译选项，保存在compile_process->flags中
+ * COMPILE_PROCESS_FLAG_SYNTAX_ONLY: 只检查输入，不生成输出文件(-fsyntax-only)
+ * COMPILE_PROCESS_FLAG_MEMORY_REPORT: 编译每个文件之后输出各个阶段的内存使用情况(-fmem-report)
+ * COMPILE_PROCESS_FLAG_COMPACT_TOKENS: 词法分析跳过注释，不产生注释和换行token，换行记录为下一个token的TOKEN_FLAG_LINE_START。
+ * 编译时默认打开，-fkeep-comments关闭；kc-tokens等工具不设置它，得到完整的token
+ * COMPILE_PROCESS_FLAG_SKIP_UNCHANGED: 输入文件和头文件的指纹与输出文件旁边的指纹文件相同时跳过词法分析之后的阶段(-fskip-unchanged)
+ */
+enum
+{
+    COMPILE_PROCESS_FLAG_SYNTAX_ONLY = 0b00000001,
+    COMPILE_PROCESS_FLAG_MEMORY_REPORT = 0b00000010,
+    COMPILE_PROCESS_FLAG_COMPACT_TOKENS = 0b00000100,
+    COMPILE_PROCESS_FLAG_SKIP_UNCHANGED = 0b00001000
+};
+
+/**
+ * 文件名为"-"时表示标准输入或标准输出
+ */
+#define COMPILE_PROCESS_STDIO_NAME "-"
+
+/**
+ * 编译过程的输入流，按块读取输入文件，每一块在读取时验证是合法的UTF-8
+ * COMPILE_PROCESS_STREAM_CHUNK: 每次读取的字节数
+ * COMPILE_PROCESS_STREAM_PUSHBACK: 重新读取时保留的已读字节数，保证词法分析总能推回字符
+ * COMPILE_PROCESS_STREAM_TAIL: 块的末尾截断了一个多字节字符时，为补全它额外读取的最大字节数
+ * fp: 输入流
+ * len: data中有效数据的长度
+ * index: 下一个要读取的字符的位置
+ * offset: data[0]在输入中的位置，用于报告错误
+ */
+#define COMPILE_PROCESS_STREAM_CHUNK 65536
+#define COMPILE_PROCESS_STREAM_PUSHBACK 16
+#define COMPILE_PROCESS_STREAM_TAIL 3
+struct compile_process_stream
+{
+    FILE* fp;
+    size_t len;
+    size_t index;
+    size_t offset;
+    char data[COMPILE_PROCESS_STREAM_PUSHBACK + COMPILE_PROCESS_STREAM_CHUNK + COMPILE_PROCESS_STREAM_TAIL];
+};
+
 /**
  * 编译过程结构体
  * flags: 编译选项
@@ -228,18 +324,203 @@ struct compile_process
      * 输入文件结构体
      * fp: 输入文件指针
      * abs_path: 文件的绝对路径
+     * stream: 词法分析从这里按块读取输入
      */
     struct compile_process_input_file
     {
         FILE* fp;
         const char* abs_path;
+        struct compile_process_stream* stream;
     } cfile;
 
-    struct vector* token_vec;
-    // 词法分析得到的token向量
+    // 预处理之后的token，按块存储，追加时已有的token不会移动，之后的阶段可以一直持有指向它们的指针
+    struct segmented_vector* token_vec;
     FILE* ofile;
+
+    // 预处理器，保存了当前翻译单元的宏定义和条件编译状态
+    struct preprocessor* preprocessor;
 };
 
+/**
+ * 预处理的结果枚举
+ * PREPROCESSOR_ALL_OK: 预处理成功
+ * PREPROCESSOR_FAILED: 预处理失败
+ */
+enum
+{
+    PREPROCESSOR_ALL_OK,
+    PREPROCESSOR_FAILED
+};
+
+/**
+ * 被缓存的头文件，在同一个进程中编译的所有翻译单元共享
+ * path: 头文件的绝对路径
+ * dir: 头文件所在的目录，用于解析该头文件中的相对#include
+ * tokens: 头文件的原始token向量，只词法分析一次
+ * guard: 头文件的include guard宏名，如果没有检测到则为NULL
+ * pragma_once: 头文件中是否有#pragma once
+ * mtime: 词法分析时文件的修改时间，常驻的编译服务用它判断缓存是否过期
+ * size: 词法分析时文件的大小
+ */
+struct preprocessor_header
+{
+    const char* path;
+    const char* dir;
+    struct vector* tokens;
+    const char* guard;
+    bool pragma_once;
+    long long mtime;
+    long long size;
+};
+
+/**
+ * 宏定义
+ * name: 宏的名字
+ * function_like: 是否是函数式宏
+ * variadic: 函数式宏的最后一个参数是否是...
+ * has_operators: 宏的值中是否有#或##运算符，有的话即使是对象式宏也需要替换
+ * params: 函数式宏的参数名，可变参数为__VA_ARGS__
+ * param_count: 参数的数量
+ * tokens: 宏的值，即宏名(和参数列表)之后直到行尾的token，分配在预处理器的内存池中
+ * token_count: 宏的值的token数量
+ * expansion: 对象式宏完整展开的结果，避免每次使用都重新展开
+ * expansion_count: 完整展开结果的token数量
+ * expansion_generation: 展开结果对应的宏定义表版本，宏定义表改变后结果失效
+ * expansion_cacheable: 在expansion_generation版本中展开结果是否可以缓存
+ */
+struct preprocessor_definition
+{
+    const char* name;
+    bool function_like;
+    bool variadic;
+    bool has_operators;
+    const char** params;
+    int param_count;
+    struct token* tokens;
+    int token_count;
+
+    struct token* expansion;
+    int expansion_count;
+    unsigned long expansion_generation;
+    bool expansion_cacheable;
+};
+
+/**
+ * 条件编译的状态，每遇到一个#if/#ifdef/#ifndef就压入一个
+ * active: 当前分支是否需要输出
+ * taken: 之前是否已经有一个分支被选中了，被选中之后后面的#elif/#else都不再输出
+ * parent_active: 外层是否处于输出状态
+ * seen_else: 是否已经遇到了#else
+ */
+struct preprocessor_condition
+{
+    bool active;
+    bool taken;
+    bool parent_active;
+    bool seen_else;
+};
+
+/**
+ * 预处理器，每个翻译单元一个
+ * compiler: 所属的编译过程
+ * definitions: 宏定义表，宏名->struct preprocessor_definition*
+ * included_once: 已经被包含过的#pragma once头文件，路径->struct preprocessor_header*
+ * conditions: 条件编译栈，元素为struct preprocessor_condition
+ * include_depth: 当前#include的嵌套深度
+ * arena: 宏定义、宏展开结果和隐藏集合所在的内存池
+ * generation: 宏定义表的版本，每次#define/#undef都会增加
+ * hidesets: 隐藏集合的驻留表，相同的(集合, 宏名)只分配一个节点
+ * vector_pool: 宏展开时可以重复使用的token向量
+ * included: 被包含过的头文件，元素为struct preprocessor_header*
+ * include_lookups: 每条#include的查找结果，元素为struct preprocessor_include_lookup
+ */
+struct preprocessor
+{
+    struct compile_process* compiler;
+    struct hashmap* definitions;
+    struct hashmap* included_once;
+    struct vector* conditions;
+    int include_depth;
+
+    struct arena* arena;
+    unsigned long generation;
+    struct preprocessor_hideset_table
+    {
+        struct preprocessor_hideset** nodes;
+        size_t capacity;
+        size_t count;
+    } hidesets;
+    struct vector* vector_pool;
+    struct vector* included;
+    struct vector* include_lookups;
+};
+
+/**
+ * 一条#include的查找结果，-fskip-unchanged用它检查同样的查找现在是否还会找到同一个文件，
+ * 例如之后在更靠前的查找目录或者包含者的目录中新加入了同名的头文件
+ * name: #include中的名字
+ * angle_brackets: 是否是<xxx>形式
+ * dir: 包含者所在的目录
+ * path: 找到的头文件的绝对路径，找不到时为NULL
+ */
+struct preprocessor_include_lookup
+{
+    const char* name;
+    bool angle_brackets;
+    const char* dir;
+    const char* path;
+};
+
+/**
+ * 文件开头的一条#include指令
+ * name: 包含的名字
+ * angle_brackets: 是否是<xxx>形式
+ * end: 这条指令之后第一个token的位置
+ */
+struct preprocessor_include_directive
+{
+    const char* name;
+    bool angle_brackets;
+    int end;
+};
+
+/**
+ * 代码生成的结果枚举
+ * CODEGEN_ALL_OK: 代码生成成功
+ * CODEGEN_FAILED: 代码生成失败
+ */
+enum
+{
+    CODEGEN_ALL_OK,
+    CODEGEN_FAILED
+};
+
+/**
+ * 代码生成器，每个翻译单元一个
+ * compiler: 所属的编译过程
+ * out: 还没有写入输出文件的汇编
+ * section: 当前所在的段
+ */
+struct codegen
+{
+    struct compile_process* compiler;
+    struct buffer* out;
+    const char* section;
+};
+
+/**
+ * 编译服务
+ * COMPILE_SERVER_DEFAULT_SOCKET: 没有指定时服务监听的Unix socket路径，也可以通过环境变量KCOMPILER_SOCKET指定
+ * COMPILE_SERVER_MAX_REQUEST: 一个请求的最大长度
+ *
+ * 请求由一个uint32_t的长度开头，之后是这么多字节的以0结尾的字符串：客户端的工作目录，然后是命令行参数。
+ * 长度和客户端的stderr文件描述符一起发送(SCM_RIGHTS)，编译时的错误信息直接写入客户端的stderr。
+ * 服务处理完后回复一个int32_t，为编译失败的文件数量，请求格式错误时为-1。
+ * 编译出错时worker进程会退出，客户端读不到回复，此时同样视为失败，服务会重新启动一个worker。
+ */
+#define COMPILE_SERVER_DEFAULT_SOCKET "/tmp/kcompiler.sock"
+#define COMPILE_SERVER_MAX_REQUEST (1024 * 1024)
+
 /***********************************************************************************************************************
  * 函数声明
  **********************************************************************************************************************/
@@ -249,13 +530,18 @@ struct compile_process
  **********************************************************************************************************************/
 int compile_file(const char* file_name, const char* out_filename, int flags);
 struct compile_process* compile_process_create(const char* filename, const char* out_filename, int flags);
+bool compile_process_open_output(struct compile_process* process, const char* out_filename);
+void compile_process_close_files(struct compile_process* process);
+void compile_process_free(struct compile_process* process);
 
 /***********************************************************************************************************************
  * 字符操作函数声明
  **********************************************************************************************************************/
-char compile_process_next_char(struct lex_process* lex_process);
-char compile_process_peek_char(struct lex_process* lex_process);
-void compile_process_push_char(struct lex_process* lex_process, char c);
+int compile_process_next_char(struct lex_process* lex_process);
+const char* compile_process_next_span(struct lex_process* lex_process, size_t* len);
+void compile_process_advance(struct lex_process* lex_process, size_t len);
+int compile_process_peek_char(struct lex_process* lex_process);
+void compile_process_push_char(struct lex_process* lex_process, int c);
 
 /***********************************************************************************************************************
  * 编译结果函数声明
@@ -272,6 +558,45 @@ void* lex_process_private(struct lex_process* process);
 struct vector* lex_process_tokens(struct lex_process* process);
 int lex(struct lex_process* process);
 
+/***********************************************************************************************************************
+ * 预处理函数声明
+ **********************************************************************************************************************/
+struct preprocessor* preprocessor_create(struct compile_process* compiler);
+void preprocessor_free(struct preprocessor* preprocessor);
+int preprocessor_run(struct compile_process* compiler, struct vector* tokens);
+void preprocessor_add_include_dir(const char* dir);
+void preprocessor_add_definition(const char* definition);
+void preprocessor_set_include_dirs(struct vector* dirs);
+void preprocessor_clear_definitions();
+void preprocessor_revalidate_headers();
+struct preprocessor_definition* preprocessor_get_definition(struct preprocessor* preprocessor, const char* name);
+void preprocessor_apply_command_line_definitions(struct preprocessor* preprocessor);
+struct vector* preprocessor_command_line_definitions();
+struct vector* preprocessor_include_dirs();
+struct vector* preprocessor_header_tokens(struct compile_process* compiler, const char* path);
+bool preprocessor_resolve_include(const char* name, bool angle_brackets, const char* dir, char* path);
+void preprocessor_record_include_lookup(struct preprocessor* preprocessor, const char* name, bool angle_brackets, const char* dir, const char* path);
+char* preprocessor_dirname(const char* path);
+int preprocessor_scan_include_prefix(struct vector* tokens, struct vector* includes);
+int preprocessor_run_prefix(struct compile_process* compiler, struct vector* tokens, int end);
+
+/***********************************************************************************************************************
+ * 预编译头文件函数声明
+ **********************************************************************************************************************/
+int pch_create(const char* file_name, const char* pch_filename, int flags);
+bool pch_use(const char* pch_filename);
+int pch_restore(struct compile_process* compiler, struct vector* tokens, const char* dir);
+
+/***********************************************************************************************************************
+ * 代码生成函数声明
+ **********************************************************************************************************************/
+int codegen(struct compile_process* process);
+struct codegen* codegen_create(struct compile_process* compiler);
+void codegen_free(struct codegen* codegen);
+void codegen_flush(struct codegen* codegen);
+void codegen_emit(struct codegen* codegen, const char* fmt, ...);
+void codegen_section(struct codegen* codegen, const char* section);
+
 /***********************************************************************************************************************
  * token函数声明
  **********************************************************************************************************************/
@@ -284,5 +609,130 @@ int lex(struct lex_process* process);
 struct lex_process* token_build_for_string(struct compile_process* compiler, const char* str);
 
 bool token_is_keyword(struct token* token, const char* value);
+bool token_is_identifier(struct token* token, const char* value);
+bool token_is_symbol(struct token* token, char c);
+bool token_is_operator(struct token* token, const char* value);
+bool token_is_newline(struct token* token);
+bool token_is_comment(struct token* token);
+bool token_is_line_start(struct token* token);
+void token_write_spelling(struct token* token, struct buffer* buffer);
+void token_write_escaped(struct buffer* buffer, unsigned char c);
+void token_concatenate_strings(struct segmented_vector* tokens);
+
+/**
+ * 命令行驱动的一个输入文件
+ * input: 输入文件名，"-"表示标准输入
+ * output: 输出文件名，"-"表示标准输出
+ */
+struct compile_driver_input
+{
+    const char* input;
+    const char* output;
+};
+
+/**
+ * 命令行驱动，解析参数之后在同一个进程中编译所有的输入文件，头文件缓存在文件之间共享
+ * flags: 编译选项
+ * inputs: 输入文件，元素为struct compile_driver_input
+ * include_dirs: -I给出的头文件查找目录，已经转为绝对路径，元素为char*
+ * definitions: -D给出的宏定义，元素为const char*
+ * pch_create: --create-pch给出的预编译头文件路径，NULL表示正常编译
+ * pch: --pch给出的预编译头文件路径
+ * cache_dir: --cache-dir给出的编译输出缓存目录，默认为环境变量KCOMPILER_CACHE_DIR，NULL表示不使用缓存
+ * cache_stats: 是否在编译完所有文件之后输出缓存的命中统计(--cache-stats)
+ * dependencies: 只扫描#include，输出Makefile格式的依赖规则而不编译(-M)，规则的目标是输入文件的输出文件
+ * dependency_file: -MF给出的依赖规则输出文件，NULL表示输出到标准输出
+ * strings: 驱动分配的字符串，包括manifest文件的内容和默认的输出文件名，元素为char*
+ */
+struct compile_driver
+{
+    int flags;
+    struct vector* inputs;
+    struct vector* include_dirs;
+    struct vector* definitions;
+    const char* pch_create;
+    const char* pch;
+    const char* cache_dir;
+    bool cache_stats;
+    bool dependencies;
+    const char* dependency_file;
+    struct vector* strings;
+};
+
+/***********************************************************************************************************************
+ * 命令行驱动函数声明
+ **********************************************************************************************************************/
+struct compile_driver* compile_driver_create();
+bool compile_driver_parse(struct compile_driver* driver, int argc, char** argv);
+int compile_driver_run(struct compile_driver* driver);
+void compile_driver_free(struct compile_driver* driver);
+
+/***********************************************************************************************************************
+ * 依赖扫描函数声明
+ **********************************************************************************************************************/
+struct depscan;
+struct depscan* depscan_create();
+void depscan_free(struct depscan* scan);
+bool depscan_file(struct depscan* scan, const char* file_name, const char* target, FILE* out);
+
+/***********************************************************************************************************************
+ * 输入文件预读函数声明
+ **********************************************************************************************************************/
+struct compile_prefetch;
+struct compile_prefetch* compile_prefetch_start(struct vector* inputs, size_t window);
+void compile_prefetch_advance(struct compile_prefetch* prefetch, size_t index);
+void compile_prefetch_stop(struct compile_prefetch* prefetch);
+
+/***********************************************************************************************************************
+ * 编译服务函数声明
+ **********************************************************************************************************************/
+int compile_server_run(const char* socket_path, int workers);
+
+/***********************************************************************************************************************
+ * token文件函数声明
+ **********************************************************************************************************************/
+bool token_dump_write(struct vector* tokens, const char* filename);
+void token_dump_write_text(struct vector* tokens, FILE* fp);
+struct vector* token_dump_read(const char* filename);
+
+/***********************************************************************************************************************
+ * 源文件指纹函数声明
+ **********************************************************************************************************************/
+struct fingerprint;
+void token_fingerprint(struct vector* tokens, struct fingerprint* fingerprint);
+void compile_fingerprint_invalidate(const char* out_filename);
+bool compile_fingerprint_unchanged(struct compile_process* process, struct fingerprint* fingerprint, const char* out_filename);
+void compile_fingerprint_store(struct compile_process* process, struct fingerprint* fingerprint, const char* out_filename);
+
+/**
+ * 编译输出缓存一次运行的统计
+ * hits: 从缓存复制了输出的编译
+ * misses: 缓存中没有输出，需要完整编译的编译
+ * stores: 编译之后保存到缓存中的输出
+ * errors: 保存失败的输出，例如缓存目录不可写
+ */
+struct compile_cache_stats
+{
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t errors;
+};
+
+/***********************************************************************************************************************
+ * 编译输出缓存函数声明
+ **********************************************************************************************************************/
+bool compile_cache_set_dir(const char* dir);
+bool compile_cache_enabled();
+void compile_cache_stats_get(struct compile_cache_stats* stats);
+void compile_cache_key(struct compile_process* process, struct fingerprint* key);
+bool compile_cache_fetch(struct fingerprint* key, const char* out_filename);
+void compile_cache_store(struct fingerprint* key, const char* out_filename);
+
+/***********************************************************************************************************************
+ * 字符串驻留函数声明
+ **********************************************************************************************************************/
+const char* intern_string(const char* str);
+const char* intern_string_n(const char* str, size_t len);
 
 #endif //KCOMPILER_COMPILER_H
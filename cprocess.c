@@ -4,6 +4,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "compiler.h"
+#include <string.h>
+#include "helpers/utf8.h"
+#include "helpers/alloc.h"
+#include "helpers/vector.h"
+
+/**
+ * @brief 创建一个按块读取的输入流
+ * @param fp 输入流
+ * @return 输入流的读取状态
+ */
+static struct compile_process_stream* compile_process_stream_create(FILE* fp)
+{
+    struct compile_process_stream* stream = mem_malloc(sizeof(struct compile_process_stream));
+    stream->fp = fp;
+    stream->len = 0;
+    stream->index = 0;
+    stream->offset = 0;
+    return stream;
+}
 
 /**
  * @brief 创建一个编译过程，检测输入文件是否存在，如果存在则打开文件
@@ -14,38 +33,133 @@
  */
 struct compile_process* compile_process_create(const char* filename, const char* out_filename, int flags)
 {
-    FILE* file = fopen(filename, "r");
+    bool is_stdin = S_EQ(filename, COMPILE_PROCESS_STDIO_NAME);
+    FILE* file = is_stdin ? stdin : fopen(filename, "r");
     if(!file)
     {
         return NULL;
     }
-    FILE* out_file = NULL;
-    if(out_filename)
-    {
-        out_file = fopen(out_filename, "w");
-        if(!out_file)
-        {
-            return NULL;
-        }
-    }
     // 为编译过程分配内存
-    struct compile_process* process = calloc(1, sizeof(struct compile_process));
+    struct compile_process* process = mem_calloc(1, sizeof(struct compile_process));
     process->flags = flags;
     process->cfile.fp = file;
-    process->ofile = out_file;
+    process->cfile.stream = compile_process_stream_create(file);
+    // 优先使用绝对路径，这样同一个头文件无论以何种相对路径被包含都只对应一个缓存
+    // 标准输入没有路径，其中"xxx"形式的#include相对于当前目录查找
+    char* abs_path = is_stdin ? NULL : realpath(filename, NULL);
+    process->cfile.abs_path = abs_path ? abs_path : strdup(is_stdin ? "<stdin>" : filename);
+    process->pos.line = 1;
+    process->pos.col = 1;
+    process->pos.filename = process->cfile.abs_path;
+    if (out_filename && !compile_process_open_output(process, out_filename))
+    {
+        compile_process_free(process);
+        return NULL;
+    }
     return process;
 }
 
+/**
+ * @brief 打开编译过程的输出文件，已有的文件会被清空。跳过没有改动的文件时，确定需要编译之后才打开
+ * @param process 编译过程
+ * @param out_filename 输出文件名，"-"表示标准输出
+ * @return 是否打开成功
+ */
+bool compile_process_open_output(struct compile_process* process, const char* out_filename)
+{
+    process->ofile = S_EQ(out_filename, COMPILE_PROCESS_STDIO_NAME) ? stdout : fopen(out_filename, "w");
+    return process->ofile != NULL;
+}
+
+/**
+ * @brief 关闭编译过程打开的输入和输出文件，常驻的编译服务会编译大量文件，不能泄漏文件描述符
+ * @param process 编译过程
+ */
+void compile_process_close_files(struct compile_process* process)
+{
+    if (process->cfile.fp && process->cfile.fp != stdin)
+    {
+        fclose(process->cfile.fp);
+    }
+    process->cfile.fp = NULL;
+    mem_free(process->cfile.stream);
+    process->cfile.stream = NULL;
+    if (process->ofile && process->ofile != stdout)
+    {
+        fclose(process->ofile);
+    }
+    process->ofile = NULL;
+}
+
+/**
+ * @brief 释放编译过程，包括预处理器和预处理之后的token向量，打开的文件也会被关闭
+ * 输入文件的绝对路径被这个编译过程的token引用，需要保留路径时，先取走cfile.abs_path并置为NULL
+ * @param process 编译过程
+ */
+void compile_process_free(struct compile_process* process)
+{
+    compile_process_close_files(process);
+    if (process->preprocessor)
+    {
+        preprocessor_free(process->preprocessor);
+    }
+    if (process->token_vec)
+    {
+        segmented_vector_free(process->token_vec);
+    }
+    // 绝对路径来自realpath或strdup
+    free((char*) process->cfile.abs_path);
+    mem_free(process);
+}
+
+/**
+ * @brief 读取下一块输入并验证它是合法的UTF-8，保留最后读取的几个字节以便推回
+ * 块的末尾如果截断了一个多字节字符，会再读取这个字符剩下的字节，这样每个字节只需要验证一次
+ * @param compiler 编译过程
+ * @return 是否读到了新的数据
+ */
+static bool compile_process_stream_fill(struct compile_process* compiler)
+{
+    struct compile_process_stream* stream = compiler->cfile.stream;
+    size_t keep = stream->index < COMPILE_PROCESS_STREAM_PUSHBACK ? stream->index : COMPILE_PROCESS_STREAM_PUSHBACK;
+    stream->offset += stream->len - keep;
+    memmove(stream->data, &stream->data[stream->index - keep], keep);
+    stream->index = keep;
+    stream->len = keep + fread(&stream->data[keep], 1, COMPILE_PROCESS_STREAM_CHUNK, stream->fp);
+
+    size_t end;
+    bool valid = utf8_validate(&stream->data[keep], stream->len - keep, &end);
+    end += keep;
+    if (valid && end < stream->len)
+    {
+        size_t missing = utf8_sequence_length(stream->data[end]) - (stream->len - end);
+        stream->len += fread(&stream->data[stream->len], 1, missing, stream->fp);
+        // 补全之后这个字符必须是完整的，否则输入在字符的中间结束了
+        size_t tail_end;
+        valid = utf8_validate(&stream->data[end], stream->len - end, &tail_end) && end + tail_end == stream->len;
+    }
+    if (!valid)
+    {
+        compiler_error(compiler, "Invalid UTF-8 at byte %zu of the input", stream->offset + end);
+    }
+    return stream->index < stream->len;
+}
+
 /**
  * @brief 读取当前词法分析过程正在处理的文件的下一个字符
  * @param lex_process 词法分析过程
- * @return 下一个字符
+ * @return 下一个字符，输入结束时为EOF
  */
-char compile_process_next_char(struct lex_process* lex_process)
+int compile_process_next_char(struct lex_process* lex_process)
 {
     struct compile_process* compiler = lex_process->compiler;
+    struct compile_process_stream* stream = compiler->cfile.stream;
     compiler->pos.col++;
-    char c = getc(compiler->cfile.fp);
+    if (stream->index >= stream->len && !compile_process_stream_fill(compiler))
+    {
+        return EOF;
+    }
+    unsigned char c = stream->data[stream->index++];
     if(c == '\n')
     {
         compiler->pos.line++;
@@ -56,25 +170,64 @@ char compile_process_next_char(struct lex_process* lex_process)
 }
 
 /**
- * @brief 读取当前词法分析过程正在处理的文件的下一个字符，在获取他之后再放回文件流
+ * @brief 查看当前词法分析过程正在处理的文件的下一个字符，不移动读取位置
  * @param lex_process 词法分析过程
- * @return 下一个字符
+ * @return 下一个字符，输入结束时为EOF
  */
-char compile_process_peek_char(struct lex_process* lex_process)
+int compile_process_peek_char(struct lex_process* lex_process)
 {
     struct compile_process* compiler = lex_process->compiler;
-    char c = getc(compiler->cfile.fp);
-    ungetc(c, compiler->cfile.fp);
-    return c;
+    struct compile_process_stream* stream = compiler->cfile.stream;
+    if (stream->index >= stream->len && !compile_process_stream_fill(compiler))
+    {
+        return EOF;
+    }
+    return (unsigned char) stream->data[stream->index];
 }
 
 /**
- * @brief 将一个字符推回到文件流中
+ * @brief 将一个字符推回到输入中，和ungetc一样推回EOF没有效果
  * @param lex_process 词法分析过程
  * @param c 待推回的字符
  */
-void compile_process_push_char(struct lex_process* lex_process, char c)
+void compile_process_push_char(struct lex_process* lex_process, int c)
+{
+    struct compile_process_stream* stream = lex_process->compiler->cfile.stream;
+    if (c == EOF || stream->index == 0)
+    {
+        return;
+    }
+    stream->data[--stream->index] = c;
+}
+
+/**
+ * @brief 获取从读取位置开始的一段输入，词法分析直接在这段输入上工作，不需要为每个字符调用函数
+ * 在读取下一段之前把编译过程的位置同步为词法分析的位置，这样读取时报告的错误有正确的行列
+ * @param lex_process 词法分析过程
+ * @param len 保存这段输入的长度，输入结束时为0
+ * @return 这段输入的起始位置
+ */
+const char* compile_process_next_span(struct lex_process* lex_process, size_t* len)
 {
     struct compile_process* compiler = lex_process->compiler;
-    ungetc(c, compiler->cfile.fp);
-}
\ No newline at end of file
+    struct compile_process_stream* stream = compiler->cfile.stream;
+    compiler->pos.line = lex_process->pos.line;
+    compiler->pos.col = lex_process->pos.col;
+    if (stream->index >= stream->len && !compile_process_stream_fill(compiler))
+    {
+        *len = 0;
+        return NULL;
+    }
+    *len = stream->len - stream->index;
+    return &stream->data[stream->index];
+}
+
+/**
+ * @brief 跳过已经被词法分析读取的输入
+ * @param lex_process 词法分析过程
+ * @param len 跳过的字节数
+ */
+void compile_process_advance(struct lex_process* lex_process, size_t len)
+{
+    lex_process->compiler->cfile.stream->index += len;
+}
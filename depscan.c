@@ -0,0 +1,400 @@
+//
+// Description: 依赖扫描(-M)，只找出#include指令，输出Makefile格式的依赖规则。
+// 不进行词法分析和预处理：逐行查找行首的#，只跟踪跨行注释的开始和结束，其余内容直接跳过
+// Created by kery on 2024/3/28.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+// 依赖规则每行的最大长度，超过时用\换行
+#define DEPSCAN_LINE_WIDTH 78
+
+/**
+ * 依赖扫描的状态，在一次运行的所有输入文件之间共享
+ * headers: 扫描过的头文件，键为绝对路径，值为它直接包含的头文件的绝对路径，struct vector，元素为char*
+ * 头文件直接包含哪些头文件只取决于它所在的目录和-I，与包含它的文件无关，每个头文件只需要扫描一次
+ */
+struct depscan
+{
+    struct hashmap* headers;
+};
+
+/**
+ * @brief 创建依赖扫描的状态
+ */
+struct depscan* depscan_create()
+{
+    struct depscan* scan = calloc(1, sizeof(struct depscan));
+    scan->headers = hashmap_create();
+    return scan;
+}
+
+/**
+ * @brief 释放包含的头文件的列表
+ * @param includes 元素为char*
+ */
+static void depscan_free_includes(struct vector* includes)
+{
+    for (size_t i = 0; i < vector_count(includes); i++)
+    {
+        free(vector_peek_ptr_at(includes, i));
+    }
+    vector_free(includes);
+}
+
+/**
+ * @brief 释放依赖扫描的状态
+ */
+void depscan_free(struct depscan* scan)
+{
+    size_t iter = 0;
+    const char* path;
+    void* includes;
+    while (hashmap_next(scan->headers, &iter, &path, &includes))
+    {
+        depscan_free_includes(includes);
+    }
+    hashmap_free(scan->headers);
+    free(scan);
+}
+
+/**
+ * @brief 把整个文件读入内存
+ * @param path 文件路径，"-"表示标准输入
+ * @param len 保存文件的长度
+ * @return 文件内容，以0结尾，由调用者释放，无法打开时返回NULL
+ */
+static char* depscan_read(const char* path, size_t* len)
+{
+    bool is_stdin = S_EQ(path, COMPILE_PROCESS_STDIO_NAME);
+    FILE* fp = is_stdin ? stdin : fopen(path, "rb");
+    if (!fp)
+    {
+        return NULL;
+    }
+    struct stat st;
+    bool has_size = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+    struct buffer* buffer = buffer_create_sized(has_size ? st.st_size + 1 : 0);
+    char chunk[65536];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    {
+        buffer_write_n(buffer, chunk, read);
+    }
+    if (!is_stdin)
+    {
+        fclose(fp);
+    }
+    *len = buffer->len;
+    buffer_write(buffer, '\0');
+    return buffer_detach(buffer);
+}
+
+/**
+ * @brief 在一行中查找注释的结尾
+ * @param ptr 注释中的位置
+ * @param line_end 行尾
+ * @param in_comment 找到结尾时置为false
+ * @return 注释结尾之后的位置，没有找到时为行尾
+ */
+static const char* depscan_comment_end(const char* ptr, const char* line_end, bool* in_comment)
+{
+    while ((ptr = memchr(ptr, '*', line_end - ptr)))
+    {
+        ptr++;
+        if (ptr < line_end && *ptr == '/')
+        {
+            *in_comment = false;
+            return ptr + 1;
+        }
+    }
+    return line_end;
+}
+
+/**
+ * @brief 判断一行在行尾时是否处于没有结束的注释中，字符串和字符常量中的注释符号不开始注释
+ * @param ptr 开始检查的位置，不在注释、字符串和字符常量中
+ * @param line_end 行尾
+ * @return 注释是否延续到下一行
+ */
+static bool depscan_line_opens_comment(const char* ptr, const char* line_end)
+{
+    char quote = 0;
+    while (ptr < line_end)
+    {
+        char c = *ptr++;
+        if (quote)
+        {
+            if (c == '\\')
+            {
+                ptr++;
+            }
+            else if (c == quote)
+            {
+                quote = 0;
+            }
+        }
+        else if (c == '"' || c == '\'')
+        {
+            quote = c;
+        }
+        else if (c == '/' && ptr < line_end && *ptr == '/')
+        {
+            return false;
+        }
+        else if (c == '/' && ptr < line_end && *ptr == '*')
+        {
+            bool in_comment = true;
+            ptr = depscan_comment_end(ptr + 1, line_end, &in_comment);
+            if (in_comment)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 处理一条预处理指令，是#include时把找到的头文件加入列表
+ * 文件名的规则与词法分析相同：<xxx>和"xxx"中的反斜杠都没有特殊含义。
+ * 由宏给出文件名的#include和找不到的头文件被忽略，它们可能在没有生效的条件编译分支中
+ * @param ptr #之后的位置
+ * @param line_end 行尾
+ * @param dir 包含者所在的目录
+ * @param includes 找到的头文件的绝对路径，元素为char*
+ */
+static void depscan_directive(const char* ptr, const char* line_end, const char* dir, struct vector* includes)
+{
+    while (ptr < line_end && (*ptr == ' ' || *ptr == '\t'))
+    {
+        ptr++;
+    }
+    size_t keyword_len = sizeof("include") - 1;
+    if ((size_t) (line_end - ptr) <= keyword_len || memcmp(ptr, "include", keyword_len) != 0)
+    {
+        return;
+    }
+    ptr += keyword_len;
+    while (ptr < line_end && (*ptr == ' ' || *ptr == '\t'))
+    {
+        ptr++;
+    }
+    if (ptr == line_end || (*ptr != '"' && *ptr != '<'))
+    {
+        return;
+    }
+
+    bool angle_brackets = *ptr == '<';
+    const char* name = ptr + 1;
+    const char* name_end = memchr(name, angle_brackets ? '>' : '"', line_end - name);
+    if (!name_end || name_end - name >= PATH_MAX)
+    {
+        return;
+    }
+    char name_copy[PATH_MAX];
+    memcpy(name_copy, name, name_end - name);
+    name_copy[name_end - name] = '\0';
+
+    char path[PATH_MAX];
+    if (preprocessor_resolve_include(name_copy, angle_brackets, dir, path))
+    {
+        char* found = strdup(path);
+        vector_push(includes, &found);
+    }
+}
+
+/**
+ * @brief 找出一个文件中的#include指令包含的头文件，不考虑条件编译
+ * 每行只在行首的空白和注释之后检查是否是#，之后的内容只在含有/时逐个字符检查，
+ * 找出没有结束的注释，其余情况整行由memchr跳过
+ * @param data 文件内容
+ * @param len 文件长度
+ * @param dir 文件所在的目录
+ * @param includes 保存找到的头文件的绝对路径，元素为char*
+ */
+static void depscan_scan(const char* data, size_t len, const char* dir, struct vector* includes)
+{
+    const char* ptr = data;
+    const char* end = data + len;
+    bool in_comment = false;
+    while (ptr < end)
+    {
+        const char* line_end = memchr(ptr, '\n', end - ptr);
+        if (!line_end)
+        {
+            line_end = end;
+        }
+
+        // 跳过行首的空白和注释，注释之后的#也是指令
+        const char* p = ptr;
+        while (p < line_end)
+        {
+            if (in_comment)
+            {
+                p = depscan_comment_end(p, line_end, &in_comment);
+            }
+            else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f' || *p == '\v')
+            {
+                p++;
+            }
+            else if (*p == '/' && p + 1 < line_end && p[1] == '*')
+            {
+                in_comment = true;
+                p += 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (p < line_end && *p == '#')
+        {
+            depscan_directive(p + 1, line_end, dir, includes);
+        }
+        if (p < line_end && memchr(p, '/', line_end - p))
+        {
+            in_comment = depscan_line_opens_comment(p, line_end);
+        }
+        ptr = line_end + 1;
+    }
+}
+
+/**
+ * @brief 获取一个头文件直接包含的头文件，没有扫描过时扫描它
+ * @param scan 依赖扫描的状态
+ * @param path 头文件的绝对路径
+ * @return 直接包含的头文件的绝对路径，元素为char*，无法读取的头文件没有依赖
+ */
+static struct vector* depscan_header(struct depscan* scan, const char* path)
+{
+    struct vector* includes = hashmap_get(scan->headers, path);
+    if (includes)
+    {
+        return includes;
+    }
+    includes = vector_create(sizeof(char*));
+    size_t len;
+    char* data = depscan_read(path, &len);
+    if (data)
+    {
+        char* dir = preprocessor_dirname(path);
+        depscan_scan(data, len, dir, includes);
+        free(dir);
+        free(data);
+    }
+    hashmap_set(scan->headers, path, includes);
+    return includes;
+}
+
+/**
+ * @brief 按照包含的顺序把头文件和它们包含的头文件加入依赖列表，每个头文件只加入一次
+ * @param scan 依赖扫描的状态
+ * @param includes 直接包含的头文件
+ * @param visited 已经加入的头文件
+ * @param deps 依赖列表，元素为const char*，指向头文件列表中的字符串
+ */
+static void depscan_visit(struct depscan* scan, struct vector* includes, struct hashmap* visited, struct vector* deps)
+{
+    for (size_t i = 0; i < vector_count(includes); i++)
+    {
+        const char* path = vector_peek_ptr_at(includes, i);
+        if (hashmap_get(visited, path))
+        {
+            continue;
+        }
+        hashmap_set(visited, path, (void*) path);
+        vector_push(deps, &path);
+        depscan_visit(scan, depscan_header(scan, path), visited, deps);
+    }
+}
+
+/**
+ * @brief 输出依赖规则中的一个文件名，空格和#前加\，$写为$$
+ * @param out 输出流
+ * @param name 文件名
+ * @param column 当前行已经输出的字符数，输出之后更新
+ */
+static void depscan_write_name(FILE* out, const char* name, size_t* column)
+{
+    size_t len = strlen(name);
+    if (*column + len + 1 > DEPSCAN_LINE_WIDTH)
+    {
+        fputs(" \\\n", out);
+        *column = 0;
+    }
+    fputc(' ', out);
+    for (const char* ptr = name; *ptr; ptr++)
+    {
+        if (*ptr == ' ' || *ptr == '#')
+        {
+            fputc('\\', out);
+        }
+        else if (*ptr == '$')
+        {
+            fputc('$', out);
+        }
+        fputc(*ptr, out);
+    }
+    *column += len + 1;
+}
+
+/**
+ * @brief 扫描一个输入文件包含的所有头文件，输出"目标: 输入文件 头文件..."形式的依赖规则
+ * @param scan 依赖扫描的状态
+ * @param file_name 输入文件，"-"表示标准输入
+ * @param target 规则的目标
+ * @param out 输出流
+ * @return 是否成功，输入文件无法读取时失败
+ */
+bool depscan_file(struct depscan* scan, const char* file_name, const char* target, FILE* out)
+{
+    size_t len;
+    char* data = depscan_read(file_name, &len);
+    if (!data)
+    {
+        fprintf(stderr, "Cannot open %s\n", file_name);
+        return false;
+    }
+    // 与预处理相同，"xxx"相对于输入文件的绝对路径所在的目录查找，标准输入相对于当前目录
+    bool is_stdin = S_EQ(file_name, COMPILE_PROCESS_STDIO_NAME);
+    char* abs_path = is_stdin ? NULL : realpath(file_name, NULL);
+    char* dir = abs_path ? preprocessor_dirname(abs_path) : strdup(".");
+    struct vector* includes = vector_create(sizeof(char*));
+    depscan_scan(data, len, dir, includes);
+    free(dir);
+    free(data);
+
+    struct hashmap* visited = hashmap_create();
+    if (abs_path)
+    {
+        hashmap_set(visited, abs_path, abs_path);
+    }
+    struct vector* deps = vector_create(sizeof(const char*));
+    depscan_visit(scan, includes, visited, deps);
+
+    size_t column = strlen(target) + 1;
+    fprintf(out, "%s:", target);
+    if (!is_stdin)
+    {
+        depscan_write_name(out, file_name, &column);
+    }
+    for (size_t i = 0; i < vector_count(deps); i++)
+    {
+        depscan_write_name(out, vector_peek_ptr_at(deps, i), &column);
+    }
+    fputc('\n', out);
+
+    vector_free(deps);
+    hashmap_free(visited);
+    depscan_free_includes(includes);
+    free(abs_path);
+    return true;
+}
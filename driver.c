@@ -0,0 +1,417 @@
+//
+// Description: 命令行驱动，把命令行参数转换为编译选项，然后在同一个进程中编译所有的输入文件
+// 用法: main [-I DIR] [-D NAME[=VALUE]] [-fsyntax-only] [-fmem-report] [-fkeep-comments] [-fskip-unchanged] [--cache-dir DIR] [--cache-stats] [-M] [-MF FILE] [--pch FILE] [--create-pch FILE] [-o FILE] FILE|-|@MANIFEST...
+// Created by kery on 2024/3/19.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/buffer.h"
+#include "helpers/alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+
+// 编译一个文件时最多提前预读的输入文件数量
+#define COMPILE_DRIVER_PREFETCH_WINDOW 4
+
+/**
+ * @brief 创建一个命令行驱动
+ * @return 命令行驱动
+ */
+struct compile_driver* compile_driver_create()
+{
+    struct compile_driver* driver = calloc(1, sizeof(struct compile_driver));
+    driver->inputs = vector_create(sizeof(struct compile_driver_input));
+    driver->include_dirs = vector_create(sizeof(char*));
+    driver->definitions = vector_create(sizeof(const char*));
+    driver->strings = vector_create(sizeof(char*));
+    // 编译不需要注释和换行token
+    driver->flags = COMPILE_PROCESS_FLAG_COMPACT_TOKENS;
+    driver->cache_dir = getenv("KCOMPILER_CACHE_DIR");
+    return driver;
+}
+
+/**
+ * @brief 记录一个由驱动分配的字符串，释放驱动时一起释放
+ */
+static char* compile_driver_own(struct compile_driver* driver, char* str)
+{
+    vector_push(driver->strings, &str);
+    return str;
+}
+
+/**
+ * @brief 获取输入文件默认的输出文件名，把扩展名替换为.s，标准输入输出到标准输出
+ * @param driver 命令行驱动
+ * @param file_name 输入文件名
+ * @return 输出文件名
+ */
+static const char* compile_driver_default_output(struct compile_driver* driver, const char* file_name)
+{
+    if (S_EQ(file_name, COMPILE_PROCESS_STDIO_NAME))
+    {
+        return COMPILE_PROCESS_STDIO_NAME;
+    }
+
+    size_t len = strlen(file_name);
+    const char* dot = strrchr(file_name, '.');
+    const char* slash = strrchr(file_name, '/');
+    if (dot && (!slash || dot > slash))
+    {
+        len = dot - file_name;
+    }
+    char* out = compile_driver_own(driver, malloc(len + 3));
+    memcpy(out, file_name, len);
+    strcpy(out + len, ".s");
+    return out;
+}
+
+/**
+ * @brief 添加一个输入文件
+ * @param driver 命令行驱动
+ * @param input 输入文件名
+ * @param output 输出文件名，NULL表示使用默认的输出文件名
+ */
+static void compile_driver_add_input(struct compile_driver* driver, const char* input, const char* output)
+{
+    struct compile_driver_input entry = {
+            .input = input,
+            .output = output ? output : compile_driver_default_output(driver, input)
+    };
+    vector_push(driver->inputs, &entry);
+}
+
+/**
+ * @brief 读取一个manifest文件，每行是一个输入文件，后面可以跟一个空格和它的输出文件
+ * 空行和#开头的行会被忽略，文件名中不能有空白字符
+ * @param driver 命令行驱动
+ * @param path manifest文件的路径
+ * @return 是否读取成功
+ */
+static bool compile_driver_read_manifest(struct compile_driver* driver, const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Cannot open the manifest %s\n", path);
+        return false;
+    }
+    // 整个文件读入内存，输入文件名直接指向其中，不需要为每一行分配内存
+    struct buffer* buffer = buffer_create();
+    char chunk[65536];
+    size_t len;
+    while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    {
+        buffer_write_n(buffer, chunk, len);
+    }
+    fclose(fp);
+    buffer_write(buffer, '\0');
+    char* data = compile_driver_own(driver, buffer_detach(buffer));
+
+    for (char* line = data; *line; )
+    {
+        char* end = strchr(line, '\n');
+        char* next = end ? end + 1 : line + strlen(line);
+        if (end)
+        {
+            *end = '\0';
+        }
+
+        char* fields[3] = {NULL};
+        int count = 0;
+        for (char* ptr = line; *ptr && count < 3; )
+        {
+            while (isspace((unsigned char) *ptr))
+            {
+                *ptr++ = '\0';
+            }
+            if (!*ptr)
+            {
+                break;
+            }
+            fields[count++] = ptr;
+            while (*ptr && !isspace((unsigned char) *ptr))
+            {
+                ptr++;
+            }
+        }
+
+        if (count == 3)
+        {
+            fprintf(stderr, "Too many fields in the manifest %s: %s\n", path, fields[0]);
+            return false;
+        }
+        if (count > 0 && fields[0][0] != '#')
+        {
+            compile_driver_add_input(driver, fields[0], fields[1]);
+        }
+        line = next;
+    }
+    return true;
+}
+
+/**
+ * @brief 获取一个需要值的选项的值，值可以紧跟在选项后面，也可以是下一个参数
+ * @param argc 参数的数量
+ * @param argv 参数
+ * @param i 当前参数的位置，使用了下一个参数时会增加
+ * @param option 选项名
+ * @return 选项的值，没有时返回NULL
+ */
+static const char* compile_driver_option_value(int argc, char** argv, int* i, const char* option)
+{
+    const char* arg = argv[*i];
+    size_t len = strlen(option);
+    if (arg[len])
+    {
+        return &arg[len];
+    }
+    if (*i + 1 >= argc)
+    {
+        fprintf(stderr, "Missing value for %s\n", option);
+        return NULL;
+    }
+    return argv[++(*i)];
+}
+
+/**
+ * @brief 解析命令行参数
+ * -o只能在只有一个输入文件时使用，多个输入文件时默认输出到同名的.s文件，或者在manifest中为每个输入指定输出
+ * @param driver 命令行驱动
+ * @param argc 参数的数量，不包括程序名
+ * @param argv 参数
+ * @return 参数是否正确，错误已经输出到stderr
+ */
+bool compile_driver_parse(struct compile_driver* driver, int argc, char** argv)
+{
+    const char* output = NULL;
+    for (int i = 0; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = NULL;
+        if (arg[0] == '@')
+        {
+            if (!compile_driver_read_manifest(driver, &arg[1]))
+            {
+                return false;
+            }
+        }
+        else if (arg[0] != '-' || S_EQ(arg, COMPILE_PROCESS_STDIO_NAME))
+        {
+            compile_driver_add_input(driver, arg, NULL);
+        }
+        else if (S_EQ(arg, "-fsyntax-only"))
+        {
+            driver->flags |= COMPILE_PROCESS_FLAG_SYNTAX_ONLY;
+        }
+        else if (S_EQ(arg, "-fmem-report"))
+        {
+            driver->flags |= COMPILE_PROCESS_FLAG_MEMORY_REPORT;
+        }
+        else if (S_EQ(arg, "-fkeep-comments"))
+        {
+            driver->flags &= ~COMPILE_PROCESS_FLAG_COMPACT_TOKENS;
+        }
+        else if (S_EQ(arg, "-fskip-unchanged"))
+        {
+            driver->flags |= COMPILE_PROCESS_FLAG_SKIP_UNCHANGED;
+        }
+        else if (S_EQ(arg, "-M"))
+        {
+            driver->dependencies = true;
+        }
+        else if (strncmp(arg, "-MF", 3) == 0)
+        {
+            if (!(driver->dependency_file = compile_driver_option_value(argc, argv, &i, "-MF")))
+            {
+                return false;
+            }
+        }
+        else if (S_EQ(arg, "--cache-stats"))
+        {
+            driver->cache_stats = true;
+        }
+        else if (S_EQ(arg, "--cache-dir"))
+        {
+            if (!(driver->cache_dir = compile_driver_option_value(argc, argv, &i, arg)))
+            {
+                return false;
+            }
+        }
+        else if (S_EQ(arg, "--pch") || S_EQ(arg, "--create-pch"))
+        {
+            if (!(value = compile_driver_option_value(argc, argv, &i, arg)))
+            {
+                return false;
+            }
+            *(S_EQ(arg, "--pch") ? &driver->pch : &driver->pch_create) = value;
+        }
+        else if (arg[1] == 'I' || arg[1] == 'D' || arg[1] == 'o')
+        {
+            char option[3] = {'-', arg[1], '\0'};
+            if (!(value = compile_driver_option_value(argc, argv, &i, option)))
+            {
+                return false;
+            }
+            if (arg[1] == 'I')
+            {
+                // 转为绝对路径，这样#include查找缓存与当前目录无关
+                char path[PATH_MAX];
+                char* dir = compile_driver_own(driver, strdup(realpath(value, path) ? path : value));
+                vector_push(driver->include_dirs, &dir);
+            }
+            else if (arg[1] == 'D')
+            {
+                vector_push(driver->definitions, &value);
+            }
+            else
+            {
+                output = value;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option \"%s\"\n", arg);
+            return false;
+        }
+    }
+
+    if (vector_count(driver->inputs) == 0)
+    {
+        fprintf(stderr, "No input files\n");
+        return false;
+    }
+    if (output)
+    {
+        if (vector_count(driver->inputs) != 1)
+        {
+            fprintf(stderr, "-o can only be used with a single input file\n");
+            return false;
+        }
+        ((struct compile_driver_input*) vector_at(driver->inputs, 0))->output = output;
+    }
+    if (driver->pch_create && vector_count(driver->inputs) != 1)
+    {
+        fprintf(stderr, "--create-pch needs exactly one input file\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 为所有的输入文件输出依赖规则(-M)，只扫描#include，不编译
+ * @param driver 命令行驱动，头文件查找目录已经设置
+ * @return 失败的文件数量
+ */
+static int compile_driver_write_dependencies(struct compile_driver* driver)
+{
+    FILE* out = driver->dependency_file ? fopen(driver->dependency_file, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "Cannot open the dependency file %s\n", driver->dependency_file);
+        return vector_count(driver->inputs);
+    }
+    // 头文件的扫描结果在输入文件之间共享
+    struct depscan* scan = depscan_create();
+    int failed = 0;
+    for (size_t i = 0; i < vector_count(driver->inputs); i++)
+    {
+        struct compile_driver_input* input = vector_at(driver->inputs, i);
+        if (!depscan_file(scan, input->input, input->output, out))
+        {
+            failed++;
+        }
+    }
+    depscan_free(scan);
+    if (out != stdout ? fclose(out) != 0 : fflush(out) != 0)
+    {
+        fprintf(stderr, "Failed to write the dependencies\n");
+        failed = vector_count(driver->inputs);
+    }
+    return failed;
+}
+
+/**
+ * @brief 把选项应用到预处理器，然后依次编译所有的输入文件
+ * @param driver 命令行驱动
+ * @return 编译失败的文件数量
+ */
+int compile_driver_run(struct compile_driver* driver)
+{
+    if (driver->flags & COMPILE_PROCESS_FLAG_MEMORY_REPORT)
+    {
+        memory_tracking_enable(true);
+    }
+    preprocessor_set_include_dirs(driver->include_dirs);
+    preprocessor_clear_definitions();
+    for (size_t i = 0; i < vector_count(driver->definitions); i++)
+    {
+        preprocessor_add_definition(vector_peek_ptr_at(driver->definitions, i));
+    }
+
+    if (driver->dependencies)
+    {
+        return compile_driver_write_dependencies(driver);
+    }
+    if (driver->pch_create)
+    {
+        struct compile_driver_input* input = vector_at(driver->inputs, 0);
+        return pch_create(input->input, driver->pch_create, driver->flags) == COMPILER_FILE_COMPILED_OK ? 0 : 1;
+    }
+    if (driver->pch && !pch_use(driver->pch))
+    {
+        fprintf(stderr, "Ignoring the precompiled header %s, it is invalid or out of date\n", driver->pch);
+    }
+
+    // 空字符串表示不使用缓存，可以用来覆盖环境变量
+    const char* cache_dir = driver->cache_dir && driver->cache_dir[0] ? driver->cache_dir : NULL;
+    if (!compile_cache_set_dir(cache_dir))
+    {
+        fprintf(stderr, "Ignoring the cache directory %s, it cannot be created\n", cache_dir);
+    }
+
+    // 多个输入文件时在后台预读之后的文件，编译和读取文件重叠进行
+    struct compile_prefetch* prefetch = NULL;
+    if (vector_count(driver->inputs) > 1)
+    {
+        prefetch = compile_prefetch_start(driver->inputs, COMPILE_DRIVER_PREFETCH_WINDOW);
+    }
+    int failed = 0;
+    for (size_t i = 0; i < vector_count(driver->inputs); i++)
+    {
+        struct compile_driver_input* input = vector_at(driver->inputs, i);
+        compile_prefetch_advance(prefetch, i);
+        if (compile_file(input->input, input->output, driver->flags) != COMPILER_FILE_COMPILED_OK)
+        {
+            fprintf(stderr, "Failed to compile %s\n", input->input);
+            failed++;
+        }
+    }
+    compile_prefetch_stop(prefetch);
+
+    if (driver->cache_stats && compile_cache_enabled())
+    {
+        struct compile_cache_stats stats;
+        compile_cache_stats_get(&stats);
+        fprintf(stderr, "Cache %s: %zu hits, %zu misses, %zu stored, %zu store errors\n",
+                cache_dir, stats.hits, stats.misses, stats.stores, stats.errors);
+    }
+    return failed;
+}
+
+/**
+ * @brief 释放命令行驱动
+ */
+void compile_driver_free(struct compile_driver* driver)
+{
+    for (size_t i = 0; i < vector_count(driver->strings); i++)
+    {
+        free(vector_peek_ptr_at(driver->strings, i));
+    }
+    vector_free(driver->strings);
+    vector_free(driver->inputs);
+    vector_free(driver->include_dirs);
+    vector_free(driver->definitions);
+    free(driver);
+}
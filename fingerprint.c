@@ -0,0 +1,370 @@
+//
+// Description: 源文件指纹，只由token的类型和拼写决定，注释、空白和位置不影响指纹。
+// 输入文件和它包含的头文件的指纹都和上次编译时相同时，说明只改动了格式或注释，可以跳过预处理之后的阶段
+// Created by kery on 2024/3/25.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/fingerprint.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+/**
+ * 指纹文件保存在输出文件旁边，是文本格式：
+ *   第一行: "kfp1 <配置的指纹>"，配置包括编译选项、-I和-D
+ *   之后每行: "<指纹> <路径>"，第一行是输入文件，之后是它包含的头文件
+ *   最后每行: "@<0|1>\t<包含者的目录>\t<名字>\t<找到的路径>"，一条#include的查找结果，
+ *   0|1表示是否是<xxx>形式，找不到时路径为空。查找结果改变(例如新加入的头文件遮住了原来的头文件)时不能跳过
+ * 配置的指纹还包含了FINGERPRINT_FORMAT_VERSION，token的指纹计算方式改变时修改它，旧的指纹文件随之失效
+ */
+#define FINGERPRINT_FILE_SUFFIX ".kfp"
+#define FINGERPRINT_FILE_MAGIC "kfp2"
+#define FINGERPRINT_FORMAT_VERSION 1
+
+// 指纹中表示预处理指令开始和结束的标记，与token类型不同
+enum
+{
+    FINGERPRINT_MARK_DIRECTIVE = 0x100,
+    FINGERPRINT_MARK_DIRECTIVE_END
+};
+
+/**
+ * @brief 把一个token的类型和拼写加入指纹
+ * @param space_before token之前是否有空白，只在预处理指令中有意义，会影响宏定义(例如F(x)和F (x))
+ */
+static void fingerprint_token(struct fingerprint* fingerprint, struct token* token, bool space_before)
+{
+    uint64_t head = (uint64_t) token->type | ((uint64_t) (token->flag & TOKEN_FLAG_ANGLE_BRACKETS) << 16);
+    if (space_before)
+    {
+        head |= 1ULL << 32;
+    }
+    fingerprint_update_u64(fingerprint, head);
+    switch (token->type)
+    {
+        case TOKEN_TYPE_IDENTIFIER:
+        case TOKEN_TYPE_KEYWORD:
+        case TOKEN_TYPE_OPERATOR:
+        case TOKEN_TYPE_STRING:
+            fingerprint_update_str(fingerprint, token->sval);
+            break;
+        case TOKEN_TYPE_NUMBER:
+            fingerprint_update_u64(fingerprint, token->llnum);
+            fingerprint_update_u64(fingerprint, token->num.type);
+            break;
+        case TOKEN_TYPE_SYMBOL:
+            fingerprint_update_u64(fingerprint, (unsigned char) token->cval);
+            break;
+    }
+}
+
+/**
+ * @brief 计算词法分析得到的token的指纹
+ * 注释、空白和位置不参与计算。换行只在结束预处理指令时有意义，因此只记录指令的开始和结束，
+ * 普通代码的换行被忽略。两种词法分析模式(是否产生换行和注释token)得到相同的指纹，
+ * 只有#if 0控制的代码在不产生换行token的模式中被直接跳过，不参与计算
+ * @param tokens token向量，元素为struct token
+ * @param fingerprint 保存计算结果
+ */
+void token_fingerprint(struct vector* tokens, struct fingerprint* fingerprint)
+{
+    struct fingerprint state;
+    fingerprint_init(&state);
+    bool at_line_start = true;
+    bool in_directive = false;
+    // token的whitespace表示它之后有空白，注释也相当于空白，行尾的空白没有意义
+    bool space = false;
+    size_t count = vector_count(tokens);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct token* token = vector_at(tokens, i);
+        if (token_is_comment(token))
+        {
+            space = true;
+            continue;
+        }
+        // 行尾的\把下一行接到指令中，不产生换行token的模式中词法分析已经去掉了它们
+        if (token_is_symbol(token, '\\') && i + 1 < count && token_is_newline(vector_at(tokens, i + 1)))
+        {
+            i++;
+            space = space || token->whitespace || ((struct token*) vector_at(tokens, i))->whitespace;
+            continue;
+        }
+        if (token_is_newline(token) || token_is_line_start(token))
+        {
+            if (in_directive)
+            {
+                fingerprint_update_u64(&state, FINGERPRINT_MARK_DIRECTIVE_END);
+                in_directive = false;
+            }
+            at_line_start = true;
+            space = false;
+            if (token_is_newline(token))
+            {
+                continue;
+            }
+        }
+        if (at_line_start && token_is_symbol(token, '#'))
+        {
+            fingerprint_update_u64(&state, FINGERPRINT_MARK_DIRECTIVE);
+            in_directive = true;
+            // 行首的空白和注释不影响指令
+            space = false;
+        }
+        at_line_start = false;
+        fingerprint_token(&state, token, in_directive && space);
+        space = token->whitespace;
+    }
+    if (in_directive)
+    {
+        fingerprint_update_u64(&state, FINGERPRINT_MARK_DIRECTIVE_END);
+    }
+    *fingerprint = fingerprint_finish(&state);
+}
+
+/**
+ * @brief 计算编译配置的指纹，配置不同时即使源文件相同输出也可能不同
+ * @param flags 编译选项
+ */
+static void compile_fingerprint_config(int flags, struct fingerprint* fingerprint)
+{
+    struct fingerprint state;
+    fingerprint_init(&state);
+    fingerprint_update_u64(&state, FINGERPRINT_FORMAT_VERSION);
+    // 内存报告和是否跳过都不影响输出
+    fingerprint_update_u64(&state, flags & ~(COMPILE_PROCESS_FLAG_MEMORY_REPORT | COMPILE_PROCESS_FLAG_SKIP_UNCHANGED));
+    struct vector* lists[] = {preprocessor_include_dirs(), preprocessor_command_line_definitions()};
+    for (int i = 0; i < 2; i++)
+    {
+        size_t count = lists[i] ? vector_count(lists[i]) : 0;
+        fingerprint_update_u64(&state, count);
+        for (size_t j = 0; j < count; j++)
+        {
+            fingerprint_update_str(&state, vector_peek_ptr_at(lists[i], j));
+        }
+    }
+    *fingerprint = fingerprint_finish(&state);
+}
+
+/**
+ * @brief 获取输出文件对应的指纹文件的路径
+ * @return 路径，由调用者释放
+ */
+static char* compile_fingerprint_path(const char* out_filename)
+{
+    size_t len = strlen(out_filename);
+    char* path = malloc(len + sizeof(FINGERPRINT_FILE_SUFFIX));
+    memcpy(path, out_filename, len);
+    strcpy(path + len, FINGERPRINT_FILE_SUFFIX);
+    return path;
+}
+
+/**
+ * @brief 读取指纹文件中的一行，格式为"<指纹> <内容>"
+ * @param line 读取到的行，行尾的换行被去掉
+ * @param fingerprint 保存行首的指纹
+ * @return 指纹之后的内容，格式错误时返回NULL
+ */
+static char* compile_fingerprint_parse_line(char* line, struct fingerprint* fingerprint)
+{
+    line[strcspn(line, "\n")] = '\0';
+    if (!fingerprint_parse(line, fingerprint) || line[FINGERPRINT_HEX_LENGTH] != ' ')
+    {
+        return NULL;
+    }
+    return &line[FINGERPRINT_HEX_LENGTH + 1];
+}
+
+/**
+ * @brief 检查指纹文件中记录的一条#include的查找结果是否仍然相同
+ * @param line "@"之后的内容，格式为"<0|1>\t<包含者的目录>\t<名字>\t<找到的路径>"，会被修改
+ * @return 同样的查找是否仍然找到同一个文件(或者仍然找不到)，格式错误时返回false
+ */
+static bool compile_fingerprint_lookup_unchanged(char* line)
+{
+    char* fields[4];
+    for (int i = 0; i < 4; i++)
+    {
+        fields[i] = line;
+        line = i < 3 ? strchr(line, '\t') : NULL;
+        if (i < 3 && !line)
+        {
+            return false;
+        }
+        if (line)
+        {
+            *line++ = '\0';
+        }
+    }
+    bool angle_brackets = S_EQ(fields[0], "1");
+    char path[PATH_MAX];
+    if (!preprocessor_resolve_include(fields[2], angle_brackets, fields[1], path))
+    {
+        return fields[3][0] == '\0';
+    }
+    return S_EQ(path, fields[3]);
+}
+
+/**
+ * @brief 判断输入文件和它包含的头文件是否都和上次编译时相同(忽略注释、空白和位置)，相同时输出文件不需要重新生成
+ * @param process 编译过程，头文件按它的编译选项进行词法分析
+ * @param fingerprint 输入文件的指纹
+ * @param out_filename 输出文件
+ * @return 是否可以跳过之后的编译阶段
+ */
+bool compile_fingerprint_unchanged(struct compile_process* process, struct fingerprint* fingerprint, const char* out_filename)
+{
+    if (access(out_filename, F_OK) != 0)
+    {
+        return false;
+    }
+    char* path = compile_fingerprint_path(out_filename);
+    FILE* fp = fopen(path, "r");
+    free(path);
+    if (!fp)
+    {
+        return false;
+    }
+
+    struct fingerprint config;
+    compile_fingerprint_config(process->flags, &config);
+    char config_hex[FINGERPRINT_HEX_LENGTH + 1];
+    fingerprint_format(&config, config_hex);
+    char expected[sizeof(FINGERPRINT_FILE_MAGIC) + FINGERPRINT_HEX_LENGTH + 1];
+    snprintf(expected, sizeof(expected), "%s %s", FINGERPRINT_FILE_MAGIC, config_hex);
+
+    // 查找结果的一行有三个路径
+    char line[PATH_MAX * 3 + 8];
+    bool unchanged = fgets(line, sizeof(line), fp) && strncmp(line, expected, strlen(expected)) == 0;
+    // 第一行是输入文件本身，之后是头文件
+    bool first = true;
+    while (unchanged && fgets(line, sizeof(line), fp))
+    {
+        if (line[0] == '@')
+        {
+            line[strcspn(line, "\n")] = '\0';
+            unchanged = compile_fingerprint_lookup_unchanged(&line[1]);
+            continue;
+        }
+        struct fingerprint stored;
+        struct fingerprint current;
+        const char* file = compile_fingerprint_parse_line(line, &stored);
+        if (!file)
+        {
+            unchanged = false;
+            break;
+        }
+        if (first)
+        {
+            current = *fingerprint;
+            unchanged = S_EQ(file, process->cfile.abs_path);
+            first = false;
+        }
+        else
+        {
+            struct vector* tokens = preprocessor_header_tokens(process, file);
+            if (!tokens)
+            {
+                unchanged = false;
+                break;
+            }
+            token_fingerprint(tokens, &current);
+        }
+        unchanged = unchanged && fingerprint_equal(&stored, &current);
+    }
+    fclose(fp);
+    return unchanged && !first;
+}
+
+/**
+ * @brief 删除输出文件对应的指纹文件，输出文件要被重新写入时调用，
+ * 编译失败或者不带-fskip-unchanged的编译改写了输出文件之后，旧的指纹不再与输出相符
+ * @param out_filename 输出文件
+ */
+void compile_fingerprint_invalidate(const char* out_filename)
+{
+    char* path = compile_fingerprint_path(out_filename);
+    remove(path);
+    free(path);
+}
+
+/**
+ * @brief 编译成功后把输入文件和它包含的头文件的指纹写入指纹文件，先写入临时文件再重命名，不会留下写了一半的指纹文件
+ * @param process 编译过程，已经完成预处理
+ * @param fingerprint 输入文件的指纹
+ * @param out_filename 输出文件
+ */
+void compile_fingerprint_store(struct compile_process* process, struct fingerprint* fingerprint, const char* out_filename)
+{
+    char* path = compile_fingerprint_path(out_filename);
+    size_t len = strlen(path);
+    char* tmp_path = malloc(len + 32);
+    snprintf(tmp_path, len + 32, "%s.%ld.tmp", path, (long) getpid());
+    FILE* fp = fopen(tmp_path, "w");
+    if (!fp)
+    {
+        free(tmp_path);
+        free(path);
+        return;
+    }
+
+    char hex[FINGERPRINT_HEX_LENGTH + 1];
+    struct fingerprint config;
+    compile_fingerprint_config(process->flags, &config);
+    fingerprint_format(&config, hex);
+    fprintf(fp, "%s %s\n", FINGERPRINT_FILE_MAGIC, hex);
+    fingerprint_format(fingerprint, hex);
+    fprintf(fp, "%s %s\n", hex, process->cfile.abs_path);
+
+    // 同一个头文件可能被包含多次，只记录一次
+    struct hashmap* written = hashmap_create();
+    struct vector* included = process->preprocessor ? process->preprocessor->included : NULL;
+    for (size_t i = 0; included && i < vector_count(included); i++)
+    {
+        struct preprocessor_header* header = vector_peek_ptr_at(included, i);
+        if (hashmap_get(written, header->path))
+        {
+            continue;
+        }
+        hashmap_set(written, header->path, header);
+        // 从预编译头文件恢复的头文件只有路径，token从头文件缓存中获取
+        struct vector* tokens = preprocessor_header_tokens(process, header->path);
+        if (!tokens)
+        {
+            continue;
+        }
+        struct fingerprint header_fingerprint;
+        token_fingerprint(tokens, &header_fingerprint);
+        fingerprint_format(&header_fingerprint, hex);
+        fprintf(fp, "%s %s\n", hex, header->path);
+    }
+    hashmap_free(written);
+
+    // 同样的查找只记录一次
+    struct hashmap* lookups = hashmap_create();
+    struct vector* include_lookups = process->preprocessor ? process->preprocessor->include_lookups : NULL;
+    for (size_t i = 0; include_lookups && i < vector_count(include_lookups); i++)
+    {
+        struct preprocessor_include_lookup* lookup = vector_at(include_lookups, i);
+        char key[PATH_MAX * 2 + 4];
+        snprintf(key, sizeof(key), "%d\t%s\t%s", lookup->angle_brackets, lookup->dir, lookup->name);
+        if (hashmap_get(lookups, key))
+        {
+            continue;
+        }
+        hashmap_set(lookups, key, lookup);
+        fprintf(fp, "@%s\t%s\n", key, lookup->path ? lookup->path : "");
+    }
+    hashmap_free(lookups);
+
+    bool ok = fclose(fp) == 0;
+    if (!ok || rename(tmp_path, path) != 0)
+    {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    free(path);
+}
@@ -0,0 +1,143 @@
+//
+// Created by kery on 2024/3/22.
+//
+
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+static bool memory_tracking = false;
+static int memory_phase = MEMORY_PHASE_OTHER;
+static struct memory_stats memory_stats;
+
+void memory_tracking_enable(bool enable)
+{
+    memory_tracking = enable;
+}
+
+bool memory_tracking_enabled()
+{
+    return memory_tracking;
+}
+
+int memory_set_phase(int phase)
+{
+    int previous = memory_phase;
+    memory_phase = phase;
+    return previous;
+}
+
+const char* memory_phase_name(int phase)
+{
+    static const char* names[MEMORY_PHASE_COUNT] = {
+            [MEMORY_PHASE_OTHER] = "other",
+            [MEMORY_PHASE_LEX] = "lex",
+            [MEMORY_PHASE_PREPROCESS] = "preprocess",
+            [MEMORY_PHASE_PARSE] = "parse",
+            [MEMORY_PHASE_CODEGEN] = "codegen"
+    };
+    return phase >= 0 && phase < MEMORY_PHASE_COUNT ? names[phase] : "unknown";
+}
+
+void memory_stats_get(struct memory_stats* stats)
+{
+    *stats = memory_stats;
+}
+
+void memory_stats_reset_peak()
+{
+    memory_stats.peak = memory_stats.live;
+}
+
+/**
+ * The allocator knows the size of every block, so no header is needed and
+ * pointers stay interchangeable with plain malloc and free
+ */
+static void memory_track_alloc(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    size_t size = malloc_usable_size(ptr);
+    struct memory_phase_stats* phase = &memory_stats.phases[memory_phase];
+    phase->allocations++;
+    phase->allocated += size;
+    memory_stats.allocations++;
+    memory_stats.live += size;
+    if (memory_stats.live > memory_stats.peak)
+    {
+        memory_stats.peak = memory_stats.live;
+    }
+}
+
+static void memory_track_free(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    size_t size = malloc_usable_size(ptr);
+    memory_stats.phases[memory_phase].freed += size;
+    // Blocks from before tracking was enabled were never added
+    memory_stats.live -= size < memory_stats.live ? size : memory_stats.live;
+}
+
+void* mem_malloc(size_t size)
+{
+    void* ptr = malloc(size);
+    if (memory_tracking)
+    {
+        memory_track_alloc(ptr);
+    }
+    return ptr;
+}
+
+void* mem_calloc(size_t count, size_t size)
+{
+    void* ptr = calloc(count, size);
+    if (memory_tracking)
+    {
+        memory_track_alloc(ptr);
+    }
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size)
+{
+    if (!memory_tracking)
+    {
+        return realloc(ptr, size);
+    }
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void* new_ptr = realloc(ptr, size);
+    if (!new_ptr)
+    {
+        return NULL;
+    }
+    memory_stats.phases[memory_phase].freed += old_size;
+    memory_stats.live -= old_size < memory_stats.live ? old_size : memory_stats.live;
+    memory_track_alloc(new_ptr);
+    return new_ptr;
+}
+
+char* mem_strdup(const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* copy = mem_malloc(len);
+    if (copy)
+    {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void mem_free(void* ptr)
+{
+    if (memory_tracking)
+    {
+        memory_track_free(ptr);
+    }
+    free(ptr);
+}
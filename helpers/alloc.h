@@ -0,0 +1,70 @@
+//
+// Created by kery on 2024/3/22.
+//
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * The phase an allocation is charged to, set by the compiler around each stage of compile_file
+ */
+enum
+{
+    MEMORY_PHASE_OTHER,
+    MEMORY_PHASE_LEX,
+    MEMORY_PHASE_PREPROCESS,
+    MEMORY_PHASE_PARSE,
+    MEMORY_PHASE_CODEGEN,
+    MEMORY_PHASE_COUNT
+};
+
+struct memory_phase_stats
+{
+    size_t allocations;
+    // Bytes allocated and freed while the phase was active, realloc counts as a free and an allocation
+    size_t allocated;
+    size_t freed;
+};
+
+struct memory_stats
+{
+    // Bytes currently allocated through the wrappers and the highest value that reached
+    size_t live;
+    size_t peak;
+    size_t allocations;
+    struct memory_phase_stats phases[MEMORY_PHASE_COUNT];
+};
+
+/**
+ * Tracking is off by default and the wrappers then cost a single branch.
+ * Memory allocated before tracking was enabled is not counted when it is freed
+ */
+void memory_tracking_enable(bool enable);
+bool memory_tracking_enabled();
+
+/**
+ * Sets the phase new allocations are charged to and returns the previous one
+ */
+int memory_set_phase(int phase);
+const char* memory_phase_name(int phase);
+
+void memory_stats_get(struct memory_stats* stats);
+
+/**
+ * Lowers the peak to the current live bytes so the peak of the next piece of work can be measured
+ */
+void memory_stats_reset_peak();
+
+/**
+ * Same as their libc counterparts, memory from them can also be released with free but it then shows up as leaked
+ */
+void* mem_malloc(size_t size);
+void* mem_calloc(size_t count, size_t size);
+void* mem_realloc(void* ptr, size_t size);
+char* mem_strdup(const char* str);
+void mem_free(void* ptr);
+
+#endif //ALLOC_H
@@ -0,0 +1,70 @@
+//
+// Created by kery on 2024/3/10.
+//
+
+#include "arena.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Allocations are rounded up to this, block data starts at this alignment too
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+static struct arena_block* arena_block_create(size_t size)
+{
+    struct arena_block* block = mem_calloc(1, sizeof(struct arena_block) + size);
+    assert(block);
+    block->size = size;
+    return block;
+}
+
+struct arena* arena_create()
+{
+    struct arena* arena = mem_calloc(1, sizeof(struct arena));
+    return arena;
+}
+
+void* arena_alloc(struct arena* arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+    struct arena_block* block = arena->head;
+    if (block && size > ARENA_BLOCK_SIZE)
+    {
+        // Oversized requests get their own block behind the head, the rest of the head stays in use
+        block = arena_block_create(size);
+        block->next = arena->head->next;
+        arena->head->next = block;
+    }
+    else if (!block || block->size - block->used < size)
+    {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = arena_block_create(block_size);
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+void* arena_memdup(struct arena* arena, const void* ptr, size_t size)
+{
+    void* copy = arena_alloc(arena, size);
+    memcpy(copy, ptr, size);
+    return copy;
+}
+
+void arena_free(struct arena* arena)
+{
+    struct arena_block* block = arena->head;
+    while (block)
+    {
+        struct arena_block* next = block->next;
+        mem_free(block);
+        block = next;
+    }
+    mem_free(arena);
+}
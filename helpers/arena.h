@@ -0,0 +1,46 @@
+//
+// Created by kery on 2024/3/10.
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Every block of the arena is at least this large, bigger allocations get a block of their own
+#define ARENA_BLOCK_SIZE 65536
+
+struct arena_block
+{
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+    // The header is 24 bytes, without this the data would only be 8-byte aligned
+    _Alignas(max_align_t) char data[];
+};
+
+/**
+ * A bump allocator, memory is only ever released all at once with arena_free.
+ * Useful for many small allocations that share the same lifetime
+ */
+struct arena
+{
+    struct arena_block* head;
+    // Total bytes handed out so far
+    size_t allocated;
+};
+
+struct arena* arena_create();
+
+/**
+ * Returns size bytes of zeroed memory aligned for any type
+ */
+void* arena_alloc(struct arena* arena, size_t size);
+
+/**
+ * Copies the given bytes into the arena and returns the copy
+ */
+void* arena_memdup(struct arena* arena, const void* ptr, size_t size);
+void arena_free(struct arena* arena);
+
+#endif //ARENA_H
@@ -2,45 +2,136 @@
 // Created by kery on 2024/2/24.
 //
 #include "buffer.h"
+#include "alloc.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
 
-struct buffer* buffer_create()
+void buffer_init(struct buffer* buffer)
+{
+    memset(buffer, 0, sizeof(struct buffer));
+    buffer->data = buffer->inline_data;
+    buffer->msize = BUFFER_INLINE_SIZE;
+}
+
+struct buffer* buffer_create_sized(size_t size)
 {
-    struct buffer* buf = calloc(sizeof(struct buffer), 1);
-    buf->data = calloc(BUFFER_REALLOC_AMOUNT, 1);
-    buf->len = 0;
-    buf->msize = BUFFER_REALLOC_AMOUNT;
+    struct buffer* buf = mem_calloc(sizeof(struct buffer), 1);
+    buf->data = buf->inline_data;
+    buf->msize = BUFFER_INLINE_SIZE;
+    if (size > BUFFER_INLINE_SIZE)
+    {
+        buf->data = mem_calloc(size, 1);
+        buf->msize = size;
+    }
     return buf;
 }
 
+struct buffer* buffer_create()
+{
+    return buffer_create_sized(0);
+}
+
+static bool buffer_is_inline(struct buffer* buffer)
+{
+    return buffer->data == buffer->inline_data;
+}
+
+/**
+ * Aborts, the buffer can not grow any further without its size overflowing
+ */
+static void buffer_overflow()
+{
+    fprintf(stderr, "Buffer size overflow\n");
+    abort();
+}
+
 void buffer_extend(struct buffer* buffer, size_t size)
 {
-    buffer->data = realloc(buffer->data, buffer->msize+size);
+    if (size > SIZE_MAX - buffer->msize)
+    {
+        buffer_overflow();
+    }
+    char* data;
+    if (buffer_is_inline(buffer))
+    {
+        // Leaving the inline storage, the contents move to the heap once
+        data = mem_malloc(buffer->msize + size);
+        if (data)
+        {
+            memcpy(data, buffer->inline_data, buffer->msize);
+        }
+    }
+    else
+    {
+        data = mem_realloc(buffer->data, buffer->msize + size);
+    }
+    if (!data)
+    {
+        buffer_overflow();
+    }
+    buffer->data = data;
     buffer->msize+=size;
 }
 
+/**
+ * Makes sure at least size more bytes fit after len. The capacity doubles so that
+ * appending many small pieces only reallocates a logarithmic number of times
+ */
 void buffer_need(struct buffer* buffer, size_t size)
 {
-    if (buffer->msize <= (buffer->len+size))
+    if (size > SIZE_MAX - buffer->len)
     {
-        size += BUFFER_REALLOC_AMOUNT;
-        buffer_extend(buffer, size);
+        buffer_overflow();
     }
+    size_t needed = buffer->len + size;
+    if (buffer->msize >= needed)
+    {
+        return;
+    }
+
+    size_t msize = buffer->msize ? buffer->msize : BUFFER_REALLOC_AMOUNT;
+    while (msize < needed)
+    {
+        // Past half of the address space doubling would overflow, take exactly what is needed
+        msize = msize > SIZE_MAX / 2 ? needed : msize * 2;
+    }
+    buffer_extend(buffer, msize - buffer->msize);
 }
 
+/**
+ * Appends the formatted text, the output is measured first so it is never truncated.
+ * Returns the amount of characters appended, the terminator is written after them
+ * but not counted in len
+ */
+static int buffer_append_vprintf(struct buffer* buffer, const char* fmt, va_list args)
+{
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if (len < 0)
+    {
+        return 0;
+    }
+    buffer_need(buffer, len + 1);
+    vsnprintf(&buffer->data[buffer->len], len + 1, fmt, args);
+    return len;
+}
+
+void buffer_vprintf(struct buffer* buffer, const char* fmt, va_list args)
+{
+    buffer->len += buffer_append_vprintf(buffer, fmt, args);
+}
 
 void buffer_printf(struct buffer* buffer, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    int index = buffer->len;
-    // Temporary, this is a limitation we are guessing the size is no more than 2048
-    int len = 2048;
-    buffer_extend(buffer, len);
-    int actual_len = vsnprintf(&buffer->data[index], len, fmt, args);
-    buffer->len += actual_len;
+    buffer_vprintf(buffer, fmt, args);
     va_end(args);
 }
 
@@ -48,15 +139,48 @@ void buffer_printf_no_terminator(struct buffer* buffer, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    int index = buffer->len;
-    // Temporary, this is a limitation we are guessing the size is no more than 2048
-    int len = 2048;
-    buffer_extend(buffer, len);
-    int actual_len = vsnprintf(&buffer->data[index], len, fmt, args);
-    buffer->len += actual_len-1;
+    // The terminator is never counted in len, so this appends exactly the same text as buffer_printf
+    buffer->len += buffer_append_vprintf(buffer, fmt, args);
     va_end(args);
 }
 
+void buffer_write_n(struct buffer* buffer, const char* data, size_t len)
+{
+    buffer_need(buffer, len);
+    memcpy(&buffer->data[buffer->len], data, len);
+    buffer->len += len;
+}
+
+void buffer_write_str(struct buffer* buffer, const char* str)
+{
+    buffer_write_n(buffer, str, strlen(str));
+}
+
+void buffer_write_uint(struct buffer* buffer, unsigned long long value)
+{
+    // Digits are produced from the lowest one, fill a scratch array from the end
+    char digits[20];
+    int index = sizeof(digits);
+    do
+    {
+        digits[--index] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    buffer_write_n(buffer, &digits[index], sizeof(digits) - index);
+}
+
+void buffer_write_int(struct buffer* buffer, long long value)
+{
+    if (value < 0)
+    {
+        buffer_write(buffer, '-');
+        // Negate as unsigned so LLONG_MIN does not overflow
+        buffer_write_uint(buffer, -(unsigned long long) value);
+        return;
+    }
+    buffer_write_uint(buffer, value);
+}
+
 void buffer_write(struct buffer* buffer, char c)
 {
     buffer_need(buffer, sizeof(char));
@@ -70,30 +194,58 @@ void* buffer_ptr(struct buffer* buffer)
     return buffer->data;
 }
 
-char buffer_read(struct buffer* buffer)
+int buffer_read(struct buffer* buffer)
 {
     if (buffer->rindex >= buffer->len)
     {
         return -1;
     }
-    char c = buffer->data[buffer->rindex];
+    unsigned char c = buffer->data[buffer->rindex];
     buffer->rindex++;
     return c;
 }
 
-char buffer_peek(struct buffer* buffer)
+int buffer_peek(struct buffer* buffer)
 {
     if (buffer->rindex >= buffer->len)
     {
         return -1;
     }
-    char c = buffer->data[buffer->rindex];
+    unsigned char c = buffer->data[buffer->rindex];
     return c;
 }
 
+void buffer_release(struct buffer* buffer)
+{
+    if (!buffer_is_inline(buffer))
+    {
+        mem_free(buffer->data);
+    }
+    buffer->data = buffer->inline_data;
+    buffer->len = 0;
+    buffer->rindex = 0;
+    buffer->msize = BUFFER_INLINE_SIZE;
+}
+
 void buffer_free(struct buffer* buffer)
 {
-    free(buffer->data);
-    free(buffer);
+    buffer_release(buffer);
+    mem_free(buffer);
+}
+
+char* buffer_detach(struct buffer* buffer)
+{
+    char* data = buffer->data;
+    if (buffer_is_inline(buffer))
+    {
+        data = mem_malloc(buffer->msize);
+        if (!data)
+        {
+            buffer_overflow();
+        }
+        memcpy(data, buffer->inline_data, buffer->msize);
+    }
+    mem_free(buffer);
+    return data;
 }
 
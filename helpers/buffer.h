@@ -7,28 +7,72 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdarg.h>
 
 #define BUFFER_REALLOC_AMOUNT 2000
+// Bytes a buffer holds inside its own struct before it needs a separate data block
+#define BUFFER_INLINE_SIZE 64
 struct buffer
 {
+    // Points at inline_data until the contents outgrow it
     char* data;
     // Read index
-    int rindex;
-    int len;
-    int msize;
+    size_t rindex;
+    size_t len;
+    size_t msize;
+    char inline_data[BUFFER_INLINE_SIZE];
 };
 
+/**
+ * Creates a buffer on the heap, small contents live in the same allocation as the buffer
+ */
 struct buffer* buffer_create();
 
-char buffer_read(struct buffer* buffer);
-char buffer_peek(struct buffer* buffer);
+/**
+ * Creates a buffer that holds size bytes before growing
+ */
+struct buffer* buffer_create_sized(size_t size);
+
+/**
+ * Initialises a buffer the caller allocated, usually on the stack for a temporary.
+ * Release it with buffer_release. While the contents fit inline the data points into the struct,
+ * so an initialised buffer must not be copied or moved
+ */
+void buffer_init(struct buffer* buffer);
+void buffer_release(struct buffer* buffer);
+
+/**
+ * Returns the next byte as an unsigned char value, or -1 once every byte was read
+ */
+int buffer_read(struct buffer* buffer);
+int buffer_peek(struct buffer* buffer);
 
 void buffer_extend(struct buffer* buffer, size_t size);
+void buffer_need(struct buffer* buffer, size_t size);
+
+/**
+ * Formatted appends, the buffer grows as much as the output needs.
+ * buffer_printf leaves a terminator after the data so buffer_ptr can be used as a string
+ */
 void buffer_printf(struct buffer* buffer, const char* fmt, ...);
+void buffer_vprintf(struct buffer* buffer, const char* fmt, va_list args);
 void buffer_printf_no_terminator(struct buffer* buffer, const char* fmt, ...);
+
+/**
+ * Appends without any format parsing, these do not write a terminator
+ */
 void buffer_write(struct buffer* buffer, char c);
+void buffer_write_n(struct buffer* buffer, const char* data, size_t len);
+void buffer_write_str(struct buffer* buffer, const char* str);
+void buffer_write_int(struct buffer* buffer, long long value);
+void buffer_write_uint(struct buffer* buffer, unsigned long long value);
 void* buffer_ptr(struct buffer* buffer);
 void buffer_free(struct buffer* buffer);
 
+/**
+ * Frees a buffer from buffer_create but keeps its contents, returned as a heap block the caller owns
+ */
+char* buffer_detach(struct buffer* buffer);
+
 
 #endif
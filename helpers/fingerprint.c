@@ -0,0 +1,125 @@
+//
+// Created by kery on 2024/3/25.
+//
+
+#include "fingerprint.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FINGERPRINT_C1 0x87c37b91114253d5ULL
+#define FINGERPRINT_C2 0x4cf5ad432745937fULL
+
+static uint64_t fingerprint_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Final avalanche of one lane so every input bit affects every output bit
+ */
+static uint64_t fingerprint_fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static void fingerprint_mix_block(struct fingerprint* fingerprint, uint64_t block)
+{
+    uint64_t k1 = fingerprint_rotl(block * FINGERPRINT_C1, 31) * FINGERPRINT_C2;
+    fingerprint->low ^= k1;
+    fingerprint->low = fingerprint_rotl(fingerprint->low, 27) + fingerprint->high;
+    fingerprint->low = fingerprint->low * 5 + 0x52dce729;
+
+    uint64_t k2 = fingerprint_rotl(block * FINGERPRINT_C2, 33) * FINGERPRINT_C1;
+    fingerprint->high ^= k2;
+    fingerprint->high = fingerprint_rotl(fingerprint->high, 31) + fingerprint->low;
+    fingerprint->high = fingerprint->high * 5 + 0x38495ab5;
+}
+
+void fingerprint_init(struct fingerprint* fingerprint)
+{
+    fingerprint->low = 0x9e3779b97f4a7c15ULL;
+    fingerprint->high = 0xbf58476d1ce4e5b9ULL;
+}
+
+void fingerprint_update(struct fingerprint* fingerprint, const void* data, size_t len)
+{
+    const unsigned char* bytes = data;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t block;
+        memcpy(&block, &bytes[i], sizeof(block));
+        fingerprint_mix_block(fingerprint, block);
+    }
+    // The tail is padded with the length so "a" and "a\0" differ
+    uint64_t tail = (uint64_t) len << 56;
+    for (size_t shift = 0; i < len; i++, shift += 8)
+    {
+        tail |= (uint64_t) bytes[i] << shift;
+    }
+    fingerprint_mix_block(fingerprint, tail);
+}
+
+void fingerprint_update_u64(struct fingerprint* fingerprint, uint64_t value)
+{
+    fingerprint_mix_block(fingerprint, value);
+}
+
+void fingerprint_update_str(struct fingerprint* fingerprint, const char* str)
+{
+    fingerprint_update(fingerprint, str, strlen(str));
+}
+
+struct fingerprint fingerprint_finish(struct fingerprint* fingerprint)
+{
+    struct fingerprint result = *fingerprint;
+    result.low += result.high;
+    result.high += result.low;
+    result.low = fingerprint_fmix(result.low);
+    result.high = fingerprint_fmix(result.high);
+    result.low += result.high;
+    result.high += result.low;
+    return result;
+}
+
+bool fingerprint_equal(struct fingerprint* a, struct fingerprint* b)
+{
+    return a->low == b->low && a->high == b->high;
+}
+
+void fingerprint_format(struct fingerprint* fingerprint, char* out)
+{
+    snprintf(out, FINGERPRINT_HEX_LENGTH + 1, "%016llx%016llx",
+             (unsigned long long) fingerprint->high, (unsigned long long) fingerprint->low);
+}
+
+bool fingerprint_parse(const char* str, struct fingerprint* fingerprint)
+{
+    uint64_t parts[2] = {0, 0};
+    for (int i = 0; i < FINGERPRINT_HEX_LENGTH; i++)
+    {
+        char c = str[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        parts[i / 16] = (parts[i / 16] << 4) | digit;
+    }
+    fingerprint->high = parts[0];
+    fingerprint->low = parts[1];
+    return true;
+}
@@ -0,0 +1,50 @@
+//
+// Created by kery on 2024/3/25.
+//
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Characters in the hex form of a fingerprint, without the terminator
+#define FINGERPRINT_HEX_LENGTH 32
+
+/**
+ * A 128 bit hash built incrementally from a sequence of byte strings. Not cryptographic,
+ * it tells apart inputs that differ by accident, not ones crafted to collide.
+ *
+ * Each update mixes its data eight bytes at a time into two 64 bit lanes that feed each other
+ * (the block step of MurmurHash3), its length is mixed in as well so that splitting the
+ * same bytes differently across updates gives a different fingerprint
+ */
+struct fingerprint
+{
+    uint64_t low;
+    uint64_t high;
+};
+
+void fingerprint_init(struct fingerprint* fingerprint);
+void fingerprint_update(struct fingerprint* fingerprint, const void* data, size_t len);
+void fingerprint_update_u64(struct fingerprint* fingerprint, uint64_t value);
+void fingerprint_update_str(struct fingerprint* fingerprint, const char* str);
+
+/**
+ * Returns the final value, the fingerprint itself is left unchanged and can be updated further
+ */
+struct fingerprint fingerprint_finish(struct fingerprint* fingerprint);
+bool fingerprint_equal(struct fingerprint* a, struct fingerprint* b);
+
+/**
+ * Writes FINGERPRINT_HEX_LENGTH hex digits and a terminator to out
+ */
+void fingerprint_format(struct fingerprint* fingerprint, char* out);
+
+/**
+ * Parses the hex form written by fingerprint_format, returns false if str does not start with one
+ */
+bool fingerprint_parse(const char* str, struct fingerprint* fingerprint);
+
+#endif //FINGERPRINT_H
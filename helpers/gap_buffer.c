@@ -0,0 +1,155 @@
+//
+// Created by kery on 2024/3/23.
+//
+
+#include "gap_buffer.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+static void* gap_buffer_element(struct gap_buffer* buffer, size_t slot)
+{
+    return buffer->data + slot * buffer->esize;
+}
+
+static size_t gap_buffer_gap(struct gap_buffer* buffer)
+{
+    return buffer->gap_end - buffer->gap_start;
+}
+
+/**
+ * Aborts, the buffer can not grow any further without its size overflowing
+ */
+static void gap_buffer_overflow()
+{
+    fprintf(stderr, "Gap buffer size overflow\n");
+    abort();
+}
+
+struct gap_buffer* gap_buffer_create(size_t esize)
+{
+    struct gap_buffer* buffer = mem_calloc(1, sizeof(struct gap_buffer));
+    buffer->esize = esize;
+    buffer->capacity = GAP_BUFFER_MIN_GAP;
+    buffer->data = mem_malloc(esize * buffer->capacity);
+    buffer->gap_start = 0;
+    buffer->gap_end = buffer->capacity;
+    return buffer;
+}
+
+void gap_buffer_free(struct gap_buffer* buffer)
+{
+    mem_free(buffer->data);
+    mem_free(buffer);
+}
+
+size_t gap_buffer_count(struct gap_buffer* buffer)
+{
+    return buffer->capacity - gap_buffer_gap(buffer);
+}
+
+void* gap_buffer_at(struct gap_buffer* buffer, size_t index)
+{
+    assert(index < gap_buffer_count(buffer));
+    size_t slot = index < buffer->gap_start ? index : index + gap_buffer_gap(buffer);
+    return gap_buffer_element(buffer, slot);
+}
+
+/**
+ * Moves the gap so that it starts at index, only the elements between the old and the new position move
+ */
+static void gap_buffer_move_gap(struct gap_buffer* buffer, size_t index)
+{
+    size_t gap = gap_buffer_gap(buffer);
+    if (index < buffer->gap_start)
+    {
+        size_t amount = buffer->gap_start - index;
+        memmove(gap_buffer_element(buffer, index + gap), gap_buffer_element(buffer, index), amount * buffer->esize);
+    }
+    else if (index > buffer->gap_start)
+    {
+        size_t amount = index - buffer->gap_start;
+        memmove(gap_buffer_element(buffer, buffer->gap_start), gap_buffer_element(buffer, buffer->gap_end), amount * buffer->esize);
+    }
+    buffer->gap_start = index;
+    buffer->gap_end = index + gap;
+}
+
+/**
+ * Grows the gap to hold at least needed elements, the capacity at least doubles so growth is amortised
+ */
+static void gap_buffer_reserve(struct gap_buffer* buffer, size_t needed)
+{
+    size_t gap = gap_buffer_gap(buffer);
+    if (gap >= needed)
+    {
+        return;
+    }
+
+    size_t count = gap_buffer_count(buffer);
+    if (needed > SIZE_MAX - count - GAP_BUFFER_MIN_GAP || buffer->capacity > SIZE_MAX / 2)
+    {
+        gap_buffer_overflow();
+    }
+    size_t capacity = buffer->capacity * 2;
+    if (capacity < count + needed + GAP_BUFFER_MIN_GAP)
+    {
+        capacity = count + needed + GAP_BUFFER_MIN_GAP;
+    }
+    if (capacity > SIZE_MAX / buffer->esize)
+    {
+        gap_buffer_overflow();
+    }
+
+    char* data = mem_realloc(buffer->data, capacity * buffer->esize);
+    if (!data)
+    {
+        gap_buffer_overflow();
+    }
+    buffer->data = data;
+    // The elements after the gap stay at the end of the larger block
+    size_t tail = buffer->capacity - buffer->gap_end;
+    size_t gap_end = capacity - tail;
+    memmove(gap_buffer_element(buffer, gap_end), gap_buffer_element(buffer, buffer->gap_end), tail * buffer->esize);
+    buffer->gap_end = gap_end;
+    buffer->capacity = capacity;
+}
+
+void gap_buffer_splice(struct gap_buffer* buffer, size_t index, size_t erase_count, const void* elements, size_t count)
+{
+    assert(index <= gap_buffer_count(buffer) && erase_count <= gap_buffer_count(buffer) - index);
+    gap_buffer_move_gap(buffer, index);
+    // The erased elements directly follow the gap, erasing them just widens it
+    buffer->gap_end += erase_count;
+    if (count == 0)
+    {
+        return;
+    }
+    gap_buffer_reserve(buffer, count);
+    memcpy(gap_buffer_element(buffer, buffer->gap_start), elements, count * buffer->esize);
+    buffer->gap_start += count;
+}
+
+void gap_buffer_insert(struct gap_buffer* buffer, size_t index, const void* elements, size_t count)
+{
+    gap_buffer_splice(buffer, index, 0, elements, count);
+}
+
+void gap_buffer_erase(struct gap_buffer* buffer, size_t index, size_t count)
+{
+    gap_buffer_splice(buffer, index, count, NULL, 0);
+}
+
+void gap_buffer_push(struct gap_buffer* buffer, const void* element)
+{
+    gap_buffer_splice(buffer, gap_buffer_count(buffer), 0, element, 1);
+}
+
+void* gap_buffer_data(struct gap_buffer* buffer)
+{
+    gap_buffer_move_gap(buffer, gap_buffer_count(buffer));
+    return buffer->data;
+}
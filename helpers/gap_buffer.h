@@ -0,0 +1,54 @@
+//
+// Created by kery on 2024/3/23.
+//
+
+#ifndef GAP_BUFFER_H
+#define GAP_BUFFER_H
+
+#include <stddef.h>
+
+// The smallest gap a gap buffer grows to, in elements
+#define GAP_BUFFER_MIN_GAP 64
+
+/**
+ * An editable sequence of fixed size elements, such as a token stream a macro expander splices into.
+ * The free space sits at the last edit position, edits close to each other only move the elements between them
+ * instead of the whole tail. Editing left to right through the sequence moves every element at most once.
+ *
+ * data holds the elements before the gap in [0, gap_start) and the elements after it in [gap_end, capacity)
+ */
+struct gap_buffer
+{
+    char* data;
+    size_t esize;
+    // Capacity in elements
+    size_t capacity;
+    size_t gap_start;
+    size_t gap_end;
+};
+
+struct gap_buffer* gap_buffer_create(size_t esize);
+void gap_buffer_free(struct gap_buffer* buffer);
+
+size_t gap_buffer_count(struct gap_buffer* buffer);
+
+/**
+ * Returns the element at the given index, the pointer is valid until the next edit
+ */
+void* gap_buffer_at(struct gap_buffer* buffer, size_t index);
+
+/**
+ * Replaces erase_count elements starting at index with the count elements at elements.
+ * Insertion and removal are both splices, the gap is moved to index once for the whole batch
+ */
+void gap_buffer_splice(struct gap_buffer* buffer, size_t index, size_t erase_count, const void* elements, size_t count);
+void gap_buffer_insert(struct gap_buffer* buffer, size_t index, const void* elements, size_t count);
+void gap_buffer_erase(struct gap_buffer* buffer, size_t index, size_t count);
+void gap_buffer_push(struct gap_buffer* buffer, const void* element);
+
+/**
+ * Closes the gap and returns all elements as one contiguous array, valid until the next edit
+ */
+void* gap_buffer_data(struct gap_buffer* buffer);
+
+#endif //GAP_BUFFER_H
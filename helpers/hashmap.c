@@ -0,0 +1,209 @@
+//
+// Created by kery on 2024/3/9.
+//
+
+#include "hashmap.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+size_t hashmap_hash(const char* key, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+static struct hashmap_bucket* hashmap_buckets_create(size_t capacity)
+{
+    struct hashmap_bucket* buckets = mem_calloc(capacity, sizeof(struct hashmap_bucket));
+    assert(buckets);
+    return buckets;
+}
+
+struct hashmap* hashmap_create()
+{
+    struct hashmap* map = mem_calloc(1, sizeof(struct hashmap));
+    map->capacity = HASHMAP_INITIAL_CAPACITY;
+    map->buckets = hashmap_buckets_create(map->capacity);
+    return map;
+}
+
+void hashmap_free(struct hashmap* map)
+{
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        mem_free(map->buckets[i].key);
+    }
+    mem_free(map->buckets);
+    mem_free(map);
+}
+
+static bool hashmap_key_equals(struct hashmap_bucket* bucket, const char* key, size_t len)
+{
+    return !bucket->tombstone && strncmp(bucket->key, key, len) == 0 && bucket->key[len] == 0x00;
+}
+
+/**
+ * Finds the bucket holding the key, or the bucket the key should be inserted into
+ * when it is not present
+ */
+static struct hashmap_bucket* hashmap_find(struct hashmap* map, const char* key, size_t len)
+{
+    size_t mask = map->capacity - 1;
+    size_t index = hashmap_hash(key, len) & mask;
+    struct hashmap_bucket* first_tombstone = NULL;
+    while (true)
+    {
+        struct hashmap_bucket* bucket = &map->buckets[index];
+        if (!bucket->key)
+        {
+            return first_tombstone ? first_tombstone : bucket;
+        }
+
+        if (bucket->tombstone)
+        {
+            if (!first_tombstone)
+            {
+                first_tombstone = bucket;
+            }
+        }
+        else if (hashmap_key_equals(bucket, key, len))
+        {
+            return bucket;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void hashmap_grow(struct hashmap* map)
+{
+    struct hashmap_bucket* old_buckets = map->buckets;
+    size_t old_capacity = map->capacity;
+
+    // Only grow when most of the used buckets are live, otherwise rehashing
+    // at the same size is enough to get rid of the tombstones
+    if (map->count * 2 >= map->used)
+    {
+        map->capacity *= 2;
+    }
+    map->buckets = hashmap_buckets_create(map->capacity);
+    map->used = map->count;
+
+    size_t mask = map->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        struct hashmap_bucket* bucket = &old_buckets[i];
+        if (!bucket->key)
+        {
+            continue;
+        }
+        if (bucket->tombstone)
+        {
+            mem_free(bucket->key);
+            continue;
+        }
+
+        size_t index = hashmap_hash(bucket->key, strlen(bucket->key)) & mask;
+        while (map->buckets[index].key)
+        {
+            index = (index + 1) & mask;
+        }
+        map->buckets[index] = *bucket;
+    }
+    mem_free(old_buckets);
+}
+
+void* hashmap_get_n(struct hashmap* map, const char* key, size_t len)
+{
+    struct hashmap_bucket* bucket = hashmap_find(map, key, len);
+    if (!bucket->key || bucket->tombstone)
+    {
+        return NULL;
+    }
+    return bucket->value;
+}
+
+void* hashmap_get(struct hashmap* map, const char* key)
+{
+    return hashmap_get_n(map, key, strlen(key));
+}
+
+const char* hashmap_set_n(struct hashmap* map, const char* key, size_t len, void* value)
+{
+    if ((map->used + 1) * 10 >= map->capacity * 7)
+    {
+        hashmap_grow(map);
+    }
+
+    struct hashmap_bucket* bucket = hashmap_find(map, key, len);
+    if (bucket->key && !bucket->tombstone)
+    {
+        bucket->value = value;
+        return bucket->key;
+    }
+
+    if (bucket->tombstone)
+    {
+        // Reusing a tombstone, it is already accounted for in used
+        mem_free(bucket->key);
+    }
+    else
+    {
+        map->used++;
+    }
+
+    bucket->key = mem_malloc(len + 1);
+    memcpy(bucket->key, key, len);
+    bucket->key[len] = 0x00;
+    bucket->value = value;
+    bucket->tombstone = false;
+    map->count++;
+    return bucket->key;
+}
+
+const char* hashmap_set(struct hashmap* map, const char* key, void* value)
+{
+    return hashmap_set_n(map, key, strlen(key), value);
+}
+
+bool hashmap_remove(struct hashmap* map, const char* key)
+{
+    struct hashmap_bucket* bucket = hashmap_find(map, key, strlen(key));
+    if (!bucket->key || bucket->tombstone)
+    {
+        return false;
+    }
+
+    bucket->tombstone = true;
+    bucket->value = NULL;
+    map->count--;
+    return true;
+}
+
+size_t hashmap_count(struct hashmap* map)
+{
+    return map->count;
+}
+
+bool hashmap_next(struct hashmap* map, size_t* iter, const char** key, void** value)
+{
+    while (*iter < map->capacity)
+    {
+        struct hashmap_bucket* bucket = &map->buckets[*iter];
+        (*iter)++;
+        if (bucket->key && !bucket->tombstone)
+        {
+            *key = bucket->key;
+            *value = bucket->value;
+            return true;
+        }
+    }
+    return false;
+}
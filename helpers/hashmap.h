@@ -0,0 +1,70 @@
+//
+// Created by kery on 2024/3/9.
+//
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// The amount of buckets a new hashmap starts with, must be a power of two
+#define HASHMAP_INITIAL_CAPACITY 16
+
+struct hashmap_bucket
+{
+    // Owned copy of the key, NULL if this bucket was never used
+    char* key;
+    void* value;
+    // True if the entry was removed, the bucket must still be probed past
+    bool tombstone;
+};
+
+struct hashmap
+{
+    struct hashmap_bucket* buckets;
+    size_t capacity;
+    // Live entries
+    size_t count;
+    // Live entries plus tombstones, used to decide when to rehash
+    size_t used;
+};
+
+struct hashmap* hashmap_create();
+void hashmap_free(struct hashmap* map);
+
+/**
+ * Returns the value stored for the given key or NULL if there is none
+ */
+void* hashmap_get(struct hashmap* map, const char* key);
+
+/**
+ * Same as hashmap_get but the key does not need to be null terminated
+ */
+void* hashmap_get_n(struct hashmap* map, const char* key, size_t len);
+
+/**
+ * Stores the value for the given key, the key is copied so the caller keeps ownership of it.
+ * Returns the key as it is stored inside of the map
+ */
+const char* hashmap_set(struct hashmap* map, const char* key, void* value);
+const char* hashmap_set_n(struct hashmap* map, const char* key, size_t len, void* value);
+
+/**
+ * Removes the given key, returns true if it existed
+ */
+bool hashmap_remove(struct hashmap* map, const char* key);
+
+size_t hashmap_count(struct hashmap* map);
+
+/**
+ * Iterates the map, start with *iter set to zero. Returns false once every entry was visited
+ */
+bool hashmap_next(struct hashmap* map, size_t* iter, const char** key, void** value);
+
+/**
+ * FNV-1a hash of the given bytes
+ */
+size_t hashmap_hash(const char* key, size_t len);
+
+#endif //HASHMAP_H
@@ -0,0 +1,128 @@
+//
+// Created by kery on 2024/3/24.
+//
+
+#include "segmented_vector.h"
+#include "vector.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+static char* segmented_vector_block(struct segmented_vector* vector, size_t block)
+{
+    return *(char**) vector_at(vector->blocks, block);
+}
+
+struct segmented_vector* segmented_vector_create(size_t esize)
+{
+    if (esize > SIZE_MAX / SEGMENTED_VECTOR_BLOCK_SIZE)
+    {
+        fprintf(stderr, "Segmented vector element too large\n");
+        abort();
+    }
+    struct segmented_vector* vector = mem_calloc(1, sizeof(struct segmented_vector));
+    vector->blocks = vector_create(sizeof(char*));
+    vector->esize = esize;
+    return vector;
+}
+
+void segmented_vector_free(struct segmented_vector* vector)
+{
+    for (size_t i = vector->released; i < vector_count(vector->blocks); i++)
+    {
+        mem_free(segmented_vector_block(vector, i));
+    }
+    vector_free(vector->blocks);
+    mem_free(vector);
+}
+
+size_t segmented_vector_count(struct segmented_vector* vector)
+{
+    return vector->count;
+}
+
+void* segmented_vector_at(struct segmented_vector* vector, size_t index)
+{
+    size_t block = index >> SEGMENTED_VECTOR_BLOCK_SHIFT;
+    assert(index < vector->count && block >= vector->released);
+    return segmented_vector_block(vector, block) + (index & (SEGMENTED_VECTOR_BLOCK_SIZE - 1)) * vector->esize;
+}
+
+void* segmented_vector_back(struct segmented_vector* vector)
+{
+    if (vector->count == 0)
+    {
+        return NULL;
+    }
+    return segmented_vector_at(vector, vector->count - 1);
+}
+
+void* segmented_vector_push(struct segmented_vector* vector, const void* elem)
+{
+    if (vector->count == SIZE_MAX)
+    {
+        fprintf(stderr, "Segmented vector size overflow\n");
+        abort();
+    }
+    size_t block = vector->count >> SEGMENTED_VECTOR_BLOCK_SHIFT;
+    if (block == vector_count(vector->blocks))
+    {
+        char* data = mem_malloc(SEGMENTED_VECTOR_BLOCK_SIZE * vector->esize);
+        vector_push(vector->blocks, &data);
+    }
+    vector->count++;
+    void* ptr = segmented_vector_at(vector, vector->count - 1);
+    memcpy(ptr, elem, vector->esize);
+    return ptr;
+}
+
+void segmented_vector_push_multiple(struct segmented_vector* vector, const void* elems, size_t total)
+{
+    const char* src = elems;
+    while (total > 0)
+    {
+        // Copy up to the end of the current block at once
+        size_t offset = vector->count & (SEGMENTED_VECTOR_BLOCK_SIZE - 1);
+        size_t amount = SEGMENTED_VECTOR_BLOCK_SIZE - offset;
+        if (amount > total)
+        {
+            amount = total;
+        }
+        char* dst = segmented_vector_push(vector, src);
+        memcpy(dst + vector->esize, src + vector->esize, (amount - 1) * vector->esize);
+        vector->count += amount - 1;
+        src += amount * vector->esize;
+        total -= amount;
+    }
+}
+
+void segmented_vector_truncate(struct segmented_vector* vector, size_t count)
+{
+    assert(count <= vector->count);
+    vector->count = count;
+    size_t needed = (count + SEGMENTED_VECTOR_BLOCK_SIZE - 1) >> SEGMENTED_VECTOR_BLOCK_SHIFT;
+    if (needed < vector->released)
+    {
+        needed = vector->released;
+    }
+    while (vector_count(vector->blocks) > needed)
+    {
+        mem_free(segmented_vector_block(vector, vector_count(vector->blocks) - 1));
+        vector_pop(vector->blocks);
+    }
+}
+
+void segmented_vector_release_before(struct segmented_vector* vector, size_t index)
+{
+    assert(index <= vector->count);
+    size_t block = index >> SEGMENTED_VECTOR_BLOCK_SHIFT;
+    for (; vector->released < block; vector->released++)
+    {
+        char** data = vector_at(vector->blocks, vector->released);
+        mem_free(*data);
+        *data = NULL;
+    }
+}
@@ -0,0 +1,58 @@
+//
+// Created by kery on 2024/3/24.
+//
+
+#ifndef SEGMENTED_VECTOR_H
+#define SEGMENTED_VECTOR_H
+
+#include <stddef.h>
+
+// Elements per block are 1 << SEGMENTED_VECTOR_BLOCK_SHIFT
+#define SEGMENTED_VECTOR_BLOCK_SHIFT 8
+#define SEGMENTED_VECTOR_BLOCK_SIZE ((size_t) 1 << SEGMENTED_VECTOR_BLOCK_SHIFT)
+
+/**
+ * An append only sequence of fixed size elements stored in fixed size blocks.
+ * Growing allocates a new block and never moves the elements already stored, a pointer returned by
+ * segmented_vector_at or segmented_vector_push stays valid until the element is truncated or its block released.
+ *
+ * blocks is a struct vector of block pointers, element i lives in block i >> SEGMENTED_VECTOR_BLOCK_SHIFT.
+ * Released blocks are set to NULL, released counts how many leading blocks that are
+ */
+struct segmented_vector
+{
+    struct vector* blocks;
+    size_t esize;
+    size_t count;
+    size_t released;
+};
+
+struct segmented_vector* segmented_vector_create(size_t esize);
+void segmented_vector_free(struct segmented_vector* vector);
+
+size_t segmented_vector_count(struct segmented_vector* vector);
+
+/**
+ * Returns the element at the given index, it must not have been released
+ */
+void* segmented_vector_at(struct segmented_vector* vector, size_t index);
+void* segmented_vector_back(struct segmented_vector* vector);
+
+/**
+ * Appends a copy of the element and returns its address in the vector
+ */
+void* segmented_vector_push(struct segmented_vector* vector, const void* elem);
+void segmented_vector_push_multiple(struct segmented_vector* vector, const void* elems, size_t total);
+
+/**
+ * Drops every element from index count onwards, blocks left empty are freed
+ */
+void segmented_vector_truncate(struct segmented_vector* vector, size_t count);
+
+/**
+ * Frees the blocks that only hold elements before index, for consumers that are done with the start of the sequence.
+ * Indexes of the remaining elements do not change
+ */
+void segmented_vector_release_before(struct segmented_vector* vector, size_t index);
+
+#endif //SEGMENTED_VECTOR_H
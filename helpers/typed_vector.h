@@ -0,0 +1,68 @@
+//
+// Created by kery on 2024/3/24.
+//
+
+#ifndef TYPED_VECTOR_H
+#define TYPED_VECTOR_H
+
+#include "vector.h"
+#include <assert.h>
+
+/**
+ * Generates accessors for a struct vector whose elements have a type known at compile time.
+ *
+ * DEFINE_VECTOR(token, struct token) defines token_vector_create, token_vector_push, token_vector_at,
+ * token_vector_back, token_vector_count and token_vector_data. They work on an ordinary struct vector,
+ * so a vector filled through them can still be handed to every generic vector_* function and the other
+ * way around. Because the element size is a constant the push copies the element by assignment and the
+ * accessors index a typed array, the compiler can inline them into hot loops instead of calling
+ * vector_push and memcpy with a runtime size for every element.
+ *
+ * Only the element size is checked, the vector must have been created for the same type
+ */
+#define DEFINE_VECTOR(name, type)                                                       \
+    static inline struct vector* name##_vector_create()                                 \
+    {                                                                                   \
+        return vector_create(sizeof(type));                                             \
+    }                                                                                   \
+                                                                                        \
+    static inline void name##_vector_push(struct vector* vector, type const* elem)      \
+    {                                                                                   \
+        assert(vector->esize == sizeof(type));                                          \
+        ((type*) vector->data)[vector->rindex] = *elem;                                 \
+        vector->rindex++;                                                               \
+        vector->count++;                                                                \
+        if (vector->rindex >= vector->mindex)                                           \
+        {                                                                               \
+            vector_resize_for(vector, 0);                                               \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    static inline type* name##_vector_at(struct vector* vector, size_t index)           \
+    {                                                                                   \
+        assert(vector->esize == sizeof(type));                                          \
+        return &((type*) vector->data)[index];                                          \
+    }                                                                                   \
+                                                                                        \
+    static inline type* name##_vector_back(struct vector* vector)                       \
+    {                                                                                   \
+        assert(vector->esize == sizeof(type));                                          \
+        if (vector->rindex == 0)                                                        \
+        {                                                                               \
+            return NULL;                                                                \
+        }                                                                               \
+        return &((type*) vector->data)[vector->rindex - 1];                             \
+    }                                                                                   \
+                                                                                        \
+    static inline size_t name##_vector_count(struct vector* vector)                     \
+    {                                                                                   \
+        return vector->count;                                                           \
+    }                                                                                   \
+                                                                                        \
+    static inline type* name##_vector_data(struct vector* vector)                       \
+    {                                                                                   \
+        assert(vector->esize == sizeof(type));                                          \
+        return (type*) vector->data;                                                    \
+    }
+
+#endif //TYPED_VECTOR_H
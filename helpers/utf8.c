@@ -0,0 +1,126 @@
+//
+// Created by kery on 2024/3/20.
+//
+#include "utf8.h"
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int utf8_sequence_length(unsigned char lead)
+{
+    if (lead < 0x80)
+    {
+        return 1;
+    }
+    if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        return 2;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * Returns the amount of leading ASCII bytes, looking at a whole block at once
+ */
+static size_t utf8_ascii_prefix(const unsigned char* data, size_t len)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    // The sign bit of every byte is gathered into a mask, it is zero for a block of ASCII
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*) &data[i]);
+        if (_mm_movemask_epi8(block))
+        {
+            break;
+        }
+    }
+#else
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        if (word & 0x8080808080808080ULL)
+        {
+            break;
+        }
+    }
+#endif
+    while (i < len && data[i] < 0x80)
+    {
+        i++;
+    }
+    return i;
+}
+
+bool utf8_validate(const char* data, size_t len, size_t* end)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t i = 0;
+    while (i < len)
+    {
+        i += utf8_ascii_prefix(&bytes[i], len - i);
+        if (i >= len)
+        {
+            break;
+        }
+
+        unsigned char lead = bytes[i];
+        int length = utf8_sequence_length(lead);
+        if (length == 0)
+        {
+            *end = i;
+            return false;
+        }
+
+        // The second byte has a narrower range after some lead bytes, this rules out
+        // overlong forms, surrogates and code points past U+10FFFF
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (lead == 0xE0)
+        {
+            low = 0xA0;
+        }
+        else if (lead == 0xED)
+        {
+            high = 0x9F;
+        }
+        else if (lead == 0xF0)
+        {
+            low = 0x90;
+        }
+        else if (lead == 0xF4)
+        {
+            high = 0x8F;
+        }
+
+        for (int j = 1; j < length; j++)
+        {
+            if (i + j >= len)
+            {
+                // Cut off by the end of the data, everything so far is fine
+                *end = i;
+                return true;
+            }
+            unsigned char c = bytes[i + j];
+            if (c < (j == 1 ? low : 0x80) || c > (j == 1 ? high : 0xBF))
+            {
+                *end = i;
+                return false;
+            }
+        }
+        i += length;
+    }
+    *end = len;
+    return true;
+}
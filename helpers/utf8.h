@@ -0,0 +1,26 @@
+//
+// Created by kery on 2024/3/20.
+//
+
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Validates that data holds well formed UTF-8, rejecting overlong forms, surrogates and
+ * code points past U+10FFFF. Runs of ASCII are skipped 16 bytes at a time.
+ *
+ * Returns false if the data is invalid, *end is then the offset of the offending sequence.
+ * Returns true otherwise, *end is then the offset of a trailing sequence that is cut off by the
+ * end of the data but valid so far, or len if there is none. The caller supplies the rest of it
+ */
+bool utf8_validate(const char* data, size_t len, size_t* end);
+
+/**
+ * Returns the length of the sequence starting with the given lead byte, 0 if it can not start one
+ */
+int utf8_sequence_length(unsigned char lead);
+
+#endif //UTF8_H
@@ -3,31 +3,34 @@
 //
 
 #include "vector.h"
+#include "alloc.h"
 #include <memory.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
 
-static bool vector_in_bounds_for_at(struct vector *vector, int index)
+static bool vector_in_bounds_for_at(struct vector *vector, size_t index)
 {
-    return (index >= 0 && index < vector->rindex);
+    // Indexes are unsigned, a peek pointer decremented past zero wraps around and is out of bounds
+    return index < vector->rindex;
 }
 
-static bool vector_in_bounds_for_pop(struct vector *vector, int index)
+static bool vector_in_bounds_for_pop(struct vector *vector, size_t index)
 {
-    return (index >= 0 && index < vector->mindex);
+    return index < vector->mindex;
 }
 
-static void vector_assert_bounds_for_pop(struct vector *vector, int index)
+static void vector_assert_bounds_for_pop(struct vector *vector, size_t index)
 {
     assert(vector_in_bounds_for_pop(vector, index));
 }
 
 struct vector *vector_create_no_saves(size_t esize)
 {
-    struct vector *vector = calloc(sizeof(struct vector), 1);
-    vector->data = malloc(esize * VECTOR_ELEMENT_INCREMENT);
+    struct vector *vector = mem_calloc(sizeof(struct vector), 1);
+    vector->data = mem_malloc(esize * VECTOR_ELEMENT_INCREMENT);
     vector->mindex = VECTOR_ELEMENT_INCREMENT;
     vector->rindex = 0;
     vector->pindex = 0;
@@ -48,49 +51,81 @@ size_t vector_element_size(struct vector *vector)
 
 struct vector *vector_clone(struct vector *vector)
 {
-    void *new_data_address = calloc(vector->esize, vector->count + VECTOR_ELEMENT_INCREMENT);
+    void *new_data_address = mem_calloc(vector->esize, vector->count + VECTOR_ELEMENT_INCREMENT);
     memcpy(new_data_address, vector->data, vector_total_size(vector));
-    struct vector *new_vec = calloc(sizeof(struct vector), 1);
+    struct vector *new_vec = mem_calloc(sizeof(struct vector), 1);
     memcpy(new_vec, vector, sizeof(struct vector));
     new_vec->data = new_data_address;
 
-    // Saves are not cloned with vector_clone yet.
-    // assert(vector->saves == NULL);
+    // Saves are not cloned with vector_clone yet, the clone must not share the save stack
+    new_vec->saves = NULL;
     return new_vec;
 }
 
 struct vector *vector_create(size_t esize)
 {
-    struct vector *vec = vector_create_no_saves(esize);
-    vec->saves = vector_create_no_saves(sizeof(struct vector));
-    return vec;
+    // The save stack is only created by the first vector_save, most vectors never need one
+    return vector_create_no_saves(esize);
 }
 
 void vector_free(struct vector *vector)
 {
-    free(vector->data);
-    free(vector);
+    if (vector->saves)
+    {
+        vector_free(vector->saves);
+    }
+    mem_free(vector->data);
+    mem_free(vector);
 }
 
-int vector_current_index(struct vector *vector)
+size_t vector_current_index(struct vector *vector)
 {
     return vector->rindex;
 }
 
-void vector_resize_for_index(struct vector *vector, int start_index, int total_elements)
+/**
+ * Aborts, the vector can not grow any further without its size overflowing
+ */
+static void vector_overflow()
 {
-    if (start_index + total_elements < vector->mindex)
+    fprintf(stderr, "Vector size overflow\n");
+    abort();
+}
+
+void vector_resize_for_index(struct vector *vector, size_t start_index, size_t total_elements)
+{
+    if (total_elements > SIZE_MAX - start_index)
+    {
+        vector_overflow();
+    }
+    size_t needed = start_index + total_elements;
+    if (needed < vector->mindex)
     {
         // Nothing to resize
         return;
     }
 
-    vector->data = realloc(vector->data, ((start_index + total_elements + VECTOR_ELEMENT_INCREMENT) * vector->esize));
+    // Grow geometrically so pushing n elements only reallocates a logarithmic number of times
+    size_t mindex = vector->mindex > SIZE_MAX / 2 ? SIZE_MAX : vector->mindex * 2;
+    if (mindex <= needed)
+    {
+        if (needed > SIZE_MAX - VECTOR_ELEMENT_INCREMENT)
+        {
+            vector_overflow();
+        }
+        mindex = needed + VECTOR_ELEMENT_INCREMENT;
+    }
+    if (mindex > SIZE_MAX / vector->esize)
+    {
+        vector_overflow();
+    }
+
+    vector->data = mem_realloc(vector->data, mindex * vector->esize);
     assert(vector->data);
-    vector->mindex = start_index + total_elements;
+    vector->mindex = mindex;
 }
 
-void vector_resize_for(struct vector *vector, int total_elements)
+void vector_resize_for(struct vector *vector, size_t total_elements)
 {
     vector_resize_for_index(vector, vector->rindex, total_elements);
 }
@@ -101,12 +136,12 @@ void vector_resize(struct vector *vector)
     vector_resize_for(vector, 0);
 }
 
-void *vector_at(struct vector *vector, int index)
+void *vector_at(struct vector *vector, size_t index)
 {
     return vector->data + (index * vector->esize);
 }
 
-void vector_set_peek_pointer(struct vector *vector, int index)
+void vector_set_peek_pointer(struct vector *vector, size_t index)
 {
     vector->pindex = index;
 }
@@ -116,7 +151,7 @@ void vector_set_peek_pointer_end(struct vector *vector)
     vector_set_peek_pointer(vector, vector->rindex - 1);
 }
 
-void *vector_peek_at(struct vector *vector, int index)
+void *vector_peek_at(struct vector *vector, size_t index)
 {
     if (!vector_in_bounds_for_at(vector, index))
     {
@@ -180,9 +215,9 @@ void *vector_peek_ptr(struct vector *vector)
     return *ptr;
 }
 
-void *vector_peek_ptr_at(struct vector *vector, int index)
+void *vector_peek_ptr_at(struct vector *vector, size_t index)
 {
-    if (index < 0 || index > vector->count)
+    if (index > vector->count)
     {
         return NULL;
     }
@@ -207,21 +242,38 @@ void *vector_back_ptr(struct vector *vector)
     return *ptr;
 }
 
+struct vector_checkpoint vector_checkpoint(struct vector *vector)
+{
+    return (struct vector_checkpoint) {
+            .pindex = vector->pindex,
+            .rindex = vector->rindex,
+            .count = vector->count
+    };
+}
+
+void vector_rollback(struct vector *vector, struct vector_checkpoint checkpoint)
+{
+    // Only the indexes move, the data pointer and capacity stay valid even if the vector grew since
+    assert(checkpoint.rindex <= vector->mindex);
+    vector->pindex = checkpoint.pindex;
+    vector->rindex = checkpoint.rindex;
+    vector->count = checkpoint.count;
+}
+
 void vector_save(struct vector *vector)
 {
-    // Let's save the state of this vector to its self
-    struct vector tmp_vec = *vector;
-    // We not allowed to modify the saves so set it to NULL
-    // when we push it to the save stack.
-    tmp_vec.saves = NULL;
-    vector_push(vector->saves, &tmp_vec);
+    if (!vector->saves)
+    {
+        vector->saves = vector_create_no_saves(sizeof(struct vector_checkpoint));
+    }
+    struct vector_checkpoint checkpoint = vector_checkpoint(vector);
+    vector_push(vector->saves, &checkpoint);
 }
 
 void vector_restore(struct vector *vector)
 {
-    struct vector save_vec = *((struct vector *)(vector_back(vector->saves)));
-    save_vec.saves = vector->saves;
-    *vector = save_vec;
+    struct vector_checkpoint* checkpoint = vector_back(vector->saves);
+    vector_rollback(vector, *checkpoint);
     vector_pop(vector->saves);
 }
 
@@ -250,7 +302,7 @@ void vector_push(struct vector *vector, void *elem)
     }
 }
 
-int vector_fread(struct vector *vector, int amount, FILE *fp)
+int vector_fread(struct vector *vector, size_t amount, FILE *fp)
 {
     size_t read_amount = fread(vector->data, 1, 1, fp);
     while (read_amount)
@@ -272,33 +324,34 @@ void *vector_data_end(struct vector *vector)
     return vector->data + vector->rindex * vector->esize;
 }
 
-size_t vector_elements_left(struct vector *vector, int index)
+size_t vector_elements_left(struct vector *vector, size_t index)
 {
     return vector->count - index;
 }
 
-int vector_elements_until_end(struct vector *vector, int index)
+size_t vector_elements_until_end(struct vector *vector, size_t index)
 {
     return vector->count - index;
 }
 
-void vector_shift_right_in_bounds_no_increment(struct vector *vector, int index, int amount)
+void vector_shift_right_in_bounds_no_increment(struct vector *vector, size_t index, size_t amount)
 {
-    vector_resize_for_index(vector, index, amount);
-    int eindex = (index + amount);
+    // The tail from index to count moves up by amount, so the buffer must hold count + amount elements
+    vector_resize_for_index(vector, vector->count, amount);
+    size_t eindex = (index + amount);
     size_t bytes_to_move = vector_elements_until_end(vector, index) * vector->esize;
-    memcpy(vector_at(vector, eindex), vector_at(vector, index), bytes_to_move);
+    memmove(vector_at(vector, eindex), vector_at(vector, index), bytes_to_move);
     memset(vector_at(vector, index), 0x00, amount * vector->esize);
 }
 
-void vector_shift_right_in_bounds(struct vector *vector, int index, int amount)
+void vector_shift_right_in_bounds(struct vector *vector, size_t index, size_t amount)
 {
     vector_shift_right_in_bounds_no_increment(vector, index, amount);
     vector->rindex += amount;
     vector->count += amount;
 }
 
-void vector_stretch(struct vector *vector, int index)
+void vector_stretch(struct vector *vector, size_t index)
 {
     if (index < vector->rindex)
         return;
@@ -308,12 +361,12 @@ void vector_stretch(struct vector *vector, int index)
     vector->rindex = index;
 }
 
-int vector_pop_value(struct vector* vector, void* val)
+size_t vector_pop_value(struct vector* vector, void* val)
 {
-    int old_pp = vector->pindex;
+    size_t old_pp = vector->pindex;
     vector_set_peek_pointer(vector, 0);
     void* ptr = vector_peek_ptr(vector);
-    int index = 0;
+    size_t index = 0;
     while(ptr)
     {
         if (ptr == val)
@@ -326,16 +379,17 @@ int vector_pop_value(struct vector* vector, void* val)
     }
 
     vector_set_peek_pointer(vector, old_pp);
+    return index;
 }
 
-int vector_pop_at_data_address(struct vector *vector, void *address)
+size_t vector_pop_at_data_address(struct vector *vector, void *address)
 {
-    int index = (address - vector->data) / vector->esize;
+    size_t index = (address - vector->data) / vector->esize;
     vector_pop_at(vector, index);
     return index;
 }
 
-void vector_shift_right(struct vector *vector, int index, int amount)
+void vector_shift_right(struct vector *vector, size_t index, size_t amount)
 {
     if (index < vector->rindex)
     {
@@ -349,15 +403,21 @@ void vector_shift_right(struct vector *vector, int index, int amount)
     vector_shift_right_in_bounds_no_increment(vector, index, amount);
 }
 
-void vector_pop_at(struct vector *vector, int index)
+void vector_pop_multiple_at(struct vector *vector, size_t index, size_t total)
 {
+    assert(index <= vector->rindex && total <= vector->rindex - index);
     void *dst_pos = vector_at(vector, index);
-    void *next_element_pos = dst_pos + vector->esize;
+    void *next_element_pos = vector_at(vector, index + total);
     void *end_pos = vector_data_end(vector);
-    size_t total = (size_t)end_pos - (size_t)next_element_pos;
-    memcpy(dst_pos, next_element_pos, total);
-    vector->count -= 1;
-    vector->rindex -= 1;
+    // The ranges overlap whenever fewer elements are removed than follow them
+    memmove(dst_pos, next_element_pos, (size_t)end_pos - (size_t)next_element_pos);
+    vector->count -= total;
+    vector->rindex -= total;
+}
+
+void vector_pop_at(struct vector *vector, size_t index)
+{
+    vector_pop_multiple_at(vector, index, 1);
 }
 
 void vector_peek_pop(struct vector *vector)
@@ -368,7 +428,7 @@ void vector_peek_pop(struct vector *vector)
     vector_pop_at(vector, vector->pindex);
 }
 
-void vector_push_multiple_at(struct vector *vector, int dst_index, void *ptr, int total)
+void vector_push_multiple_at(struct vector *vector, size_t dst_index, void *ptr, size_t total)
 {
     vector_shift_right(vector, dst_index, total);
     void *dst_ptr = vector_at(vector, dst_index);
@@ -376,7 +436,7 @@ void vector_push_multiple_at(struct vector *vector, int dst_index, void *ptr, in
     memcpy(dst_ptr, ptr, total_bytes);
 }
 
-void vector_push_at(struct vector *vector, int index, void *ptr)
+void vector_push_at(struct vector *vector, size_t index, void *ptr)
 {
     vector_shift_right(vector, index, 1);
 
@@ -384,7 +444,7 @@ void vector_push_at(struct vector *vector, int index, void *ptr)
     memcpy(data_ptr, ptr, vector->esize);
 }
 
-int vector_insert(struct vector *vector_dst, struct vector *vector_src, int dst_index)
+int vector_insert(struct vector *vector_dst, struct vector *vector_src, size_t dst_index)
 {
     if (vector_dst->esize != vector_src->esize)
     {
@@ -455,7 +515,7 @@ void *vector_back(struct vector *vector)
     return vector_at(vector, vector->rindex - 1);
 }
 
-int vector_count(struct vector *vector)
+size_t vector_count(struct vector *vector)
 {
     return vector->count;
 }
\ No newline at end of file
@@ -25,30 +25,41 @@ struct vector
     void* data;
     // The pointer index is the index that will be read next upon calling "vector_peek".
     // This index will then be incremented
-    int pindex;
-    int rindex;
-    int mindex;
-    int count;
+    size_t pindex;
+    size_t rindex;
+    // Capacity in elements
+    size_t mindex;
+    size_t count;
     int flags;
     size_t esize;
 
 
-    // Vector of struct vector, holds saves of this vector. YOu can save the internal state
+    // Vector of struct vector_checkpoint, holds saves of this vector. YOu can save the internal state
     // at all times with vector_save
     // Data is not restored and is permenant, save does not respect data, only pointers
     // and variables are saved. Useful to temporarily push the vector state
-    // and restore it later.
+    // and restore it later. Created by the first vector_save
     struct vector* saves;
 };
 
+/**
+ * The indexes of a vector at some point in time, a plain value that needs no allocation
+ */
+struct vector_checkpoint
+{
+    size_t pindex;
+    size_t rindex;
+    size_t count;
+};
+
 
 struct vector* vector_create(size_t esize);
 void vector_free(struct vector* vector);
-void* vector_at(struct vector* vector, int index);
-void* vector_peek_ptr_at(struct vector* vector, int index);
+void* vector_at(struct vector* vector, size_t index);
+void* vector_peek_ptr_at(struct vector* vector, size_t index);
 void* vector_peek_no_increment(struct vector* vector);
 void* vector_peek(struct vector* vector);
-void *vector_peek_at(struct vector *vector, int index);
+void *vector_peek_at(struct vector *vector, size_t index);
 void vector_set_flag(struct vector* vector, int flag);
 void vector_unset_flag(struct vector* vector, int flag);
 
@@ -63,10 +74,14 @@ void vector_pop_last_peek(struct vector* vector);
  * Use this function instead of vector_peek if this is a vector of pointers
  */
 void* vector_peek_ptr(struct vector* vector);
-void vector_set_peek_pointer(struct vector* vector, int index);
+void vector_set_peek_pointer(struct vector* vector, size_t index);
 void vector_set_peek_pointer_end(struct vector* vector);
 void vector_push(struct vector* vector, void* elem);
-void vector_push_at(struct vector *vector, int index, void *ptr);
+void vector_push_at(struct vector *vector, size_t index, void *ptr);
+/**
+ * Inserts total elements at dst_index, the tail is moved once for the whole range
+ */
+void vector_push_multiple_at(struct vector *vector, size_t dst_index, void *ptr, size_t total);
 void vector_pop(struct vector* vector);
 void vector_peek_pop(struct vector* vector);
 
@@ -87,17 +102,17 @@ const char* vector_string(struct vector* vec);
 bool vector_empty(struct vector* vector);
 void vector_clear(struct vector* vector);
 
-int vector_count(struct vector* vector);
+size_t vector_count(struct vector* vector);
 /**
  * freads from the file directly into the vector
  */
-int vector_fread(struct vector* vector, int amount, FILE* fp);
+int vector_fread(struct vector* vector, size_t amount, FILE* fp);
 /**
  * Returns a void pointer pointing to the data of this vector
  */
 void* vector_data_ptr(struct vector* vector);
 
-int vector_insert(struct vector *vector_dst, struct vector *vector_src, int dst_index);
+int vector_insert(struct vector *vector_dst, struct vector *vector_src, size_t dst_index);
 
 /**
  * Pops the element at the given data address.
@@ -105,14 +120,20 @@ int vector_insert(struct vector *vector_dst, struct vector *vector_src, int dst_
  * \param address The address that is part of the vector->data range to pop off.
  * \return Returns the index that we popped off.
  */
-int vector_pop_at_data_address(struct vector* vector, void* address);
+size_t vector_pop_at_data_address(struct vector* vector, void* address);
 
 /**
  * Pops the given value from the vector. Only the first value found is popped
  */
-int vector_pop_value(struct vector* vector, void* val);
+size_t vector_pop_value(struct vector* vector, void* val);
+
+void vector_pop_at(struct vector *vector, size_t index);
 
-void vector_pop_at(struct vector *vector, int index);
+/**
+ * Pops total elements starting at index, the tail is moved once for the whole range.
+ * For many edits to a long sequence use a struct gap_buffer instead
+ */
+void vector_pop_multiple_at(struct vector *vector, size_t index, size_t total);
 
 /**
  * Decrements the peek pointer so that the next peek
@@ -123,7 +144,19 @@ void vector_peek_back(struct vector* vector);
 /**
  * Returns the current index that a vector_push would push too
  */
-int vector_current_index(struct vector* vector);
+size_t vector_current_index(struct vector* vector);
+
+/**
+ * Grows the vector so that total_elements more elements fit after the current index
+ */
+void vector_resize_for(struct vector* vector, size_t total_elements);
+
+/**
+ * Returns the current state of the vector, pass it to vector_rollback to return to it.
+ * Elements pushed after the checkpoint are dropped on rollback, popped ones are not brought back
+ */
+struct vector_checkpoint vector_checkpoint(struct vector* vector);
+void vector_rollback(struct vector* vector, struct vector_checkpoint checkpoint);
 
 /**
  * Saves the state of the vector
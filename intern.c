@@ -0,0 +1,35 @@
+//
+// Description: 字符串驻留表，相同内容的字符串只保存一份，之后可以直接比较指针
+// Created by kery on 2024/3/10.
+//
+#include "compiler.h"
+#include "helpers/hashmap.h"
+
+// 进程内所有翻译单元共享的字符串表
+static struct hashmap* string_table = NULL;
+
+/**
+ * @brief 获取一个字符串的驻留副本，内容相同的字符串总是返回同一个指针
+ * @param str 字符串，不需要以0结尾
+ * @param len 字符串的长度
+ * @return 驻留的字符串，在进程结束前一直有效
+ */
+const char* intern_string_n(const char* str, size_t len)
+{
+    if (!string_table)
+    {
+        string_table = hashmap_create();
+    }
+    // 哈希表保存的键就是驻留的副本
+    return hashmap_set_n(string_table, str, len, NULL);
+}
+
+/**
+ * @brief 获取一个以0结尾的字符串的驻留副本
+ * @param str 字符串
+ * @return 驻留的字符串
+ */
+const char* intern_string(const char* str)
+{
+    return intern_string_n(str, strlen(str));
+}
@@ -0,0 +1,148 @@
+//
+// Description: 对文件进行词法分析，把token保存为二进制或文本格式，或者读回一个二进制token文件并以文本格式输出
+// 用法: kc-tokens [-t] [-o FILE] FILE|-...
+//      kc-tokens --load FILE [-o FILE]
+// 默认输出到输入文件名加上.ktok，-t时加上.ktok.txt，"-o -"输出文本到标准输出
+// Created by kery on 2024/3/21.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief 把token向量按要求的格式写入文件
+ * @param tokens token向量
+ * @param output 输出文件名，"-"表示标准输出，此时总是使用文本格式
+ * @param text 是否使用文本格式
+ * @return 是否写入成功
+ */
+static bool kc_tokens_write(struct vector* tokens, const char* output, bool text)
+{
+    if (S_EQ(output, COMPILE_PROCESS_STDIO_NAME))
+    {
+        token_dump_write_text(tokens, stdout);
+        return fflush(stdout) == 0;
+    }
+    if (!text)
+    {
+        return token_dump_write(tokens, output);
+    }
+    FILE* fp = fopen(output, "w");
+    if (!fp)
+    {
+        return false;
+    }
+    token_dump_write_text(tokens, fp);
+    return fclose(fp) == 0;
+}
+
+/**
+ * @brief 对一个文件进行词法分析并保存得到的token
+ * @param input 输入文件名，"-"表示标准输入
+ * @param output 输出文件名，NULL表示使用默认的输出文件名
+ * @param text 是否使用文本格式
+ * @return 是否成功
+ */
+static bool kc_tokens_dump(const char* input, const char* output, bool text)
+{
+    struct compile_process* process = compile_process_create(input, NULL, 0);
+    if (!process)
+    {
+        fprintf(stderr, "Cannot open %s\n", input);
+        return false;
+    }
+    struct lex_process* lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+    if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
+        fprintf(stderr, "Failed to lex %s\n", input);
+        lex_process_free(lex_process);
+        compile_process_free(process);
+        return false;
+    }
+
+    char* default_output = NULL;
+    if (!output)
+    {
+        const char* name = S_EQ(input, COMPILE_PROCESS_STDIO_NAME) ? "stdin" : input;
+        default_output = malloc(strlen(name) + sizeof(".ktok.txt"));
+        strcpy(stpcpy(default_output, name), text ? ".ktok.txt" : ".ktok");
+        output = default_output;
+    }
+    bool ok = kc_tokens_write(lex_process->token_vec, output, text);
+    if (!ok)
+    {
+        fprintf(stderr, "Cannot write %s\n", output);
+    }
+    free(default_output);
+    lex_process_free(lex_process);
+    compile_process_free(process);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const char* load = NULL;
+    const char* output = NULL;
+    bool text = false;
+    bool usage = false;
+    struct vector* inputs = vector_create(sizeof(const char*));
+    for (int i = 1; i < argc; i++)
+    {
+        if (S_EQ(argv[i], "-t"))
+        {
+            text = true;
+        }
+        else if (S_EQ(argv[i], "-o") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (S_EQ(argv[i], "--load") && i + 1 < argc)
+        {
+            load = argv[++i];
+        }
+        else if (argv[i][0] != '-' || S_EQ(argv[i], COMPILE_PROCESS_STDIO_NAME))
+        {
+            vector_push(inputs, &argv[i]);
+        }
+        else
+        {
+            usage = true;
+            break;
+        }
+    }
+
+    if (usage || (load ? vector_count(inputs) != 0 : vector_count(inputs) == 0 || (output && vector_count(inputs) != 1)))
+    {
+        fprintf(stderr, "usage: %s [-t] [-o FILE] FILE|-...\n       %s --load FILE [-o FILE]\n", argv[0], argv[0]);
+        vector_free(inputs);
+        return 1;
+    }
+
+    int failed = 0;
+    if (load)
+    {
+        // 读回的token总是以文本格式输出，用于检查和比较
+        struct vector* tokens = token_dump_read(load);
+        if (!tokens)
+        {
+            fprintf(stderr, "%s is not a valid token file\n", load);
+            failed++;
+        }
+        else if (!kc_tokens_write(tokens, output ? output : COMPILE_PROCESS_STDIO_NAME, true))
+        {
+            fprintf(stderr, "Cannot write %s\n", output);
+            failed++;
+        }
+        if (tokens)
+        {
+            vector_free(tokens);
+        }
+    }
+    for (size_t i = 0; i < vector_count(inputs); i++)
+    {
+        failed += !kc_tokens_dump(vector_peek_ptr_at(inputs, i), output, text);
+    }
+    vector_free(inputs);
+    return failed == 0 ? 0 : 1;
+}
@@ -3,6 +3,8 @@
 //
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/alloc.h"
+#include "helpers/buffer.h"
 #include <stdlib.h>
 
 /**
@@ -14,7 +16,7 @@
  */
 struct lex_process* lex_process_create(struct compile_process* compiler, struct lex_process_functions* functions, void* private)
 {
-    struct lex_process* process = calloc(1, sizeof(struct lex_process));
+    struct lex_process* process = mem_calloc(1, sizeof(struct lex_process));
     process->function = functions;
     process->token_vec = vector_create(sizeof(struct token));
     process->compiler = compiler;
@@ -25,13 +27,22 @@ struct lex_process* lex_process_create(struct compile_process* compiler, struct
 }
 
 /**
- * @brief 释放词法分析过程
+ * @brief 释放词法分析过程和它的token向量，token中的字符串都是驻留的，不需要单独释放
+ * 需要保留token时，先把token_vec取走并置为NULL
+ * 私有数据属于调用者，不会被释放
  * @param process 词法分析过程
  */
 void lex_process_free(struct lex_process* process)
 {
-    vector_free(process->token_vec);
-    free(process);
+    if (process->token_vec)
+    {
+        vector_free(process->token_vec);
+    }
+    if (process->parentheses_buffer)
+    {
+        buffer_free(process->parentheses_buffer);
+    }
+    mem_free(process);
 }
 
 /**
@@ -6,7 +6,6 @@
 #include "helpers/vector.h"
 #include "helpers/buffer.h"
 #include <assert.h>
-#include <ctype.h>
 
 // 如果exp的表达式的值为真，那么就执行buffer_write(buffer, c)和nextc()
 // 即将c写入buffer，然后读取下一个字符
@@ -19,25 +18,80 @@
 
 struct token *read_next_token();
 
+void lexer_pop_token();
+
 bool lex_is_in_expression();
 
 static struct lex_process *lex_process;
 static struct token tmp_token;
+// 跳过注释或换行而没有产生token时返回它，lex不把它加入token向量，继续读取下一个token
+static struct token lex_skipped_token;
+
+// 读取数字、字符串和字符常量时重复使用的缓冲区，读完之后内容被转换或驻留，不需要为每个常量分配内存
+static struct buffer *literal_buffer;
+
+/**
+ * 获取清空之后的常量缓冲区
+ * @return 常量缓冲区，其中的内容在读取下一个常量之前有效
+ */
+static struct buffer *lex_literal_buffer() {
+    if (!literal_buffer) {
+        literal_buffer = buffer_create();
+    }
+    literal_buffer->len = 0;
+    return literal_buffer;
+}
+
+/**
+ * 在当前位置报告一个词法错误，输入源批量读取时编译过程的位置不会随每个字符更新
+ */
+#define LEX_ERROR(...)                                                  \
+    do                                                                  \
+    {                                                                   \
+        lex_process->compiler->pos = lex_process->pos;                  \
+        compiler_error(lex_process->compiler, __VA_ARGS__);             \
+    } while (0)
+
+/**
+ * 把窗口中已经读取的部分告诉输入源，然后获取下一段输入
+ * @return 是否还有输入
+ */
+static bool lex_fill_window() {
+    lex_process->function->advance(lex_process, lex_process->window_index);
+    lex_process->window = lex_process->function->next_span(lex_process, &lex_process->window_len);
+    lex_process->window_index = 0;
+    return lex_process->window_len > 0;
+}
 
 /**
  * 从文件中读取下一个字符，但不获取
- * @return 下一个字符
+ * 输入源支持批量读取时直接从窗口中读取，否则调用输入源的peek_char
+ * @return 下一个字符，为0到255之间的字节，输入结束时为EOF，因此0xFF不会被误认为输入结束
  */
-static char peekc() {
-    return lex_process->function->peek_char(lex_process);
+static int peekc() {
+    if (!lex_process->function->next_span) {
+        return lex_process->function->peek_char(lex_process);
+    }
+    if (lex_process->window_index >= lex_process->window_len && !lex_fill_window()) {
+        return EOF;
+    }
+    return (unsigned char) lex_process->window[lex_process->window_index];
 }
 
 /**
  * 从文件中读取下一个字符
  * @return 下一个字符
  */
-static char nextc() {
-    char c = lex_process->function->next_char(lex_process);
+static int nextc() {
+    int c;
+    if (lex_process->function->next_span) {
+        c = peekc();
+        if (c != EOF) {
+            lex_process->window_index++;
+        }
+    } else {
+        c = lex_process->function->next_char(lex_process);
+    }
     if (lex_is_in_expression()) {
         buffer_write(lex_process->parentheses_buffer, c);
     }
@@ -53,13 +107,59 @@ static char nextc() {
  * 将字符c推回到文件中
  * @param c 待推入的字符
  */
-static void pushc(char c) {
+static void pushc(int c) {
+    if (!lex_process->function->next_span || c == EOF) {
+        lex_process->function->push_char(lex_process, c);
+        return;
+    }
+    // 推回的总是刚刚读取的字符，窗口中还有它时只需要后退
+    if (lex_process->window_index > 0) {
+        lex_process->window_index--;
+        return;
+    }
+    // 窗口的开头之前的输入已经交给了输入源，由输入源推回，下一次读取时重新获取窗口
+    lex_process->function->advance(lex_process, 0);
     lex_process->function->push_char(lex_process, c);
+    lex_process->window_len = 0;
+}
+
+/**
+ * 读取直到行尾(不包括换行符)的输入，写入buffer。输入源支持批量读取时整段复制窗口中的内容
+ * @param buffer 保存读取的内容，为NULL时只跳过
+ */
+static void lex_read_until_newline(struct buffer *buffer) {
+    if (!lex_process->function->next_span) {
+        int c;
+        for (c = peekc(); c != '\n' && c != EOF; c = peekc()) {
+            if (buffer) {
+                buffer_write(buffer, c);
+            }
+            nextc();
+        }
+        return;
+    }
+    while (peekc() != EOF) {
+        const char *start = &lex_process->window[lex_process->window_index];
+        size_t available = lex_process->window_len - lex_process->window_index;
+        const char *newline = memchr(start, '\n', available);
+        size_t len = newline ? (size_t) (newline - start) : available;
+        if (buffer) {
+            buffer_write_n(buffer, start, len);
+        }
+        if (lex_is_in_expression()) {
+            buffer_write_n(lex_process->parentheses_buffer, start, len);
+        }
+        lex_process->window_index += len;
+        lex_process->pos.col += len;
+        if (newline) {
+            break;
+        }
+    }
 }
 
 
-static char assert_next_char(char c) {
-    char next_c = nextc();
+static int assert_next_char(int c) {
+    int next_c = nextc();
     assert(c == next_c);
     return next_c;
 }
@@ -80,6 +180,10 @@ static struct pos lex_file_position() {
 struct token *token_create(struct token *_token) {
     memcpy(&tmp_token, _token, sizeof(struct token));
     tmp_token.pos = lex_file_position();
+    if (lex_process->line_start) {
+        tmp_token.flag |= TOKEN_FLAG_LINE_START;
+        lex_process->line_start = false;
+    }
     if (lex_is_in_expression()) {
         tmp_token.between_brackets = buffer_ptr(lex_process->parentheses_buffer);
     }
@@ -109,12 +213,11 @@ static struct token *handle_whitespace() {
 
 /**
  * 读取一个数字字符串
- * @return 字符串在buffer中的指针
+ * @return 字符串在常量缓冲区中的指针，在读取下一个常量之前有效
  */
 const char *read_number_str() {
-    const char *num = NULL;
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
+    struct buffer *buffer = lex_literal_buffer();
+    int c = peekc();
     LEX_GETC_IF(buffer, c, (c >= '0' && c <= '9'));
 
     buffer_write(buffer, 0x00);
@@ -171,26 +274,167 @@ struct token *token_make_number() {
 }
 
 /**
- * 创建一个字符串token结构体
+ * 读取一个十六进制数字的值
+ * @return 数字的值，不是十六进制数字时返回-1
+ */
+static int lex_hex_digit_value(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * 以UTF-8编码写入一个\u或\U给出的码点
+ */
+static void lex_write_utf8(struct buffer *buffer, unsigned long cp) {
+    if (cp < 0x80) {
+        buffer_write(buffer, cp);
+    } else if (cp < 0x800) {
+        buffer_write(buffer, 0xC0 | (cp >> 6));
+        buffer_write(buffer, 0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        buffer_write(buffer, 0xE0 | (cp >> 12));
+        buffer_write(buffer, 0x80 | ((cp >> 6) & 0x3F));
+        buffer_write(buffer, 0x80 | (cp & 0x3F));
+    } else {
+        buffer_write(buffer, 0xF0 | (cp >> 18));
+        buffer_write(buffer, 0x80 | ((cp >> 12) & 0x3F));
+        buffer_write(buffer, 0x80 | ((cp >> 6) & 0x3F));
+        buffer_write(buffer, 0x80 | (cp & 0x3F));
+    }
+}
+
+/**
+ * 解码反斜杠之后的转义序列，把得到的字节写入缓冲区
+ * @param buffer 缓冲区
+ */
+static void lex_read_escape(struct buffer *buffer) {
+    int c = nextc();
+    unsigned long value = 0;
+    switch (c) {
+        case 'n': buffer_write(buffer, '\n'); break;
+        case 't': buffer_write(buffer, '\t'); break;
+        case 'r': buffer_write(buffer, '\r'); break;
+        case 'a': buffer_write(buffer, '\a'); break;
+        case 'b': buffer_write(buffer, '\b'); break;
+        case 'f': buffer_write(buffer, '\f'); break;
+        case 'v': buffer_write(buffer, '\v'); break;
+        case 'e': buffer_write(buffer, 0x1B); break;
+        case '\\':
+        case '\'':
+        case '"':
+        case '?':
+            buffer_write(buffer, c);
+            break;
+        case '\n':
+            // 反斜杠加换行是续行，不产生任何字符
+            break;
+        case 'x': {
+            int digits = 0;
+            bool overflow = false;
+            for (int d = lex_hex_digit_value(peekc()); d >= 0; d = lex_hex_digit_value(peekc()), digits++) {
+                value = value * 16 + d;
+                // 记住越界，过长的数字串会让value回绕
+                overflow |= value > 0xFF;
+                nextc();
+            }
+            if (digits == 0) {
+                LEX_ERROR("\\x used with no following hex digits");
+            }
+            if (overflow) {
+                LEX_ERROR("hex escape sequence out of range");
+            }
+            buffer_write(buffer, value);
+            break;
+        }
+        case 'u':
+        case 'U': {
+            int digits = c == 'u' ? 4 : 8;
+            for (int i = 0; i < digits; i++) {
+                int d = lex_hex_digit_value(nextc());
+                if (d < 0) {
+                    LEX_ERROR("Incomplete universal character name");
+                }
+                value = value * 16 + d;
+            }
+            if (value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+                LEX_ERROR("Invalid universal character name");
+            }
+            lex_write_utf8(buffer, value);
+            break;
+        }
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+            // 最多三位八进制数字
+            value = c - '0';
+            for (int i = 1; i < 3 && peekc() >= '0' && peekc() <= '7'; i++) {
+                value = value * 8 + (nextc() - '0');
+            }
+            if (value > 0xFF) {
+                LEX_ERROR("octal escape sequence out of range");
+            }
+            buffer_write(buffer, value);
+            break;
+        case EOF:
+            LEX_ERROR("Unterminated escape sequence");
+            break;
+        default:
+            lex_process->compiler->pos = lex_process->pos;
+            compiler_warning(lex_process->compiler, "Unknown escape sequence '\\%c'", c);
+            buffer_write(buffer, c);
+    }
+}
+
+/**
+ * 读取字符串或字符常量的内容，开始的分隔符已经被读取
+ * @param end_delim 结束分隔符
+ * @param decode 是否解码转义序列，#include的文件名不解码
+ * @return 内容所在的缓冲区，在读取下一个字符串之前有效
+ */
+static struct buffer *lex_read_literal(char end_delim, bool decode) {
+    struct buffer *buffer = lex_literal_buffer();
+    for (int c = nextc(); c != end_delim; c = nextc()) {
+        if (c == EOF || c == '\n') {
+            LEX_ERROR("Missing terminating %c character", end_delim);
+        }
+        if (c == '\\' && decode) {
+            lex_read_escape(buffer);
+            continue;
+        }
+        buffer_write(buffer, c);
+    }
+    return buffer;
+}
+
+/**
+ * 创建一个字符串token结构体，转义序列被解码，结果被驻留，相同的字符串只保存一份
  * @param start_delim 开始分割符
  * @param end_delim 结束分割符
  * @return
  */
 static struct token *token_make_string(char start_delim, char end_delim) {
-    struct buffer *buf = buffer_create();
     assert(start_delim == nextc());
-    char c = nextc();
-    for (; c != end_delim && c != EOF; c = nextc()) {
-        if (c == '\\') {
-            continue;
-        }
-
-        buffer_write(buf, c);
-    }
-    buffer_write(buf, 0x00);
+    // #include的文件名中的反斜杠没有特殊含义
+    struct token *last_token = lexer_last_token();
+    bool decode = start_delim != '<' && !(last_token && token_is_keyword(last_token, "include"));
+    struct buffer *buffer = lex_read_literal(end_delim, decode);
     return token_create(&(struct token) {
             .type = TOKEN_TYPE_STRING,
-            .sval = buffer_ptr(buf)
+            .flag = start_delim == '<' ? TOKEN_FLAG_ANGLE_BRACKETS : 0,
+            .sval = intern_string_n(buffer->data, buffer->len)
     });
 }
 
@@ -268,7 +512,7 @@ bool op_valid(const char *op) {
 void read_op_flush_back_keep_first(struct buffer *buffer) {
     const char *data = buffer_ptr(buffer);
     int len = buffer->len;
-    for (int i = len - 1; i > 1; i--) {
+    for (int i = len - 1; i >= 1; i--) {
         if (data[i] == 0x00) {
             continue;
         }
@@ -283,7 +527,10 @@ void read_op_flush_back_keep_first(struct buffer *buffer) {
 const char *read_op() {
     bool single_operator = true;
     char op = nextc();
-    struct buffer *buffer = buffer_create();
+    // 运算符最多只有几个字符，缓冲区放在栈上不需要分配内存
+    struct buffer op_buffer;
+    struct buffer *buffer = &op_buffer;
+    buffer_init(buffer);
     buffer_write(buffer, op);
 
     if (!op_treated_as_one(op)) {
@@ -313,9 +560,12 @@ const char *read_op() {
     } else if (!op_valid(ptr))
         // 如果是单字符运算符，但不在列表中
     {
-        compiler_error(lex_process->compiler, "The operator %s is not valid\n", ptr);
+        LEX_ERROR("The operator %s is not valid\n", ptr);
     }
-    return ptr;
+    // 运算符只有少数几种，驻留之后缓冲区可以立即释放
+    const char *result = intern_string(ptr);
+    buffer_release(buffer);
+    return result;
 }
 
 /**
@@ -325,6 +575,7 @@ static void lex_new_expression() {
     lex_process->current_expression_count++;
     if (lex_process->current_expression_count == 1) {
         lex_process->parentheses_buffer = buffer_create();
+        lex_process->parentheses_start = vector_count(lex_process->token_vec);
     }
 }
 
@@ -334,10 +585,28 @@ static void lex_new_expression() {
 static void lex_finish_expression() {
     lex_process->current_expression_count--;
     if (lex_process->current_expression_count < 0) {
-        compiler_error(lex_process->compiler, "Unexpected ')'\n");
+        LEX_ERROR("Unexpected ')'\n");
     }
 }
 
+/**
+ * 最外层的括号结束之后，把括号之间的内容驻留，并让括号中的token指向驻留的字符串，然后释放括号缓冲区
+ * 缓冲区在读取括号内容的过程中可能被重新分配，所以token在这之前保存的指针不能继续使用
+ */
+static void lex_finish_parentheses() {
+    struct buffer *buffer = lex_process->parentheses_buffer;
+    buffer_write(buffer, 0x00);
+    const char *between_brackets = intern_string(buffer_ptr(buffer));
+    for (size_t i = lex_process->parentheses_start; i < token_vector_count(lex_process->token_vec); i++) {
+        struct token *token = token_vector_at(lex_process->token_vec, i);
+        if (token->between_brackets) {
+            token->between_brackets = between_brackets;
+        }
+    }
+    buffer_free(buffer);
+    lex_process->parentheses_buffer = NULL;
+}
+
 /**
  * 检测当前是否在一个表达式内部
  */
@@ -425,25 +694,84 @@ static struct token *token_make_operator_or_string() {
 }
 
 
+/**
+ * 是否跳过注释和换行，不为它们产生token
+ */
+static bool lex_is_compact() {
+    return lex_process->compiler->flags & COMPILE_PROCESS_FLAG_COMPACT_TOKENS;
+}
+
+/**
+ * 跳过的注释相当于一个空格
+ * @return 表示没有产生token
+ */
+static struct token *lex_skip_comment() {
+    struct token *last_token = lexer_last_token();
+    if (last_token) {
+        last_token->whitespace = true;
+    }
+    return &lex_skipped_token;
+}
+
 struct token *token_make_one_line_comment() {
-    struct buffer *buffer = buffer_create();
-    char c;
-    LEX_GETC_IF(buffer, c, c != '\n' && c != EOF);
+    if (lex_is_compact()) {
+        lex_read_until_newline(NULL);
+        return lex_skip_comment();
+    }
+    struct buffer *buffer = lex_literal_buffer();
+    lex_read_until_newline(buffer);
     buffer_write(buffer, 0x00);
+    const char *comment = intern_string(buffer_ptr(buffer));
     return token_create(&(struct token) {
             .type = TOKEN_TYPE_COMMENT,
-            .sval = buffer_ptr(buffer)
+            .sval = comment
     });
 }
 
+/**
+ * 跳过多行注释剩下的部分直到注释结束，不复制注释的内容。输入源支持批量读取时在窗口中查找*，中间的字符整段跳过
+ */
+static void lex_skip_multiline_comment() {
+    while (true) {
+        int c = peekc();
+        if (c == EOF) {
+            LEX_ERROR("You did not close this multiline comment.\n");
+        }
+        if (lex_process->function->next_span && c != '*') {
+            const char *start = &lex_process->window[lex_process->window_index];
+            size_t available = lex_process->window_len - lex_process->window_index;
+            const char *star = memchr(start, '*', available);
+            size_t len = star ? (size_t) (star - start) : available;
+            if (lex_is_in_expression()) {
+                buffer_write_n(lex_process->parentheses_buffer, start, len);
+            }
+            for (const char *newline = memchr(start, '\n', len); newline;
+                 newline = memchr(newline + 1, '\n', len - (newline + 1 - start))) {
+                lex_process->pos.line++;
+                lex_process->pos.col = 1 - (int) (newline + 1 - start);
+            }
+            lex_process->pos.col += len;
+            lex_process->window_index += len;
+            continue;
+        }
+        if (nextc() == '*' && peekc() == '/') {
+            nextc();
+            return;
+        }
+    }
+}
 
 struct token *token_make_multiline_comment() {
-    struct buffer *buffer = buffer_create();
-    char c = 0;
+    if (lex_is_compact()) {
+        lex_skip_multiline_comment();
+        return lex_skip_comment();
+    }
+    struct buffer *buffer = lex_literal_buffer();
+    int c = 0;
     while (true) {
         LEX_GETC_IF(buffer, c, c != '*' && c != EOF);
         if (c == EOF) {
-            compiler_error(lex_process->compiler, "You did not close this multiline comment.\n");
+            LEX_ERROR("You did not close this multiline comment.\n");
         } else if (c == '*') {
             // 跳过星号
             nextc();
@@ -453,15 +781,17 @@ struct token *token_make_multiline_comment() {
             }
         }
     }
+    buffer_write(buffer, 0x00);
+    const char *comment = intern_string(buffer_ptr(buffer));
     return token_create(&(struct token) {
             .type = TOKEN_TYPE_COMMENT,
-            .sval = buffer_ptr(buffer)
+            .sval = comment
     });
 }
 
 
 struct token *handle_comment() {
-    char c = peekc();
+    int c = peekc();
     if (c == '/') {
         nextc();
         if (peekc() == '/') {
@@ -481,7 +811,7 @@ struct token *handle_comment() {
  * @return 符号token结构体
  */
 static struct token *token_make_symbol() {
-    char c = nextc();
+    int c = nextc();
     if (c == ')') {
         lex_finish_expression();
     }
@@ -493,21 +823,35 @@ static struct token *token_make_symbol() {
 }
 
 
+/**
+ * 是否是标识符中可以出现的字符，输入已经验证过是合法的UTF-8，所以非ASCII的字节总是组成完整的字符
+ * @param c 字节，EOF表示输入结束
+ */
+static bool lex_is_identifier_start(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80;
+}
+
+static bool lex_is_identifier_char(int c) {
+    return lex_is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
 static struct token *token_make_identifier_or_keyword() {
-    struct buffer *buffer = buffer_create();
-    char c;
-    LEX_GETC_IF(buffer, c, (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_');
+    struct buffer *buffer = lex_literal_buffer();
+    int c;
+    LEX_GETC_IF(buffer, c, lex_is_identifier_char(c));
     buffer_write(buffer, 0x00);
-    if (is_keyword(buffer_ptr(buffer))) {
+    // 标识符和关键字都被驻留，相同的名字共享同一个字符串，预处理器可以直接比较指针
+    const char *name = intern_string(buffer_ptr(buffer));
+    if (is_keyword(name)) {
         // 关键字检测
         return token_create(&(struct token) {
                 .type = TOKEN_TYPE_KEYWORD,
-                .sval = buffer_ptr(buffer)
+                .sval = name
         });
     }
     return token_create(&(struct token) {
             .type = TOKEN_TYPE_IDENTIFIER,
-            .sval = buffer_ptr(buffer)
+            .sval = name
     });
 }
 
@@ -516,46 +860,179 @@ static struct token *token_make_identifier_or_keyword() {
  * @return
  */
 struct token *read_special_token() {
-    char c = peekc();
-    if (isalpha(c) || c == '_') {
+    int c = peekc();
+    if (lex_is_identifier_start(c)) {
         return token_make_identifier_or_keyword();
     }
     return NULL;
 }
 
+/**
+ * 判断刚读完的一行是否是#if 0，它控制的代码无论宏如何定义都不会被编译
+ */
+static bool lex_is_if_zero_line() {
+    size_t count = token_vector_count(lex_process->token_vec);
+    if (count < 3) {
+        return false;
+    }
+    struct token *hash = token_vector_at(lex_process->token_vec, count - 3);
+    struct token *directive = token_vector_at(lex_process->token_vec, count - 2);
+    struct token *value = token_vector_at(lex_process->token_vec, count - 1);
+    // 文件的第一个token没有行首标记
+    return token_is_symbol(hash, '#') && (count == 3 || token_is_line_start(hash)) &&
+           token_is_keyword(directive, "if") && value->type == TOKEN_TYPE_NUMBER && value->llnum == 0;
+}
+
+/**
+ * 跳过行首的空白和注释
+ */
+static void lex_skip_line_space() {
+    while (true) {
+        int c = peekc();
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            nextc();
+            continue;
+        }
+        if (c != '/') {
+            return;
+        }
+        nextc();
+        if (peekc() == '*') {
+            nextc();
+            lex_skip_multiline_comment();
+            continue;
+        }
+        if (peekc() == '/') {
+            lex_read_until_newline(NULL);
+        }
+        return;
+    }
+}
+
+/**
+ * 跳过不编译的区域中一行剩下的部分，包括行尾的换行。
+ * 只识别注释、字符串、字符常量和行尾的\，没有结束的字符串和字符常量(例如英文注释中的don't)到行尾为止。
+ * 输入源支持批量读取并且这一行中没有这些字符时整行一次跳过
+ */
+static void lex_skip_inactive_line() {
+    if (lex_process->function->next_span && peekc() != EOF) {
+        const char *start = &lex_process->window[lex_process->window_index];
+        size_t available = lex_process->window_len - lex_process->window_index;
+        const char *newline = memchr(start, '\n', available);
+        size_t len = newline ? (size_t) (newline - start) : 0;
+        if (newline && !memchr(start, '/', len) && !memchr(start, '"', len) && !memchr(start, '\'', len) &&
+            !memchr(start, '\\', len)) {
+            lex_process->window_index += len + 1;
+            lex_process->pos.line++;
+            lex_process->pos.col = 1;
+            return;
+        }
+    }
+
+    char quote = 0;
+    for (int c = nextc(); c != EOF && c != '\n'; c = nextc()) {
+        if (c == '\\' && (quote || peekc() == '\n')) {
+            if (peekc() != EOF) {
+                nextc();
+            }
+        } else if (quote) {
+            quote = c == quote ? 0 : quote;
+        } else if (c == '"' || c == '\'') {
+            quote = (char) c;
+        } else if (c == '/' && peekc() == '*') {
+            nextc();
+            lex_skip_multiline_comment();
+        } else if (c == '/' && peekc() == '/') {
+            lex_read_until_newline(NULL);
+        }
+    }
+}
+
+/**
+ * 跳过#if 0之后直到与它匹配的#elif、#else或#endif之前的内容，不为其中的代码产生token。
+ * 每行只检查跳过空白和注释之后是否是#，嵌套的条件编译指令只计数，其余部分由lex_skip_inactive_line跳过。
+ * 找到匹配的指令时已经读过了#和指令名，为它们产生token，这一行剩下的部分正常进行词法分析
+ */
+static void lex_skip_inactive_group() {
+    int depth = 0;
+    while (peekc() != EOF) {
+        lex_skip_line_space();
+        if (peekc() != '#') {
+            lex_skip_inactive_line();
+            continue;
+        }
+
+        struct pos hash_pos = lex_process->pos;
+        nextc();
+        bool space = false;
+        while (peekc() == ' ' || peekc() == '\t') {
+            nextc();
+            space = true;
+        }
+        struct pos name_pos = lex_process->pos;
+        char name[8];
+        size_t len = 0;
+        for (int c = peekc(); lex_is_identifier_char(c); c = peekc()) {
+            name[len < sizeof(name) - 1 ? len : sizeof(name) - 1] = (char) nextc();
+            len++;
+        }
+        name[len < sizeof(name) - 1 ? len : sizeof(name) - 1] = 0x00;
+        if (len >= sizeof(name)) {
+            // 比所有条件编译指令都长的名字
+            name[0] = 0x00;
+        }
+
+        if (S_EQ(name, "if") || S_EQ(name, "ifdef") || S_EQ(name, "ifndef")) {
+            depth++;
+        } else if ((S_EQ(name, "endif") && depth-- == 0) ||
+                   (depth == 0 && (S_EQ(name, "else") || S_EQ(name, "elif")))) {
+            lex_process->line_start = true;
+            struct token *hash = token_create(&(struct token) {
+                    .type = TOKEN_TYPE_SYMBOL,
+                    .cval = '#',
+                    .whitespace = space
+            });
+            hash->pos = hash_pos;
+            token_vector_push(lex_process->token_vec, hash);
+            const char *directive_name = intern_string(name);
+            struct token *directive = token_create(&(struct token) {
+                    .type = is_keyword(directive_name) ? TOKEN_TYPE_KEYWORD : TOKEN_TYPE_IDENTIFIER,
+                    .sval = directive_name
+            });
+            directive->pos = name_pos;
+            token_vector_push(lex_process->token_vec, directive);
+            return;
+        }
+        lex_skip_inactive_line();
+    }
+}
+
 /**
  * 创建一个换行符token结构体
  * @return
  */
 struct token *token_make_newline() {
     nextc();
+    if (lex_is_compact()) {
+        // 换行记录在下一个token上；行尾的\和换行一起去掉，两行连成一行
+        struct token *last_token = lexer_last_token();
+        if (last_token && token_is_symbol(last_token, '\\')) {
+            lex_process->line_start = token_is_line_start(last_token);
+            lexer_pop_token();
+        } else {
+            lex_process->line_start = true;
+            // #if 0控制的代码直接按字节跳过
+            if (!lex_is_in_expression() && lex_is_if_zero_line()) {
+                lex_skip_inactive_group();
+            }
+        }
+        return &lex_skipped_token;
+    }
     return token_create(&(struct token) {
             .type = TOKEN_TYPE_NEWLINE
     });
 }
 
-char lex_get_escaped_char(char c) {
-    char co = 0;
-    switch (c) {
-        case 'n':
-            co = '\n';
-            break;
-        case 't':
-            co = '\t';
-            break;
-        case 'r':
-            co = '\r';
-            break;
-        case '\\':
-            co = '\\';
-            break;
-        case '\'':
-            co = '\'';
-            break;
-    }
-    return co;
-}
-
 /**
  * 弹出一个token
  */
@@ -564,9 +1041,8 @@ void lexer_pop_token() {
 }
 
 
-bool is_hex_char(char c) {
-    c = tolower(c);
-    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+bool is_hex_char(int c) {
+    return lex_hex_digit_value(c) >= 0;
 }
 
 /**
@@ -574,8 +1050,8 @@ bool is_hex_char(char c) {
  * @return
  */
 const char *read_hex_number_str() {
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
+    struct buffer *buffer = lex_literal_buffer();
+    int c = peekc();
     LEX_GETC_IF(buffer, c, is_hex_char(c));
     buffer_write(buffer, 0x00);
     return buffer_ptr(buffer);
@@ -599,8 +1075,8 @@ struct token *token_make_special_number_hexadecimal() {
 
 
 const char *read_bin_number_str() {
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
+    struct buffer *buffer = lex_literal_buffer();
+    int c = peekc();
     LEX_GETC_IF(buffer, c, c == '0' || c == '1');
     buffer_write(buffer, 0x00);
     return buffer_ptr(buffer);
@@ -608,9 +1084,9 @@ const char *read_bin_number_str() {
 
 void lexer_validate_binary_string(const char *str) {
     size_t len = strlen(str);
-    for (int i = 0; i < len; i++) {
+    for (size_t i = 0; i < len; i++) {
         if (str[i] != '0' && str[i] != '1') {
-            compiler_error(lex_process->compiler, "Invalid binary string\n");
+            LEX_ERROR("Invalid binary string\n");
         }
     }
 }
@@ -634,34 +1110,39 @@ struct token *token_make_special_number() {
     if (!last_token || !(last_token->type == TOKEN_TYPE_NUMBER && last_token->llnum == 0)) {
         return token_make_identifier_or_keyword();
     }
+    // 不产生换行token时行首标记在被替换的0上
+    int line_start = last_token->flag & TOKEN_FLAG_LINE_START;
     lexer_pop_token();
-    char c = peekc();
+    int c = peekc();
     if (c == 'x') {
         token = token_make_special_number_hexadecimal();
     } else if (c == 'b') {
         token = token_make_special_number_binary();
     }
+    if (token) {
+        token->flag |= line_start;
+    }
     return token;
 }
 
 /**
- * 创建一个引号token结构体
+ * 创建一个字符常量token结构体，和字符串使用同样的转义解码，多字符常量按照GCC的方式合并为一个整数
  * @return
  */
 struct token *token_make_quote() {
     assert_next_char('\'');
-    char c = nextc();
-    if (c == '\\') {
-        c = nextc();
-        c = lex_get_escaped_char(c);
+    struct buffer *buffer = lex_read_literal('\'', true);
+    if (buffer->len == 0) {
+        LEX_ERROR("Empty character constant");
     }
-    if (nextc() != '\'') {
-        compiler_error(lex_process->compiler, "You opened a quote, but did not close it.\n");
+    unsigned long long value = 0;
+    for (size_t i = 0; i < buffer->len; i++) {
+        value = (value << 8) | (unsigned char) buffer->data[i];
     }
 
     return token_create(&(struct token) {
             .type = TOKEN_TYPE_NUMBER,
-            .cval = c
+            .llnum = value
     });
 }
 
@@ -671,7 +1152,7 @@ struct token *token_make_quote() {
  */
 struct token *read_next_token() {
     struct token *token = NULL;
-    char c = peekc();
+    int c = peekc();
     token = handle_comment();
     if (token) {
         return token;
@@ -717,7 +1198,7 @@ struct token *read_next_token() {
 
         default:
             token = read_special_token();
-            if (!token) { compiler_error(lex_process->compiler, "Unexpected token\n"); }
+            if (!token) { LEX_ERROR("Unexpected token\n"); }
     }
     return token;
 }
@@ -728,45 +1209,90 @@ struct token *read_next_token() {
  * @return
  */
 int lex(struct lex_process *process) {
+    // 预处理器在词法分析的过程中可能会再对字符串进行词法分析(例如##运算符)，结束后需要恢复之前的词法分析过程
+    struct lex_process *previous_process = lex_process;
     process->current_expression_count = 0;
     process->parentheses_buffer = NULL;
     // 括号缓冲区
+    process->window = NULL;
+    process->window_len = 0;
+    process->window_index = 0;
     lex_process = process;
     process->pos.filename = process->compiler->cfile.abs_path;
 
+    process->line_start = false;
     struct token *token = read_next_token();
     while (token) {
-        vector_push(process->token_vec, token);
+        if (token == &lex_skipped_token) {
+            token = read_next_token();
+            continue;
+        }
+        token_vector_push(process->token_vec, token);
+        if (process->parentheses_buffer && !lex_is_in_expression()) {
+            lex_finish_parentheses();
+        }
         token = read_next_token();
     }
+    // 没有闭合的括号
+    if (process->parentheses_buffer) {
+        lex_finish_parentheses();
+    }
+    // 窗口中已经读取的部分交还给输入源
+    if (process->function->next_span) {
+        process->function->advance(process, process->window_index);
+        process->window = NULL;
+        process->window_len = 0;
+        process->window_index = 0;
+    }
+    lex_process = previous_process;
     return LEXICAL_ANALYSIS_ALL_OK;
 }
 
-char lexer_string_buffer_next_char(struct lex_process *process) {
+int lexer_string_buffer_next_char(struct lex_process *process) {
     struct buffer *buf = lex_process_private(process);
     return buffer_read(buf);
 }
 
-char lexer_string_buffer_peek_char(struct lex_process *process) {
+int lexer_string_buffer_peek_char(struct lex_process *process) {
     struct buffer *buf = lex_process_private(process);
     return buffer_peek(buf);
 }
 
-void lexer_string_buffer_push_char(struct lex_process *process, char c) {
+void lexer_string_buffer_push_char(struct lex_process *process, int c) {
+    struct buffer *buf = lex_process_private(process);
+    if (c == EOF) {
+        return;
+    }
+    // 推回的字符需要放在读取位置之前，而不是追加到缓冲区的末尾
+    if (buf->rindex > 0) {
+        buf->rindex--;
+        buf->data[buf->rindex] = c;
+    }
+}
+
+const char *lexer_string_buffer_next_span(struct lex_process *process, size_t *len) {
+    struct buffer *buf = lex_process_private(process);
+    *len = buf->len - buf->rindex;
+    return &buf->data[buf->rindex];
+}
+
+void lexer_string_buffer_advance(struct lex_process *process, size_t len) {
     struct buffer *buf = lex_process_private(process);
-    buffer_write(buf, c);
+    buf->rindex += len;
 }
 
 struct lex_process_functions lexer_string_buffer_functions = {
         .next_char = lexer_string_buffer_next_char,
         .peek_char = lexer_string_buffer_peek_char,
-        .push_char = lexer_string_buffer_push_char
+        .push_char = lexer_string_buffer_push_char,
+        .next_span = lexer_string_buffer_next_span,
+        .advance = lexer_string_buffer_advance
 };
 
 
 struct lex_process *token_build_for_string(struct compile_process *compiler, const char *str) {
     struct buffer *buffer = buffer_create();
-    buffer_printf(buffer, str);
+    buffer_write_str(buffer, str);
     struct lex_process *lex_process = lex_process_create(compiler, &lexer_string_buffer_functions, buffer);
     if (!lex_process) {
         return NULL;
@@ -2,21 +2,38 @@
 // Created by kery on 2024/2/24.
 //
 #include <stdio.h>
+#include <stdlib.h>
 #include "helpers/vector.h"
 #include "compiler.h"
-int main() {
-    // 打开test.c文件，然后编译它
-    int res = compile_file("./test.c", "test", 0);
-    if(res == COMPILER_FILE_COMPILED_OK)
+int main(int argc, char** argv) {
+    // main --server [SOCKET] [-j WORKERS] 作为常驻的编译服务运行，由kclient发送编译请求
+    if (argc > 1 && S_EQ(argv[1], "--server"))
     {
-        printf("everything compiled fine\n");
-    } else if (res == COMPILER_FAILED_WITH_ERRORS)
-    {
-        printf("compilation failed\n");
+        const char* socket_path = getenv("KCOMPILER_SOCKET");
+        int workers = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            if (S_EQ(argv[i], "-j") && i + 1 < argc)
+            {
+                workers = atoi(argv[++i]);
+            }
+            else
+            {
+                socket_path = argv[i];
+            }
+        }
+        return compile_server_run(socket_path ? socket_path : COMPILE_SERVER_DEFAULT_SOCKET, workers) == 0 ? 0 : 1;
     }
-    else
+
+    // 所有输入文件在同一个进程中编译，共享头文件缓存
+    struct compile_driver* driver = compile_driver_create();
+    if (!compile_driver_parse(driver, argc - 1, argv + 1))
     {
-        printf("unknown error\n");
+        fprintf(stderr, "usage: %s [-I DIR] [-D NAME[=VALUE]] [-fsyntax-only] [-fmem-report] [-fkeep-comments] [-fskip-unchanged] [--cache-dir DIR] [--cache-stats] [-M] [-MF FILE] [--pch FILE] [--create-pch FILE] [-o FILE] FILE|-|@MANIFEST...\n", argv[0]);
+        compile_driver_free(driver);
+        return 1;
     }
-    return 0;
-}
\ No newline at end of file
+    int failed = compile_driver_run(driver);
+    compile_driver_free(driver);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,729 @@
+//
+// Description: 预编译头文件，保存预处理完文件开头的#include之后的状态，之后的编译可以直接从这个状态开始
+// Created by kery on 2024/3/16.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * 预编译头文件的格式
+ * 文件由一个struct pch_file_header开头，之后是各个段，段的位置和元素数量保存在文件头中。
+ * 所有的数据都是定长的结构体，没有指针，整个文件可以直接mmap之后使用。
+ * 字符串统一保存在字符串段中，其他段通过字符串的编号引用字符串，PCH_NO_STRING表示NULL。
+ *
+ * strings: 每个字符串在string_data中的偏移，uint32_t
+ * string_data: 以0结尾的字符串
+ * includes: 文件开头被预编译的#include对应的头文件的绝对路径，uint32_t
+ * dependencies: 预处理时读取过的所有头文件，struct pch_dependency，任何一个被修改过则预编译头文件失效
+ * definitions: 预处理完之后的宏定义表，struct pch_definition
+ * params: 函数式宏的参数名，uint32_t
+ * tokens: 宏的值，struct pch_token
+ * output: 预处理文件开头产生的token，struct pch_token
+ * once: 被#pragma once的头文件的绝对路径，uint32_t
+ * command_line: 生成时命令行中-D给出的宏定义，uint32_t，使用时必须完全相同
+ * symbols: 为之后的符号表保留，目前总是空的
+ */
+#define PCH_MAGIC "KPCH"
+#define PCH_VERSION 1
+#define PCH_NO_STRING UINT32_MAX
+
+struct pch_section
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+enum
+{
+    PCH_SECTION_STRINGS,
+    PCH_SECTION_STRING_DATA,
+    PCH_SECTION_INCLUDES,
+    PCH_SECTION_DEPENDENCIES,
+    PCH_SECTION_DEFINITIONS,
+    PCH_SECTION_PARAMS,
+    PCH_SECTION_TOKENS,
+    PCH_SECTION_OUTPUT,
+    PCH_SECTION_ONCE,
+    PCH_SECTION_COMMAND_LINE,
+    PCH_SECTION_SYMBOLS,
+    PCH_SECTION_COUNT
+};
+
+struct pch_file_header
+{
+    char magic[4];
+    uint32_t version;
+    int32_t flags;
+    uint32_t reserved;
+    struct pch_section sections[PCH_SECTION_COUNT];
+};
+
+struct pch_dependency
+{
+    uint32_t path;
+    uint32_t reserved;
+    int64_t mtime;
+    int64_t size;
+};
+
+struct pch_definition
+{
+    uint32_t name;
+    uint8_t function_like;
+    uint8_t variadic;
+    uint8_t has_operators;
+    uint8_t reserved;
+    uint32_t param_start;
+    uint32_t param_count;
+    uint32_t token_start;
+    uint32_t token_count;
+};
+
+/**
+ * value: 字符串类型的token保存字符串编号，其他token保存llnum
+ */
+struct pch_token
+{
+    int32_t type;
+    int32_t flag;
+    int32_t line;
+    int32_t col;
+    uint32_t filename;
+    uint32_t between_brackets;
+    int32_t num_type;
+    uint8_t whitespace;
+    uint8_t reserved[3];
+    uint64_t value;
+};
+
+/**
+ * 正在使用的预编译头文件，已经转换为预处理器可以直接使用的形式，所有翻译单元共享
+ * path: 预编译头文件的路径
+ * flags: 生成时的编译选项
+ * includes: 被预编译的头文件的绝对路径
+ * include_count: includes的数量
+ * definitions: 宏定义，恢复时复制到翻译单元的预处理器中，宏的值和参数不会被修改，可以共享
+ * definition_count: definitions的数量
+ * output: 预处理文件开头产生的token
+ * output_count: output的数量
+ * once: 被#pragma once的头文件的绝对路径
+ * once_count: once的数量
+ * dependencies: 读取过的头文件的绝对路径
+ * dependency_count: dependencies的数量
+ * command_line: 生成时的命令行宏定义
+ * command_line_count: command_line的数量
+ */
+static struct pch_state
+{
+    const char* path;
+    int flags;
+    const char** includes;
+    int include_count;
+    struct preprocessor_definition* definitions;
+    int definition_count;
+    struct token* output;
+    int output_count;
+    const char** once;
+    int once_count;
+    const char** dependencies;
+    int dependency_count;
+    const char** command_line;
+    int command_line_count;
+} *pch_state = NULL;
+
+/**
+ * 生成预编译头文件时使用的写入状态
+ * strings: 字符串->编号+1
+ * sections: 每个段的内容
+ */
+struct pch_writer
+{
+    struct hashmap* strings;
+    struct vector* sections[PCH_SECTION_COUNT];
+};
+
+/**
+ * @brief token的值是否是字符串
+ */
+static bool pch_token_has_string(int type)
+{
+    return type == TOKEN_TYPE_IDENTIFIER || type == TOKEN_TYPE_KEYWORD || type == TOKEN_TYPE_OPERATOR
+           || type == TOKEN_TYPE_STRING || type == TOKEN_TYPE_COMMENT;
+}
+
+/**
+ * @brief 获取一个字符串的编号，第一次遇到的字符串加入字符串段
+ * @param writer 写入状态
+ * @param str 字符串，可以为NULL
+ * @return 字符串编号
+ */
+static uint32_t pch_write_string(struct pch_writer* writer, const char* str)
+{
+    if (!str)
+    {
+        return PCH_NO_STRING;
+    }
+
+    uintptr_t id = (uintptr_t) hashmap_get(writer->strings, str);
+    if (id)
+    {
+        return id - 1;
+    }
+
+    struct vector* data = writer->sections[PCH_SECTION_STRING_DATA];
+    uint32_t offset = vector_count(data);
+    for (const char* c = str; ; c++)
+    {
+        vector_push(data, (void*) c);
+        if (*c == 0x00)
+        {
+            break;
+        }
+    }
+    vector_push(writer->sections[PCH_SECTION_STRINGS], &offset);
+    id = vector_count(writer->sections[PCH_SECTION_STRINGS]);
+    hashmap_set(writer->strings, str, (void*) id);
+    return id - 1;
+}
+
+/**
+ * @brief 把一个字符串编号加入段中
+ */
+static void pch_write_string_ref(struct pch_writer* writer, int section, const char* str)
+{
+    uint32_t id = pch_write_string(writer, str);
+    vector_push(writer->sections[section], &id);
+}
+
+/**
+ * @brief 把一个token加入段中
+ */
+static void pch_write_token(struct pch_writer* writer, int section, struct token* token)
+{
+    struct pch_token record = {
+            .type = token->type,
+            .flag = token->flag,
+            .line = token->pos.line,
+            .col = token->pos.col,
+            .filename = pch_write_string(writer, token->pos.filename),
+            .between_brackets = pch_write_string(writer, token->between_brackets),
+            .num_type = token->num.type,
+            .whitespace = token->whitespace,
+            .value = token->llnum
+    };
+    if (pch_token_has_string(token->type))
+    {
+        record.value = pch_write_string(writer, token->sval);
+    }
+    vector_push(writer->sections[section], &record);
+}
+
+/**
+ * @brief 把一个宏定义加入宏定义段中
+ */
+static void pch_write_definition(struct pch_writer* writer, struct preprocessor_definition* definition)
+{
+    struct pch_definition record = {
+            .name = pch_write_string(writer, definition->name),
+            .function_like = definition->function_like,
+            .variadic = definition->variadic,
+            .has_operators = definition->has_operators,
+            .param_start = vector_count(writer->sections[PCH_SECTION_PARAMS]),
+            .param_count = definition->param_count,
+            .token_start = vector_count(writer->sections[PCH_SECTION_TOKENS]),
+            .token_count = definition->token_count
+    };
+    for (int i = 0; i < definition->param_count; i++)
+    {
+        pch_write_string_ref(writer, PCH_SECTION_PARAMS, definition->params[i]);
+    }
+    for (int i = 0; i < definition->token_count; i++)
+    {
+        pch_write_token(writer, PCH_SECTION_TOKENS, &definition->tokens[i]);
+    }
+    vector_push(writer->sections[PCH_SECTION_DEFINITIONS], &record);
+}
+
+/**
+ * @brief 把一个被读取过的头文件加入依赖段中，每个头文件只记录一次
+ */
+static void pch_write_dependency(struct pch_writer* writer, struct hashmap* seen, const char* path)
+{
+    struct stat st;
+    if (hashmap_get(seen, path) || stat(path, &st) != 0)
+    {
+        return;
+    }
+    hashmap_set(seen, path, (void*) path);
+
+    struct pch_dependency record = {
+            .path = pch_write_string(writer, path),
+            .mtime = st.st_mtime,
+            .size = st.st_size
+    };
+    vector_push(writer->sections[PCH_SECTION_DEPENDENCIES], &record);
+}
+
+/**
+ * @brief 把所有段写入文件
+ * @param writer 写入状态
+ * @param pch_filename 预编译头文件的路径
+ * @param flags 编译选项
+ * @return 是否写入成功
+ */
+static bool pch_write_file(struct pch_writer* writer, const char* pch_filename, int flags)
+{
+    struct pch_file_header header = {
+            .magic = PCH_MAGIC,
+            .version = PCH_VERSION,
+            .flags = flags
+    };
+    // 每个段按8字节对齐，mmap之后可以直接按结构体访问
+    uint64_t offset = sizeof(header);
+    for (int i = 0; i < PCH_SECTION_COUNT; i++)
+    {
+        struct vector* section = writer->sections[i];
+        offset = (offset + 7) & ~7ULL;
+        header.sections[i].offset = offset;
+        header.sections[i].count = vector_count(section);
+        offset += vector_count(section) * vector_element_size(section);
+    }
+
+    FILE* file = fopen(pch_filename, "wb");
+    if (!file)
+    {
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    static const char padding[8] = {0};
+    for (int i = 0; i < PCH_SECTION_COUNT; i++)
+    {
+        struct vector* section = writer->sections[i];
+        fwrite(padding, 1, header.sections[i].offset - ftell(file), file);
+        fwrite(vector_data_ptr(section), vector_element_size(section), vector_count(section), file);
+    }
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * @brief 生成预编译头文件，预处理输入文件开头连续的#include并保存预处理之后的状态
+ * 预编译头文件只对开头被包含的头文件相同、命令行宏定义相同的翻译单元有效
+ * @param file_name 输入文件，通常只包含需要预编译的#include
+ * @param pch_filename 预编译头文件的路径
+ * @param flags 编译选项
+ * @return 编译结果
+ */
+int pch_create(const char* file_name, const char* pch_filename, int flags)
+{
+    struct compile_process* process = compile_process_create(file_name, NULL, flags);
+    if (!process)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+    struct lex_process* lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+    if (!lex_process || lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    struct vector* includes = vector_create(sizeof(struct preprocessor_include_directive));
+    int end = preprocessor_scan_include_prefix(lex_process->token_vec, includes);
+    if (end == 0)
+    {
+        compiler_error(process, "\"%s\" does not start with an #include to precompile", file_name);
+    }
+    if (preprocessor_run_prefix(process, lex_process->token_vec, end) != PREPROCESSOR_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    struct pch_writer writer;
+    writer.strings = hashmap_create();
+    size_t esizes[PCH_SECTION_COUNT] = {
+            [PCH_SECTION_STRINGS] = sizeof(uint32_t),
+            [PCH_SECTION_STRING_DATA] = sizeof(char),
+            [PCH_SECTION_INCLUDES] = sizeof(uint32_t),
+            [PCH_SECTION_DEPENDENCIES] = sizeof(struct pch_dependency),
+            [PCH_SECTION_DEFINITIONS] = sizeof(struct pch_definition),
+            [PCH_SECTION_PARAMS] = sizeof(uint32_t),
+            [PCH_SECTION_TOKENS] = sizeof(struct pch_token),
+            [PCH_SECTION_OUTPUT] = sizeof(struct pch_token),
+            [PCH_SECTION_ONCE] = sizeof(uint32_t),
+            [PCH_SECTION_COMMAND_LINE] = sizeof(uint32_t),
+            [PCH_SECTION_SYMBOLS] = sizeof(char)
+    };
+    for (int i = 0; i < PCH_SECTION_COUNT; i++)
+    {
+        writer.sections[i] = vector_create(esizes[i]);
+    }
+
+    // 被预编译的#include按照输入文件所在的目录解析，使用时要求解析到同样的文件
+    char* dir = strdup(process->cfile.abs_path);
+    char* slash = strrchr(dir, '/');
+    if (slash)
+    {
+        *slash = 0x00;
+    }
+    for (size_t i = 0; i < vector_count(includes); i++)
+    {
+        struct preprocessor_include_directive* include = vector_at(includes, i);
+        char path[PATH_MAX];
+        if (!preprocessor_resolve_include(include->name, include->angle_brackets, dir, path))
+        {
+            compiler_error(process, "Could not find the header \"%s\" to precompile", include->name);
+        }
+        pch_write_string_ref(&writer, PCH_SECTION_INCLUDES, path);
+    }
+    free(dir);
+
+    struct preprocessor* preprocessor = process->preprocessor;
+    struct hashmap* seen = hashmap_create();
+    for (size_t i = 0; i < vector_count(preprocessor->included); i++)
+    {
+        struct preprocessor_header* header = vector_peek_ptr_at(preprocessor->included, i);
+        pch_write_dependency(&writer, seen, header->path);
+    }
+    hashmap_free(seen);
+
+    size_t iter = 0;
+    const char* name;
+    void* value;
+    while (hashmap_next(preprocessor->definitions, &iter, &name, &value))
+    {
+        pch_write_definition(&writer, value);
+    }
+    iter = 0;
+    while (hashmap_next(preprocessor->included_once, &iter, &name, &value))
+    {
+        pch_write_string_ref(&writer, PCH_SECTION_ONCE, name);
+    }
+    for (size_t i = 0; i < segmented_vector_count(process->token_vec); i++)
+    {
+        pch_write_token(&writer, PCH_SECTION_OUTPUT, segmented_vector_at(process->token_vec, i));
+    }
+    struct vector* command_line = preprocessor_command_line_definitions();
+    for (size_t i = 0; command_line && i < vector_count(command_line); i++)
+    {
+        pch_write_string_ref(&writer, PCH_SECTION_COMMAND_LINE, vector_peek_ptr_at(command_line, i));
+    }
+
+    bool ok = pch_write_file(&writer, pch_filename, flags);
+    for (int i = 0; i < PCH_SECTION_COUNT; i++)
+    {
+        vector_free(writer.sections[i]);
+    }
+    hashmap_free(writer.strings);
+    vector_free(includes);
+    if (!ok)
+    {
+        compiler_error(process, "Could not write the precompiled header \"%s\"", pch_filename);
+    }
+    lex_process_free(lex_process);
+    compile_process_free(process);
+    return COMPILER_FILE_COMPILED_OK;
+}
+
+/**
+ * @brief 获取一个段的起始位置，检查段是否在文件范围内
+ * @return 段的起始位置，越界时返回NULL
+ */
+static const void* pch_section(const char* data, size_t size, const struct pch_file_header* header, int section, size_t esize)
+{
+    const struct pch_section* s = &header->sections[section];
+    if (s->offset > size || s->count > (size - s->offset) / esize)
+    {
+        return NULL;
+    }
+    return data + s->offset;
+}
+
+/**
+ * @brief 把字符串编号转换为驻留的字符串
+ */
+static const char* pch_string(const char** strings, uint32_t count, uint32_t id)
+{
+    return id < count ? strings[id] : NULL;
+}
+
+/**
+ * @brief 把字符串编号的数组转换为驻留的字符串数组
+ */
+static const char** pch_string_array(const char** strings, uint32_t count, const uint32_t* ids, size_t n)
+{
+    const char** result = calloc(n ? n : 1, sizeof(const char*));
+    for (size_t i = 0; i < n; i++)
+    {
+        result[i] = pch_string(strings, count, ids[i]);
+    }
+    return result;
+}
+
+/**
+ * @brief 把文件中的token转换为预处理器使用的token
+ */
+static void pch_read_token(struct token* token, const struct pch_token* record, const char** strings, uint32_t count)
+{
+    memset(token, 0, sizeof(struct token));
+    token->type = record->type;
+    token->flag = record->flag;
+    token->pos.line = record->line;
+    token->pos.col = record->col;
+    token->pos.filename = pch_string(strings, count, record->filename);
+    token->between_brackets = pch_string(strings, count, record->between_brackets);
+    token->num.type = record->num_type;
+    token->whitespace = record->whitespace;
+    token->llnum = record->value;
+    if (pch_token_has_string(record->type))
+    {
+        token->sval = pch_string(strings, count, record->value);
+    }
+}
+
+/**
+ * @brief 检查预编译时读取过的头文件是否都没有被修改过
+ */
+static bool pch_dependencies_fresh(const struct pch_dependency* dependencies, size_t n, const char** strings, uint32_t count)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        struct stat st;
+        const char* path = pch_string(strings, count, dependencies[i].path);
+        if (!path || stat(path, &st) != 0 || st.st_mtime != dependencies[i].mtime || st.st_size != dependencies[i].size)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 使用一个预编译头文件，之后编译的翻译单元如果开头的#include和它相同则直接从它保存的状态开始预处理
+ * 文件会被mmap，内容只在这里转换一次，所有字符串都被驻留，之后每个翻译单元只需要复制
+ * @param pch_filename 预编译头文件的路径
+ * @return 预编译头文件是否可用，格式不对或者依赖的头文件被修改过时返回false，此时正常编译
+ */
+bool pch_use(const char* pch_filename)
+{
+    int fd = open(pch_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct pch_file_header))
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const struct pch_file_header* header = (const struct pch_file_header*) data;
+    const uint32_t* offsets = pch_section(data, size, header, PCH_SECTION_STRINGS, sizeof(uint32_t));
+    const char* string_data = pch_section(data, size, header, PCH_SECTION_STRING_DATA, sizeof(char));
+    const uint32_t* includes = pch_section(data, size, header, PCH_SECTION_INCLUDES, sizeof(uint32_t));
+    const struct pch_dependency* dependencies = pch_section(data, size, header, PCH_SECTION_DEPENDENCIES, sizeof(struct pch_dependency));
+    const struct pch_definition* definitions = pch_section(data, size, header, PCH_SECTION_DEFINITIONS, sizeof(struct pch_definition));
+    const uint32_t* params = pch_section(data, size, header, PCH_SECTION_PARAMS, sizeof(uint32_t));
+    const struct pch_token* tokens = pch_section(data, size, header, PCH_SECTION_TOKENS, sizeof(struct pch_token));
+    const struct pch_token* output = pch_section(data, size, header, PCH_SECTION_OUTPUT, sizeof(struct pch_token));
+    const uint32_t* once = pch_section(data, size, header, PCH_SECTION_ONCE, sizeof(uint32_t));
+    const uint32_t* command_line = pch_section(data, size, header, PCH_SECTION_COMMAND_LINE, sizeof(uint32_t));
+    if (memcmp(header->magic, PCH_MAGIC, 4) != 0 || header->version != PCH_VERSION
+        || !offsets || !string_data || !includes || !dependencies || !definitions
+        || !params || !tokens || !output || !once || !command_line)
+    {
+        munmap((void*) data, size);
+        return false;
+    }
+
+    // 驻留所有字符串，之后的宏名、参数名和标识符都可以直接比较指针
+    uint32_t string_count = header->sections[PCH_SECTION_STRINGS].count;
+    size_t data_size = header->sections[PCH_SECTION_STRING_DATA].count;
+    const char** strings = calloc(string_count ? string_count : 1, sizeof(const char*));
+    for (uint32_t i = 0; i < string_count; i++)
+    {
+        if (offsets[i] >= data_size || !memchr(string_data + offsets[i], 0x00, data_size - offsets[i]))
+        {
+            free(strings);
+            munmap((void*) data, size);
+            return false;
+        }
+        strings[i] = intern_string(string_data + offsets[i]);
+    }
+
+    size_t dependency_count = header->sections[PCH_SECTION_DEPENDENCIES].count;
+    if (!pch_dependencies_fresh(dependencies, dependency_count, strings, string_count))
+    {
+        free(strings);
+        munmap((void*) data, size);
+        return false;
+    }
+
+    struct pch_state* state = calloc(1, sizeof(struct pch_state));
+    state->path = strdup(pch_filename);
+    state->flags = header->flags;
+    state->include_count = header->sections[PCH_SECTION_INCLUDES].count;
+    state->includes = pch_string_array(strings, string_count, includes, state->include_count);
+    state->once_count = header->sections[PCH_SECTION_ONCE].count;
+    state->once = pch_string_array(strings, string_count, once, state->once_count);
+    state->command_line_count = header->sections[PCH_SECTION_COMMAND_LINE].count;
+    state->command_line = pch_string_array(strings, string_count, command_line, state->command_line_count);
+    state->dependency_count = dependency_count;
+    state->dependencies = calloc(dependency_count ? dependency_count : 1, sizeof(const char*));
+    for (size_t i = 0; i < dependency_count; i++)
+    {
+        state->dependencies[i] = pch_string(strings, string_count, dependencies[i].path);
+    }
+
+    state->output_count = header->sections[PCH_SECTION_OUTPUT].count;
+    state->output = calloc(state->output_count ? state->output_count : 1, sizeof(struct token));
+    for (int i = 0; i < state->output_count; i++)
+    {
+        pch_read_token(&state->output[i], &output[i], strings, string_count);
+    }
+
+    size_t param_total = header->sections[PCH_SECTION_PARAMS].count;
+    size_t token_total = header->sections[PCH_SECTION_TOKENS].count;
+    state->definition_count = header->sections[PCH_SECTION_DEFINITIONS].count;
+    state->definitions = calloc(state->definition_count ? state->definition_count : 1, sizeof(struct preprocessor_definition));
+    for (int i = 0; i < state->definition_count; i++)
+    {
+        const struct pch_definition* record = &definitions[i];
+        struct preprocessor_definition* definition = &state->definitions[i];
+        if (record->param_start > param_total || record->param_count > param_total - record->param_start
+            || record->token_start > token_total || record->token_count > token_total - record->token_start)
+        {
+            // 文件已经损坏，已经转换的部分随进程一起释放
+            munmap((void*) data, size);
+            free(strings);
+            return false;
+        }
+        definition->name = pch_string(strings, string_count, record->name);
+        definition->function_like = record->function_like;
+        definition->variadic = record->variadic;
+        definition->has_operators = record->has_operators;
+        definition->param_count = record->param_count;
+        definition->params = pch_string_array(strings, string_count, &params[record->param_start], record->param_count);
+        definition->token_count = record->token_count;
+        definition->tokens = calloc(record->token_count ? record->token_count : 1, sizeof(struct token));
+        for (uint32_t j = 0; j < record->token_count; j++)
+        {
+            pch_read_token(&definition->tokens[j], &tokens[record->token_start + j], strings, string_count);
+        }
+    }
+
+    free(strings);
+    munmap((void*) data, size);
+    pch_state = state;
+    return true;
+}
+
+/**
+ * @brief 检查翻译单元的编译环境是否和生成预编译头文件时相同
+ */
+static bool pch_command_line_matches(struct pch_state* state)
+{
+    struct vector* command_line = preprocessor_command_line_definitions();
+    int count = command_line ? vector_count(command_line) : 0;
+    if (count != state->command_line_count)
+    {
+        return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (!S_EQ((const char*) vector_peek_ptr_at(command_line, i), state->command_line[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 如果翻译单元开头的#include和正在使用的预编译头文件相同，则恢复预编译头文件保存的预处理状态
+ * @param compiler 编译过程，预处理器已经创建
+ * @param tokens 翻译单元的原始token向量
+ * @param dir 翻译单元所在的目录
+ * @return 恢复之后需要继续预处理的第一个token的位置，不能使用预编译头文件时返回0
+ */
+int pch_restore(struct compile_process* compiler, struct vector* tokens, const char* dir)
+{
+    struct pch_state* state = pch_state;
+    if (!state || state->flags != compiler->flags || !pch_command_line_matches(state))
+    {
+        return 0;
+    }
+
+    struct vector* includes = vector_create(sizeof(struct preprocessor_include_directive));
+    preprocessor_scan_include_prefix(tokens, includes);
+    int start = 0;
+    if (state->include_count > 0 && vector_count(includes) >= (size_t) state->include_count)
+    {
+        start = ((struct preprocessor_include_directive*) vector_at(includes, state->include_count - 1))->end;
+        for (int i = 0; i < state->include_count; i++)
+        {
+            struct preprocessor_include_directive* include = vector_at(includes, i);
+            char path[PATH_MAX];
+            if (!preprocessor_resolve_include(include->name, include->angle_brackets, dir, path)
+                || !S_EQ(path, state->includes[i]))
+            {
+                start = 0;
+                break;
+            }
+        }
+    }
+    if (start == 0)
+    {
+        vector_free(includes);
+        return 0;
+    }
+
+    struct preprocessor* preprocessor = compiler->preprocessor;
+    segmented_vector_push_multiple(compiler->token_vec, state->output, state->output_count);
+    for (int i = 0; i < state->definition_count; i++)
+    {
+        struct preprocessor_definition* definition = arena_memdup(preprocessor->arena, &state->definitions[i], sizeof(struct preprocessor_definition));
+        hashmap_set(preprocessor->definitions, definition->name, definition);
+    }
+    preprocessor->generation++;
+
+    // 只需要路径，#pragma once和之后的依赖输出都只用到了头文件的路径
+    for (int i = 0; i < state->once_count; i++)
+    {
+        struct preprocessor_header* header = arena_alloc(preprocessor->arena, sizeof(struct preprocessor_header));
+        header->path = state->once[i];
+        header->pragma_once = true;
+        hashmap_set(preprocessor->included_once, header->path, header);
+    }
+    for (int i = 0; i < state->dependency_count; i++)
+    {
+        struct preprocessor_header* header = arena_alloc(preprocessor->arena, sizeof(struct preprocessor_header));
+        header->path = state->dependencies[i];
+        vector_push(preprocessor->included, &header);
+    }
+    // 预编译的#include本身的查找结果，头文件内部的#include在创建预编译头文件时已经确定
+    for (int i = 0; i < state->include_count; i++)
+    {
+        struct preprocessor_include_directive* include = vector_at(includes, i);
+        preprocessor_record_include_lookup(preprocessor, include->name, include->angle_brackets, dir, state->includes[i]);
+    }
+    vector_free(includes);
+    return start;
+}
@@ -0,0 +1,157 @@
+//
+// Description: 输入文件预读。命令行驱动依次编译多个输入文件时，一个后台线程提前读取之后的几个输入文件，
+// 让它们的内容进入页缓存，轮到它们被词法分析时读取不再阻塞在磁盘或网络文件系统上
+// Created by kery on 2024/3/27.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// 读取文件内容时每次读取的字节数，读到的数据直接丢弃，只为了让内核把文件读入页缓存
+#define COMPILE_PREFETCH_CHUNK 65536
+
+/**
+ * 预读线程的状态，lock保护之后的所有字段
+ * paths: 需要预读的文件，按编译的顺序排列，标准输入为NULL
+ * count: 文件的数量
+ * next: 下一个要预读的文件的位置
+ * current: 驱动正在编译的文件的位置，预读最多领先它window个文件
+ * window: 预读的文件数量
+ * stop: 驱动已经编译完所有文件，线程应该退出
+ */
+struct compile_prefetch
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const char** paths;
+    size_t count;
+    size_t next;
+    size_t current;
+    size_t window;
+    bool stop;
+};
+
+/**
+ * @brief 把一个文件读入页缓存
+ * 先请求内核异步预读整个文件，然后顺序读一遍，网络文件系统上异步预读的请求可能被忽略
+ * @param path 文件路径，文件不存在时什么也不做，错误留给之后的编译报告
+ */
+static void compile_prefetch_file(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    char chunk[COMPILE_PREFETCH_CHUNK];
+    while (read(fd, chunk, sizeof(chunk)) > 0)
+    {
+    }
+    close(fd);
+}
+
+/**
+ * @brief 预读线程，依次预读窗口内的文件，窗口满了之后等待驱动前进
+ * 线程中只使用标准库的内存分配，内存统计和缓存都不是线程安全的
+ */
+static void* compile_prefetch_thread(void* arg)
+{
+    struct compile_prefetch* prefetch = arg;
+    pthread_mutex_lock(&prefetch->lock);
+    while (!prefetch->stop && prefetch->next < prefetch->count)
+    {
+        if (prefetch->next >= prefetch->current + prefetch->window)
+        {
+            pthread_cond_wait(&prefetch->cond, &prefetch->lock);
+            continue;
+        }
+        // 已经开始编译的文件不需要预读
+        if (prefetch->next <= prefetch->current)
+        {
+            prefetch->next = prefetch->current + 1;
+            continue;
+        }
+        const char* path = prefetch->paths[prefetch->next++];
+        pthread_mutex_unlock(&prefetch->lock);
+        if (path)
+        {
+            compile_prefetch_file(path);
+        }
+        pthread_mutex_lock(&prefetch->lock);
+    }
+    pthread_mutex_unlock(&prefetch->lock);
+    return NULL;
+}
+
+/**
+ * @brief 开始预读输入文件，驱动从第一个文件开始编译
+ * @param inputs 命令行驱动的输入文件，元素为struct compile_driver_input，预读结束之前不能修改
+ * @param window 最多提前预读的文件数量
+ * @return 预读状态，无法创建线程时返回NULL，编译照常进行
+ */
+struct compile_prefetch* compile_prefetch_start(struct vector* inputs, size_t window)
+{
+    struct compile_prefetch* prefetch = calloc(1, sizeof(struct compile_prefetch));
+    prefetch->count = vector_count(inputs);
+    prefetch->paths = calloc(prefetch->count, sizeof(const char*));
+    for (size_t i = 0; i < prefetch->count; i++)
+    {
+        struct compile_driver_input* input = vector_at(inputs, i);
+        prefetch->paths[i] = S_EQ(input->input, COMPILE_PROCESS_STDIO_NAME) ? NULL : input->input;
+    }
+    prefetch->window = window;
+    pthread_mutex_init(&prefetch->lock, NULL);
+    pthread_cond_init(&prefetch->cond, NULL);
+    if (pthread_create(&prefetch->thread, NULL, compile_prefetch_thread, prefetch) != 0)
+    {
+        pthread_cond_destroy(&prefetch->cond);
+        pthread_mutex_destroy(&prefetch->lock);
+        free(prefetch->paths);
+        free(prefetch);
+        return NULL;
+    }
+    return prefetch;
+}
+
+/**
+ * @brief 通知预读线程驱动开始编译第index个文件，预读窗口随之前进
+ * @param prefetch 预读状态，NULL时什么也不做
+ * @param index 正在编译的文件的位置
+ */
+void compile_prefetch_advance(struct compile_prefetch* prefetch, size_t index)
+{
+    if (!prefetch)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->current = index;
+    pthread_cond_signal(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->lock);
+}
+
+/**
+ * @brief 停止预读，等待线程退出并释放预读状态
+ * @param prefetch 预读状态，NULL时什么也不做
+ */
+void compile_prefetch_stop(struct compile_prefetch* prefetch)
+{
+    if (!prefetch)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->stop = true;
+    pthread_cond_signal(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->lock);
+    pthread_join(prefetch->thread, NULL);
+    pthread_cond_destroy(&prefetch->cond);
+    pthread_mutex_destroy(&prefetch->lock);
+    free(prefetch->paths);
+    free(prefetch);
+}
@@ -0,0 +1,2450 @@
+//
+// Description: 预处理器，处理#include、#define和条件编译指令
+// Created by kery on 2024/3/9.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/buffer.h"
+#include "helpers/arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// #include的最大嵌套深度，超过则认为头文件在递归包含自己
+#define PREPROCESSOR_MAX_INCLUDE_DEPTH 200
+
+// 进程内所有翻译单元共享的头文件缓存，绝对路径->struct preprocessor_header*
+static struct hashmap* header_cache = NULL;
+// #include查找结果的缓存，查找的目录和名字->struct preprocessor_header*，命中时不再访问文件系统
+static struct hashmap* include_lookup_cache = NULL;
+// 头文件查找目录，元素为const char*
+static struct vector* include_dirs = NULL;
+// 命令行中-D定义的宏，元素为"宏名 值"形式的const char*
+static struct vector* command_line_definitions = NULL;
+// 命令行宏定义词法分析的结果，元素为struct vector*，第一次使用时才进行词法分析
+static struct vector* command_line_tokens = NULL;
+
+static void preprocessor_handle_tokens(struct preprocessor* preprocessor, struct vector* tokens, int start, int end, const char* dir);
+static void preprocessor_definition_free(struct preprocessor_definition* definition);
+
+/**
+ * @brief 在token所在的位置报告一个预处理错误
+ */
+#define PREPROCESSOR_ERROR(preprocessor, token, ...)               \
+    do                                                             \
+    {                                                              \
+        (preprocessor)->compiler->pos = (token)->pos;              \
+        compiler_error((preprocessor)->compiler, __VA_ARGS__);     \
+    } while (0)
+
+/**
+ * @brief 添加一个头文件查找目录，对之后编译的所有翻译单元生效
+ * @param dir 目录
+ */
+void preprocessor_add_include_dir(const char* dir)
+{
+    if (!include_dirs)
+    {
+        include_dirs = vector_create(sizeof(const char*));
+    }
+    const char* copy = strdup(dir);
+    vector_push(include_dirs, &copy);
+}
+
+/**
+ * @brief 添加一个命令行宏定义，对之后编译的所有翻译单元生效
+ * @param definition "NAME"或者"NAME=VALUE"形式的宏定义，没有值的宏定义为1
+ */
+void preprocessor_add_definition(const char* definition)
+{
+    if (!command_line_definitions)
+    {
+        command_line_definitions = vector_create(sizeof(const char*));
+        command_line_tokens = vector_create(sizeof(struct vector*));
+    }
+
+    // 转换为"NAME VALUE"，这样可以和#define之后的内容一样进行词法分析
+    size_t len = strlen(definition);
+    char* source = malloc(len + 3);
+    strcpy(source, definition);
+    char* equals = strchr(source, '=');
+    if (equals)
+    {
+        *equals = ' ';
+    }
+    else
+    {
+        strcat(source, " 1");
+    }
+    vector_push(command_line_definitions, &source);
+}
+
+/**
+ * @brief 替换全部头文件查找目录，和当前的目录完全相同时保留#include查找结果的缓存
+ * @param dirs 新的查找目录，元素为const char*
+ */
+void preprocessor_set_include_dirs(struct vector* dirs)
+{
+    size_t count = include_dirs ? vector_count(include_dirs) : 0;
+    bool same = count == vector_count(dirs);
+    for (size_t i = 0; same && i < count; i++)
+    {
+        same = S_EQ((const char*) vector_peek_ptr_at(include_dirs, i), (const char*) vector_peek_ptr_at(dirs, i));
+    }
+    if (same)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(vector_peek_ptr_at(include_dirs, i));
+    }
+    if (include_dirs)
+    {
+        vector_clear(include_dirs);
+    }
+    for (size_t i = 0; i < vector_count(dirs); i++)
+    {
+        preprocessor_add_include_dir(vector_peek_ptr_at(dirs, i));
+    }
+    // 查找结果依赖于查找目录
+    if (include_lookup_cache)
+    {
+        hashmap_free(include_lookup_cache);
+        include_lookup_cache = hashmap_create();
+    }
+}
+
+/**
+ * @brief 清空命令行宏定义和它们的词法分析结果
+ */
+void preprocessor_clear_definitions()
+{
+    if (!command_line_definitions)
+    {
+        return;
+    }
+    for (size_t i = 0; i < vector_count(command_line_definitions); i++)
+    {
+        free(vector_peek_ptr_at(command_line_definitions, i));
+    }
+    for (size_t i = 0; i < vector_count(command_line_tokens); i++)
+    {
+        vector_free(vector_peek_ptr_at(command_line_tokens, i));
+    }
+    vector_clear(command_line_definitions);
+    vector_clear(command_line_tokens);
+}
+
+/**
+ * @brief 丢弃缓存中在磁盘上已经被修改过的头文件，下次被包含时重新词法分析
+ * 常驻的编译服务在每个请求开始时调用一次，每个头文件只需要一次stat
+ */
+void preprocessor_revalidate_headers()
+{
+    if (!header_cache)
+    {
+        return;
+    }
+
+    bool dropped = false;
+    size_t iter = 0;
+    const char* path;
+    void* value;
+    while (hashmap_next(header_cache, &iter, &path, &value))
+    {
+        struct preprocessor_header* header = value;
+        struct stat st;
+        if (stat(path, &st) == 0 && st.st_mtime == header->mtime && st.st_size == header->size)
+        {
+            continue;
+        }
+        // 被删除的键仍然保存在桶中，迭代可以继续
+        hashmap_remove(header_cache, path);
+        vector_free(header->tokens);
+        free((char*) header->path);
+        free((char*) header->dir);
+        free(header);
+        dropped = true;
+    }
+
+    // 查找结果缓存可能指向被丢弃的头文件
+    if (dropped)
+    {
+        hashmap_free(include_lookup_cache);
+        include_lookup_cache = hashmap_create();
+    }
+}
+
+/**
+ * @brief 创建一个预处理器
+ * @param compiler 预处理器所属的编译过程
+ * @return 预处理器
+ */
+struct preprocessor* preprocessor_create(struct compile_process* compiler)
+{
+    struct preprocessor* preprocessor = calloc(1, sizeof(struct preprocessor));
+    preprocessor->compiler = compiler;
+    preprocessor->definitions = hashmap_create();
+    preprocessor->included_once = hashmap_create();
+    preprocessor->conditions = vector_create(sizeof(struct preprocessor_condition));
+    preprocessor->arena = arena_create();
+    preprocessor->vector_pool = vector_create(sizeof(struct vector*));
+    preprocessor->included = vector_create(sizeof(struct preprocessor_header*));
+    preprocessor->include_lookups = vector_create(sizeof(struct preprocessor_include_lookup));
+    return preprocessor;
+}
+
+/**
+ * @brief 释放预处理器，宏定义、隐藏集合和包含记录都属于它的内存池，一起被释放
+ * 缓存的头文件在编译之间共享，不会被释放
+ * @param preprocessor 预处理器
+ */
+void preprocessor_free(struct preprocessor* preprocessor)
+{
+    size_t iter = 0;
+    const char* name;
+    void* value;
+    while (hashmap_next(preprocessor->definitions, &iter, &name, &value))
+    {
+        preprocessor_definition_free(value);
+    }
+    hashmap_free(preprocessor->definitions);
+    hashmap_free(preprocessor->included_once);
+    vector_free(preprocessor->conditions);
+    for (size_t i = 0; i < vector_count(preprocessor->vector_pool); i++)
+    {
+        vector_free(vector_peek_ptr_at(preprocessor->vector_pool, i));
+    }
+    vector_free(preprocessor->vector_pool);
+    vector_free(preprocessor->included);
+    vector_free(preprocessor->include_lookups);
+    free(preprocessor->hidesets.nodes);
+    arena_free(preprocessor->arena);
+    free(preprocessor);
+}
+
+/**
+ * @brief 获取一个宏定义
+ * @param preprocessor 预处理器
+ * @param name 宏名
+ * @return 宏定义，如果没有定义则返回NULL
+ */
+struct preprocessor_definition* preprocessor_get_definition(struct preprocessor* preprocessor, const char* name)
+{
+    return hashmap_get(preprocessor->definitions, name);
+}
+
+/**
+ * @brief 获取一个路径所在的目录
+ * @param path 路径
+ * @return 新分配的目录字符串
+ */
+char* preprocessor_dirname(const char* path)
+{
+    char* dir = strdup(path);
+    char* slash = strrchr(dir, '/');
+    if (!slash)
+    {
+        free(dir);
+        return strdup(".");
+    }
+    if (slash == dir)
+    {
+        slash++;
+    }
+    *slash = 0x00;
+    return dir;
+}
+
+/**
+ * @brief 获取一个标识符或关键字token的名字，预处理指令名和宏名既可能是标识符也可能是关键字
+ * @param token
+ * @return 名字，如果不是标识符或关键字则返回NULL
+ */
+static const char* preprocessor_token_name(struct token* token)
+{
+    if (!token || (token->type != TOKEN_TYPE_IDENTIFIER && token->type != TOKEN_TYPE_KEYWORD))
+    {
+        return NULL;
+    }
+    return token->sval;
+}
+
+/**
+ * @brief 读取一条预处理指令所在的整行，行尾的'\\'会把下一行连接进来，注释被忽略
+ * @param tokens token向量
+ * @param index 指令开头的'#'所在的位置
+ * @param line 用来存放这一行token指针的向量，不包括'#'
+ * @return 这一行之后第一个token的位置
+ */
+static int preprocessor_read_directive_line(struct vector* tokens, int index, struct vector* line)
+{
+    int count = vector_count(tokens);
+    vector_clear(line);
+    int i = index + 1;
+    for (; i < count; i++)
+    {
+        struct token* token = token_vector_at(tokens, i);
+        if (token_is_line_start(token))
+        {
+            break;
+        }
+        if (token_is_newline(token))
+        {
+            i++;
+            break;
+        }
+        if (token_is_comment(token))
+        {
+            continue;
+        }
+        if (token_is_symbol(token, '\\') && i + 1 < count && token_is_newline(token_vector_at(tokens, i + 1)))
+        {
+            i++;
+            continue;
+        }
+        token_ptr_vector_push(line, &token);
+    }
+    return i;
+}
+
+/**
+ * @brief 获取指令行中的第index个token
+ * @return token，如果超出了行尾则返回NULL
+ */
+static struct token* preprocessor_line_token(struct vector* line, size_t index)
+{
+    if (index >= vector_count(line))
+    {
+        return NULL;
+    }
+    return vector_peek_ptr_at(line, index);
+}
+
+/**
+ * @brief 解析"!defined X"和"!defined(X)"形式的#if条件，这是include guard的另一种写法
+ * @param line 指令行，第一个token是if
+ * @return 宏名，如果不是这种形式则返回NULL
+ */
+static const char* preprocessor_parse_not_defined(struct vector* line)
+{
+    struct token* not = preprocessor_line_token(line, 1);
+    struct token* defined = preprocessor_line_token(line, 2);
+    if (!not || !defined || !token_is_operator(not, "!") || !token_is_identifier(defined, "defined"))
+    {
+        return NULL;
+    }
+
+    struct token* name = preprocessor_line_token(line, 3);
+    if (name && token_is_operator(name, "("))
+    {
+        struct token* close = preprocessor_line_token(line, 5);
+        if (!close || !token_is_symbol(close, ')') || vector_count(line) != 6)
+        {
+            return NULL;
+        }
+        return preprocessor_token_name(preprocessor_line_token(line, 4));
+    }
+    if (vector_count(line) != 4)
+    {
+        return NULL;
+    }
+    return preprocessor_token_name(name);
+}
+
+/**
+ * @brief 判断指令是否会开启一个条件编译块
+ */
+static bool preprocessor_is_condition_open(const char* directive)
+{
+    return S_EQ(directive, "if") || S_EQ(directive, "ifdef") || S_EQ(directive, "ifndef");
+}
+
+/**
+ * @brief 扫描一个刚被词法分析的头文件，检测#pragma once和include guard
+ * 只有整个文件的有效内容都被一个#ifndef X ... #endif包围，且这个块没有#else/#elif时才认为X是include guard，
+ * 这样当X已经被定义时，再次包含这个头文件不会产生任何token，可以直接跳过而无需重新打开文件
+ * @param header 头文件
+ */
+static void preprocessor_scan_header(struct preprocessor_header* header)
+{
+    struct vector* tokens = header->tokens;
+    struct vector* line = vector_create(sizeof(struct token*));
+    int count = vector_count(tokens);
+    int depth = 0;
+    int top_level_groups = 0;
+    bool outside_content = false;
+    bool top_level_else = false;
+    const char* candidate = NULL;
+    bool at_line_start = true;
+
+    int i = 0;
+    while (i < count)
+    {
+        struct token* token = token_vector_at(tokens, i);
+        if (token_is_line_start(token))
+        {
+            at_line_start = true;
+        }
+        if (at_line_start && token_is_symbol(token, '#'))
+        {
+            i = preprocessor_read_directive_line(tokens, i, line);
+            const char* directive = preprocessor_token_name(preprocessor_line_token(line, 0));
+            struct token* argument = preprocessor_line_token(line, 1);
+            if (S_EQ(directive, "pragma") && argument && token_is_identifier(argument, "once"))
+            {
+                header->pragma_once = true;
+            }
+            else if (preprocessor_is_condition_open(directive))
+            {
+                if (depth == 0)
+                {
+                    if (top_level_groups == 0 && !outside_content)
+                    {
+                        if (S_EQ(directive, "ifndef") && vector_count(line) == 2)
+                        {
+                            candidate = preprocessor_token_name(preprocessor_line_token(line, 1));
+                        }
+                        else if (S_EQ(directive, "if"))
+                        {
+                            candidate = preprocessor_parse_not_defined(line);
+                        }
+                    }
+                    top_level_groups++;
+                }
+                depth++;
+            }
+            else if (S_EQ(directive, "else") || S_EQ(directive, "elif"))
+            {
+                if (depth == 1)
+                {
+                    top_level_else = true;
+                }
+            }
+            else if (S_EQ(directive, "endif"))
+            {
+                depth--;
+            }
+            else if (depth == 0 && directive)
+            {
+                outside_content = true;
+            }
+            continue;
+        }
+
+        if (token_is_newline(token))
+        {
+            at_line_start = true;
+        }
+        else if (!token_is_comment(token))
+        {
+            at_line_start = false;
+            if (depth == 0)
+            {
+                outside_content = true;
+            }
+        }
+        i++;
+    }
+
+    if (candidate && top_level_groups == 1 && !outside_content && !top_level_else)
+    {
+        header->guard = candidate;
+    }
+    vector_free(line);
+}
+
+/**
+ * @brief 词法分析一个头文件并加入缓存
+ * @param preprocessor 预处理器
+ * @param path 头文件的绝对路径
+ * @return 头文件，如果无法打开则返回NULL
+ */
+static struct preprocessor_header* preprocessor_load_header(struct preprocessor* preprocessor, const char* path)
+{
+    struct compile_process* process = compile_process_create(path, NULL, preprocessor->compiler->flags);
+    if (!process)
+    {
+        return NULL;
+    }
+    struct lex_process* lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+    if (!lex_process || lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
+        return NULL;
+    }
+    struct stat st;
+    bool has_stat = fstat(fileno(process->cfile.fp), &st) == 0;
+
+    // 头文件的token和路径被缓存，从词法分析过程和编译过程中取走之后再释放它们
+    struct preprocessor_header* header = calloc(1, sizeof(struct preprocessor_header));
+    header->path = process->cfile.abs_path;
+    header->dir = preprocessor_dirname(header->path);
+    header->tokens = lex_process->token_vec;
+    process->cfile.abs_path = NULL;
+    lex_process->token_vec = NULL;
+    lex_process_free(lex_process);
+    compile_process_free(process);
+    header->mtime = has_stat ? st.st_mtime : -1;
+    header->size = has_stat ? st.st_size : -1;
+    preprocessor_scan_header(header);
+    hashmap_set(header_cache, header->path, header);
+    return header;
+}
+
+/**
+ * @brief 检查一个候选路径是否是可读的文件
+ * @param candidate 候选路径
+ * @param path 文件存在时保存它的绝对路径，长度至少为PATH_MAX
+ * @return 文件是否存在
+ */
+static bool preprocessor_resolve_candidate(const char* candidate, char* path)
+{
+    return access(candidate, R_OK) == 0 && realpath(candidate, path);
+}
+
+/**
+ * @brief 按照#include的查找规则找到头文件的绝对路径，不会打开文件
+ * "xxx"形式先在包含者所在的目录查找，然后和<xxx>形式一样依次在头文件查找目录中查找
+ * @param name #include中的名字
+ * @param angle_brackets 是否是<xxx>形式
+ * @param dir 包含者所在的目录
+ * @param path 找到时保存头文件的绝对路径，长度至少为PATH_MAX
+ * @return 是否找到了头文件
+ */
+bool preprocessor_resolve_include(const char* name, bool angle_brackets, const char* dir, char* path)
+{
+    if (name[0] == '/')
+    {
+        return preprocessor_resolve_candidate(name, path);
+    }
+
+    char candidate[PATH_MAX];
+    if (!angle_brackets)
+    {
+        snprintf(candidate, sizeof(candidate), "%s/%s", dir, name);
+        if (preprocessor_resolve_candidate(candidate, path))
+        {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; include_dirs && i < vector_count(include_dirs); i++)
+    {
+        const char* include_dir = vector_peek_ptr_at(include_dirs, i);
+        snprintf(candidate, sizeof(candidate), "%s/%s", include_dir, name);
+        if (preprocessor_resolve_candidate(candidate, path))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 记录一条#include的查找结果，字符串都被驻留，在编译过程结束之后仍然有效
+ * @param preprocessor 预处理器
+ * @param name #include中的名字
+ * @param angle_brackets 是否是<xxx>形式
+ * @param dir 包含者所在的目录
+ * @param path 找到的头文件的绝对路径，找不到时为NULL
+ */
+void preprocessor_record_include_lookup(struct preprocessor* preprocessor, const char* name, bool angle_brackets, const char* dir, const char* path)
+{
+    struct preprocessor_include_lookup lookup = {
+            .name = intern_string(name),
+            .angle_brackets = angle_brackets,
+            .dir = intern_string(dir),
+            .path = path ? intern_string(path) : NULL
+    };
+    vector_push(preprocessor->include_lookups, &lookup);
+}
+
+/**
+ * @brief 查找一个被#include的头文件，已经缓存过的头文件直接返回，否则进行词法分析并加入缓存
+ * @param preprocessor 预处理器
+ * @param name #include中的名字
+ * @param angle_brackets 是否是<xxx>形式
+ * @param dir 包含者所在的目录
+ * @return 头文件，如果找不到则返回NULL
+ */
+static struct preprocessor_header* preprocessor_find_header(struct preprocessor* preprocessor, const char* name, bool angle_brackets, const char* dir)
+{
+    if (!header_cache)
+    {
+        header_cache = hashmap_create();
+        include_lookup_cache = hashmap_create();
+    }
+
+    char key[PATH_MAX * 2];
+    snprintf(key, sizeof(key), "%s|%s", angle_brackets ? "<>" : dir, name);
+    struct preprocessor_header* header = hashmap_get(include_lookup_cache, key);
+    if (header)
+    {
+        return header;
+    }
+
+    char path[PATH_MAX];
+    if (!preprocessor_resolve_include(name, angle_brackets, dir, path))
+    {
+        return NULL;
+    }
+    header = hashmap_get(header_cache, path);
+    if (!header)
+    {
+        header = preprocessor_load_header(preprocessor, path);
+    }
+
+    if (header)
+    {
+        hashmap_set(include_lookup_cache, key, header);
+    }
+    return header;
+}
+
+/**
+ * @brief 处理#include指令
+ * @param preprocessor 预处理器
+ * @param line 指令行
+ * @param dir 包含者所在的目录
+ */
+static void preprocessor_handle_include(struct preprocessor* preprocessor, struct vector* line, const char* dir)
+{
+    struct token* directive = preprocessor_line_token(line, 0);
+    struct token* target = preprocessor_line_token(line, 1);
+    if (!target || target->type != TOKEN_TYPE_STRING)
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+
+    bool angle_brackets = target->flag & TOKEN_FLAG_ANGLE_BRACKETS;
+    struct preprocessor_header* header = preprocessor_find_header(preprocessor, target->sval, angle_brackets, dir);
+    preprocessor_record_include_lookup(preprocessor, target->sval, angle_brackets, dir, header ? header->path : NULL);
+    if (!header)
+    {
+        if (angle_brackets)
+        {
+            // 没有提供系统头文件时，找不到的<xxx>只给出警告
+            preprocessor->compiler->pos = target->pos;
+            compiler_warning(preprocessor->compiler, "Could not find the system header <%s>, skipping it", target->sval);
+            return;
+        }
+        PREPROCESSOR_ERROR(preprocessor, target, "Could not find the header \"%s\"", target->sval);
+    }
+
+    // 以下两种情况再次包含不会产生任何token，不需要重新处理头文件
+    if (header->pragma_once && hashmap_get(preprocessor->included_once, header->path))
+    {
+        return;
+    }
+    if (header->guard && preprocessor_get_definition(preprocessor, header->guard))
+    {
+        return;
+    }
+
+    if (preprocessor->include_depth >= PREPROCESSOR_MAX_INCLUDE_DEPTH)
+    {
+        PREPROCESSOR_ERROR(preprocessor, target, "#include nested too deeply");
+    }
+    if (header->pragma_once)
+    {
+        hashmap_set(preprocessor->included_once, header->path, header);
+    }
+
+    preprocessor->include_depth++;
+    vector_push(preprocessor->included, &header);
+    preprocessor_handle_tokens(preprocessor, header->tokens, 0, vector_count(header->tokens), header->dir);
+    preprocessor->include_depth--;
+}
+
+/**
+ * @brief 判断隐藏集合中是否有某个宏名
+ */
+static bool preprocessor_hideset_contains(struct preprocessor_hideset* set, const char* name)
+{
+    for (; set; set = set->next)
+    {
+        if (set->name == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t preprocessor_hideset_hash(struct preprocessor_hideset* set, const char* name)
+{
+    uint64_t hash = ((uintptr_t)set >> 4) ^ ((uintptr_t)name * 0x9E3779B97F4A7C15ULL);
+    return (size_t)(hash ^ (hash >> 29));
+}
+
+/**
+ * @brief 把一个节点放入隐藏集合驻留表，调用者保证表中还有空位
+ */
+static void preprocessor_hideset_table_insert(struct preprocessor_hideset_table* table, struct preprocessor_hideset* node)
+{
+    size_t mask = table->capacity - 1;
+    size_t index = preprocessor_hideset_hash(node->next, node->name) & mask;
+    while (table->nodes[index])
+    {
+        index = (index + 1) & mask;
+    }
+    table->nodes[index] = node;
+    table->count++;
+}
+
+/**
+ * @brief 向隐藏集合中加入一个宏名，得到一个新的集合，原来的集合不会被修改
+ * 相同的(集合, 宏名)总是得到同一个节点，所以同一次展开得到的所有token共享同一个集合
+ * @param preprocessor 预处理器
+ * @param set 原来的集合
+ * @param name 驻留的宏名
+ * @return 新的集合
+ */
+static struct preprocessor_hideset* preprocessor_hideset_add(struct preprocessor* preprocessor, struct preprocessor_hideset* set, const char* name)
+{
+    if (preprocessor_hideset_contains(set, name))
+    {
+        return set;
+    }
+
+    struct preprocessor_hideset_table* table = &preprocessor->hidesets;
+    if ((table->count + 1) * 2 > table->capacity)
+    {
+        struct preprocessor_hideset** old_nodes = table->nodes;
+        size_t old_capacity = table->capacity;
+        table->capacity = old_capacity ? old_capacity * 2 : 64;
+        table->nodes = calloc(table->capacity, sizeof(struct preprocessor_hideset*));
+        table->count = 0;
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (old_nodes[i])
+            {
+                preprocessor_hideset_table_insert(table, old_nodes[i]);
+            }
+        }
+        free(old_nodes);
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t index = preprocessor_hideset_hash(set, name) & mask;
+    while (table->nodes[index])
+    {
+        struct preprocessor_hideset* node = table->nodes[index];
+        if (node->next == set && node->name == name)
+        {
+            return node;
+        }
+        index = (index + 1) & mask;
+    }
+
+    struct preprocessor_hideset* node = arena_alloc(preprocessor->arena, sizeof(struct preprocessor_hideset));
+    node->name = name;
+    node->next = set;
+    table->nodes[index] = node;
+    table->count++;
+    return node;
+}
+
+/**
+ * @brief 两个隐藏集合的并集
+ */
+static struct preprocessor_hideset* preprocessor_hideset_union(struct preprocessor* preprocessor, struct preprocessor_hideset* a, struct preprocessor_hideset* b)
+{
+    if (!a || a == b)
+    {
+        return b;
+    }
+    for (; a; a = a->next)
+    {
+        b = preprocessor_hideset_add(preprocessor, b, a->name);
+    }
+    return b;
+}
+
+/**
+ * @brief 两个隐藏集合的交集
+ */
+static struct preprocessor_hideset* preprocessor_hideset_intersect(struct preprocessor* preprocessor, struct preprocessor_hideset* a, struct preprocessor_hideset* b)
+{
+    if (a == b)
+    {
+        return a;
+    }
+    struct preprocessor_hideset* set = NULL;
+    for (; a; a = a->next)
+    {
+        if (preprocessor_hideset_contains(b, a->name))
+        {
+            set = preprocessor_hideset_add(preprocessor, set, a->name);
+        }
+    }
+    return set;
+}
+
+/**
+ * @brief 从向量池中取出一个空的向量，宏展开过程中的临时向量都来自向量池，用完之后归还
+ * @param preprocessor 预处理器
+ * @param esize 向量元素的大小
+ * @return 空的向量
+ */
+static struct vector* preprocessor_vector_take(struct preprocessor* preprocessor, size_t esize)
+{
+    struct vector* pool = preprocessor->vector_pool;
+    for (int i = vector_count(pool) - 1; i >= 0; i--)
+    {
+        struct vector* vector = vector_peek_ptr_at(pool, i);
+        if (vector_element_size(vector) == esize)
+        {
+            struct vector** last = vector_back(pool);
+            *(struct vector**) vector_at(pool, i) = *last;
+            vector_pop(pool);
+            return vector;
+        }
+    }
+    return vector_create(esize);
+}
+
+/**
+ * @brief 将向量清空后归还到向量池
+ */
+static void preprocessor_vector_give(struct preprocessor* preprocessor, struct vector* vector)
+{
+    vector_clear(vector);
+    vector_push(preprocessor->vector_pool, &vector);
+}
+
+/**
+ * 宏展开的一段输入
+ * tokens: 这段输入的token数组
+ * count: token的数量
+ * index: 下一个被读取的token
+ * hideset: 从这段输入中读取的token都要加入这个隐藏集合
+ * owner: tokens所在的向量，读完之后归还到向量池，为NULL时tokens属于别处(例如宏定义本身)
+ */
+struct preprocessor_span
+{
+    struct token* tokens;
+    int count;
+    int index;
+    struct preprocessor_hideset* hideset;
+    struct vector* owner;
+};
+
+/**
+ * 宏展开的输入，宏展开的结果会被压在输入的最前面重新扫描
+ * spans: 输入段的栈，栈底是文件或者宏参数本身
+ * at_line_start: 栈底的输入是否处于行首，用于识别预处理指令
+ * isolated: 是否是单独展开一段token(宏参数或者缓存的展开结果)，而不是展开整个文件
+ * incomplete: 单独展开时，展开结果是否依赖于这段token之后的内容
+ */
+struct preprocessor_reader
+{
+    struct vector* spans;
+    bool at_line_start;
+    bool isolated;
+    bool incomplete;
+};
+
+static void preprocessor_reader_init(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct token* tokens, int count, struct preprocessor_hideset* hideset, bool isolated)
+{
+    reader->spans = preprocessor_vector_take(preprocessor, sizeof(struct preprocessor_span));
+    reader->at_line_start = true;
+    reader->isolated = isolated;
+    reader->incomplete = false;
+    struct preprocessor_span base = {
+            .tokens = tokens,
+            .count = count,
+            .index = 0,
+            .hideset = hideset,
+            .owner = NULL
+    };
+    vector_push(reader->spans, &base);
+}
+
+static void preprocessor_reader_free(struct preprocessor* preprocessor, struct preprocessor_reader* reader)
+{
+    for (size_t i = 0; i < vector_count(reader->spans); i++)
+    {
+        struct preprocessor_span* span = vector_at(reader->spans, i);
+        if (span->owner)
+        {
+            preprocessor_vector_give(preprocessor, span->owner);
+        }
+    }
+    preprocessor_vector_give(preprocessor, reader->spans);
+}
+
+/**
+ * @brief 将一段宏展开的结果压到输入的最前面
+ */
+static void preprocessor_reader_push(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct token* tokens, int count, struct preprocessor_hideset* hideset, struct vector* owner)
+{
+    if (count == 0)
+    {
+        if (owner)
+        {
+            preprocessor_vector_give(preprocessor, owner);
+        }
+        return;
+    }
+    struct preprocessor_span span = {
+            .tokens = tokens,
+            .count = count,
+            .index = 0,
+            .hideset = hideset,
+            .owner = owner
+    };
+    vector_push(reader->spans, &span);
+}
+
+/**
+ * @brief 根据读取到的栈底token更新行首状态
+ */
+static void preprocessor_reader_track_line(struct preprocessor_reader* reader, struct token* token)
+{
+    if (token_is_newline(token))
+    {
+        reader->at_line_start = true;
+    }
+    else if (!token_is_comment(token))
+    {
+        reader->at_line_start = false;
+    }
+}
+
+/**
+ * @brief 弹出已经读完的宏展开结果，栈底的输入段不出栈，这样预处理指令总是可以通过它找到在文件中的位置
+ * 宏展开的结果读完之后，下一个token可能就是下一行的预处理指令，调用者需要先弹出读完的输入段才能识别它
+ */
+static void preprocessor_reader_drop_finished(struct preprocessor* preprocessor, struct preprocessor_reader* reader)
+{
+    while (vector_count(reader->spans) > 1)
+    {
+        struct preprocessor_span* span = vector_back(reader->spans);
+        if (span->index < span->count)
+        {
+            return;
+        }
+        if (span->owner)
+        {
+            preprocessor_vector_give(preprocessor, span->owner);
+        }
+        vector_pop(reader->spans);
+    }
+}
+
+/**
+ * @brief 读取下一个token
+ * @param preprocessor 预处理器
+ * @param reader 输入
+ * @param token 读取到的token，它的隐藏集合已经加上了所在输入段的隐藏集合
+ * @return 输入结束时返回false
+ */
+static bool preprocessor_reader_next(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct token* token)
+{
+    preprocessor_reader_drop_finished(preprocessor, reader);
+    size_t top = vector_count(reader->spans) - 1;
+    struct preprocessor_span* span = vector_at(reader->spans, top);
+    if (span->index >= span->count)
+    {
+        return false;
+    }
+    *token = span->tokens[span->index++];
+    if (top == 0)
+    {
+        preprocessor_reader_track_line(reader, token);
+    }
+    token->hideset = preprocessor_hideset_union(preprocessor, token->hideset, span->hideset);
+    return true;
+}
+
+/**
+ * @brief 查看下一个不是换行和注释的token，不读取它
+ * @return 下一个token，输入结束时返回NULL
+ */
+static struct token* preprocessor_reader_peek_significant(struct preprocessor_reader* reader)
+{
+    for (int i = vector_count(reader->spans) - 1; i >= 0; i--)
+    {
+        struct preprocessor_span* span = vector_at(reader->spans, i);
+        for (int j = span->index; j < span->count; j++)
+        {
+            struct token* token = &span->tokens[j];
+            if (!token_is_newline(token) && !token_is_comment(token))
+            {
+                return token;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 获取可以被展开的宏定义
+ * @param preprocessor 预处理器
+ * @param token
+ * @return 宏定义，如果token不是宏名或者宏名在token的隐藏集合中则返回NULL
+ */
+static struct preprocessor_definition* preprocessor_expandable_definition(struct preprocessor* preprocessor, struct token* token)
+{
+    const char* name = preprocessor_token_name(token);
+    if (!name || hashmap_count(preprocessor->definitions) == 0 || preprocessor_hideset_contains(token->hideset, name))
+    {
+        return NULL;
+    }
+    return preprocessor_get_definition(preprocessor, name);
+}
+
+static void preprocessor_expand_token(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct token* token, struct vector* out);
+
+/**
+ * @brief 单独展开一段token，结果不会和这段token之后的内容一起重新扫描
+ * @param preprocessor 预处理器
+ * @param tokens token数组
+ * @param count token的数量
+ * @param hideset 这些token都要加入的隐藏集合
+ * @param out 展开的结果
+ * @return 如果展开的结果不依赖于之后的内容则返回true
+ */
+static bool preprocessor_expand_isolated(struct preprocessor* preprocessor, struct token* tokens, int count, struct preprocessor_hideset* hideset, struct vector* out)
+{
+    struct preprocessor_reader reader;
+    preprocessor_reader_init(preprocessor, &reader, tokens, count, hideset, true);
+    struct token token;
+    while (preprocessor_reader_next(preprocessor, &reader, &token))
+    {
+        preprocessor_expand_token(preprocessor, &reader, &token, out);
+    }
+    preprocessor_reader_free(preprocessor, &reader);
+    return !reader.incomplete;
+}
+
+/**
+ * @brief 获取函数式宏的参数序号
+ * @return 参数的序号，如果token不是参数则返回-1
+ */
+static int preprocessor_param_index(struct preprocessor_definition* definition, struct token* token)
+{
+    const char* name = preprocessor_token_name(token);
+    if (!name || !definition->function_like)
+    {
+        return -1;
+    }
+    for (int i = 0; i < definition->param_count; i++)
+    {
+        if (definition->params[i] == name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 宏的值中第index个位置是否是##运算符，词法分析把它分成了两个紧挨着的#
+ */
+static bool preprocessor_is_paste(struct preprocessor_definition* definition, int index)
+{
+    return index + 1 < definition->token_count
+           && token_is_symbol(&definition->tokens[index], '#')
+           && token_is_symbol(&definition->tokens[index + 1], '#')
+           && !definition->tokens[index].whitespace;
+}
+
+/**
+ * 函数式宏调用的实参，所有实参的token保存在同一个向量中
+ * tokens: 所有实参的token
+ * offsets: 第i个实参是tokens中[offsets[i], offsets[i+1])的部分
+ * expanded: 完整展开后的实参，第一次使用时才展开
+ */
+struct preprocessor_arguments
+{
+    struct vector* tokens;
+    struct vector* offsets;
+    struct vector** expanded;
+};
+
+static int preprocessor_argument_count(struct preprocessor_arguments* arguments)
+{
+    return vector_count(arguments->offsets) - 1;
+}
+
+/**
+ * @brief 获取第index个实参的token
+ * @param arguments 实参
+ * @param index 实参的序号
+ * @param count 实参的token数量
+ * @return 实参的第一个token
+ */
+static struct token* preprocessor_argument(struct preprocessor_arguments* arguments, int index, int* count)
+{
+    int start = *(int*) vector_at(arguments->offsets, index);
+    int end = *(int*) vector_at(arguments->offsets, index + 1);
+    *count = end - start;
+    return vector_at(arguments->tokens, start);
+}
+
+/**
+ * @brief 将token数组追加到向量中
+ */
+static void preprocessor_push_tokens(struct vector* out, struct token* tokens, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        token_vector_push(out, &tokens[i]);
+    }
+}
+
+/**
+ * @brief 宏的#运算符，将实参转换为字符串
+ */
+static struct token preprocessor_stringize(struct token* tokens, int count, struct token* invocation)
+{
+    struct buffer string;
+    struct buffer* buffer = &string;
+    buffer_init(buffer);
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0 && tokens[i - 1].whitespace)
+        {
+            buffer_write(buffer, ' ');
+        }
+        token_write_spelling(&tokens[i], buffer);
+    }
+    buffer_write(buffer, 0x00);
+    struct token token = {
+            .type = TOKEN_TYPE_STRING,
+            .pos = invocation->pos,
+            .sval = intern_string(buffer_ptr(buffer))
+    };
+    buffer_release(buffer);
+    return token;
+}
+
+/**
+ * @brief 宏的##运算符，将两个token的拼写连接起来重新进行词法分析
+ * @param preprocessor 预处理器
+ * @param left 左边的token，结果保存在这里
+ * @param right 右边的token
+ */
+static void preprocessor_paste(struct preprocessor* preprocessor, struct token* left, struct token* right)
+{
+    struct buffer spelling;
+    struct buffer* buffer = &spelling;
+    buffer_init(buffer);
+    token_write_spelling(left, buffer);
+    token_write_spelling(right, buffer);
+    buffer_write(buffer, 0x00);
+
+    struct lex_process* lex_process = token_build_for_string(preprocessor->compiler, buffer_ptr(buffer));
+    if (!lex_process || vector_count(lex_process->token_vec) != 1)
+    {
+        PREPROCESSOR_ERROR(preprocessor, left, "Pasting \"%s\" does not give a valid preprocessing token", (char*) buffer_ptr(buffer));
+    }
+
+    struct token* result = vector_at(lex_process->token_vec, 0);
+    struct pos pos = left->pos;
+    *left = *result;
+    left->pos = pos;
+    left->whitespace = right->whitespace;
+    left->hideset = NULL;
+    buffer_free(lex_process_private(lex_process));
+    lex_process_free(lex_process);
+    buffer_release(buffer);
+}
+
+/**
+ * @brief 用实参替换宏的值中的形参，并处理#和##运算符
+ * @param preprocessor 预处理器
+ * @param definition 宏定义
+ * @param arguments 实参，对象式宏为NULL
+ * @param invocation 宏名token
+ * @return 替换的结果，来自向量池
+ */
+static struct vector* preprocessor_substitute(struct preprocessor* preprocessor, struct preprocessor_definition* definition, struct preprocessor_arguments* arguments, struct token* invocation)
+{
+    struct vector* out = preprocessor_vector_take(preprocessor, sizeof(struct token));
+    // 上一个元素在out中的起始位置，##的左边是它的最后一个token，它为空时##的左边为空
+    size_t previous_start = 0;
+    int i = 0;
+    while (i < definition->token_count)
+    {
+        struct token* token = &definition->tokens[i];
+        size_t start = vector_count(out);
+
+        if (preprocessor_is_paste(definition, i))
+        {
+            if (i + 2 >= definition->token_count)
+            {
+                PREPROCESSOR_ERROR(preprocessor, token, "'##' cannot appear at either end of a macro expansion");
+            }
+
+            struct token* right = &definition->tokens[i + 2];
+            int param = preprocessor_param_index(definition, right);
+            int count = 1;
+            struct token* tokens = right;
+            if (param >= 0)
+            {
+                tokens = preprocessor_argument(arguments, param, &count);
+            }
+
+            bool left_empty = vector_count(out) == previous_start;
+            // GNU扩展: , ## __VA_ARGS__ 在可变参数为空时去掉逗号，否则不进行连接
+            bool comma_va_args = param >= 0 && param == definition->param_count - 1 && definition->variadic
+                                 && !left_empty && token_is_operator(vector_back(out), ",");
+            if (count == 0 && comma_va_args)
+            {
+                vector_pop(out);
+            }
+            else if (count > 0)
+            {
+                int rest = 0;
+                if (!left_empty && !comma_va_args)
+                {
+                    preprocessor_paste(preprocessor, vector_back(out), tokens);
+                    rest = 1;
+                }
+                preprocessor_push_tokens(out, tokens + rest, count - rest);
+                start = vector_count(out) - 1;
+            }
+            else
+            {
+                start = previous_start;
+            }
+            previous_start = start;
+            i += 3;
+            continue;
+        }
+
+        if (definition->function_like && token_is_symbol(token, '#') && i + 1 < definition->token_count)
+        {
+            int param = preprocessor_param_index(definition, &definition->tokens[i + 1]);
+            if (param < 0)
+            {
+                PREPROCESSOR_ERROR(preprocessor, token, "'#' is not followed by a macro parameter");
+            }
+            int count = 0;
+            struct token* tokens = preprocessor_argument(arguments, param, &count);
+            struct token string = preprocessor_stringize(tokens, count, invocation);
+            string.whitespace = definition->tokens[i + 1].whitespace;
+            vector_push(out, &string);
+            previous_start = start;
+            i += 2;
+            continue;
+        }
+
+        int param = preprocessor_param_index(definition, token);
+        if (param >= 0)
+        {
+            int count = 0;
+            struct token* tokens = preprocessor_argument(arguments, param, &count);
+            if (preprocessor_is_paste(definition, i + 1))
+            {
+                // ##的操作数使用没有展开的实参
+                preprocessor_push_tokens(out, tokens, count);
+            }
+            else
+            {
+                if (!arguments->expanded[param])
+                {
+                    arguments->expanded[param] = preprocessor_vector_take(preprocessor, sizeof(struct token));
+                    preprocessor_expand_isolated(preprocessor, tokens, count, NULL, arguments->expanded[param]);
+                }
+                struct vector* expanded = arguments->expanded[param];
+                preprocessor_push_tokens(out, vector_data_ptr(expanded), vector_count(expanded));
+            }
+        }
+        else
+        {
+            token_vector_push(out, token);
+        }
+        previous_start = start;
+        i++;
+    }
+    return out;
+}
+
+/**
+ * @brief 收集函数式宏调用的实参，读取到与(匹配的)为止
+ * @param preprocessor 预处理器
+ * @param reader 输入，下一个有意义的token是(
+ * @param definition 宏定义
+ * @param arguments 实参
+ * @param close_hideset 匹配的)的隐藏集合
+ * @return 如果输入在)之前结束则返回false
+ */
+static bool preprocessor_collect_arguments(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct preprocessor_definition* definition, struct preprocessor_arguments* arguments, struct preprocessor_hideset** close_hideset)
+{
+    struct token token;
+    do
+    {
+        preprocessor_reader_next(preprocessor, reader, &token);
+    } while (!token_is_operator(&token, "("));
+
+    // 可变参数宏多出来的实参连同逗号一起成为__VA_ARGS__
+    int split_limit = definition->variadic ? definition->param_count - 1 : INT_MAX;
+    int depth = 0;
+    int offset = 0;
+    vector_push(arguments->offsets, &offset);
+    while (preprocessor_reader_next(preprocessor, reader, &token))
+    {
+        if (token_is_newline(&token) || token_is_comment(&token) || token_is_line_start(&token))
+        {
+            struct token* last = vector_back_or_null(arguments->tokens);
+            if (last)
+            {
+                last->whitespace = true;
+            }
+            // 换行记录在token上时token本身还是实参的一部分
+            if (!token_is_line_start(&token))
+            {
+                continue;
+            }
+        }
+
+        if (token_is_operator(&token, "("))
+        {
+            depth++;
+        }
+        else if (token_is_symbol(&token, ')'))
+        {
+            if (depth == 0)
+            {
+                *close_hideset = token.hideset;
+                offset = vector_count(arguments->tokens);
+                vector_push(arguments->offsets, &offset);
+                return true;
+            }
+            depth--;
+        }
+        else if (depth == 0 && token_is_operator(&token, ",") && preprocessor_argument_count(arguments) < split_limit)
+        {
+            offset = vector_count(arguments->tokens);
+            vector_push(arguments->offsets, &offset);
+            continue;
+        }
+        token_vector_push(arguments->tokens, &token);
+    }
+    return false;
+}
+
+/**
+ * @brief 检查实参的数量是否和形参一致，没有形参时F()有一个空的实参，可变参数可以省略
+ */
+static void preprocessor_check_argument_count(struct preprocessor* preprocessor, struct preprocessor_definition* definition, struct preprocessor_arguments* arguments, struct token* invocation)
+{
+    int count = preprocessor_argument_count(arguments);
+    if (definition->param_count == 0 && count == 1 && vector_empty(arguments->tokens))
+    {
+        vector_pop(arguments->offsets);
+        return;
+    }
+    if (definition->variadic && count == definition->param_count - 1)
+    {
+        // 补上一个空的__VA_ARGS__
+        int offset = vector_count(arguments->tokens);
+        vector_push(arguments->offsets, &offset);
+        return;
+    }
+    if (count != definition->param_count)
+    {
+        PREPROCESSOR_ERROR(preprocessor, invocation, "Macro \"%s\" expects %i arguments, but %i were given", definition->name, definition->param_count, count);
+    }
+}
+
+/**
+ * @brief 展开一次函数式宏调用，结果压到输入的最前面重新扫描
+ */
+static void preprocessor_expand_function(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct preprocessor_definition* definition, struct token* token, struct vector* out)
+{
+    struct vector* expanded[definition->param_count + 1];
+    memset(expanded, 0, sizeof(expanded));
+    struct preprocessor_arguments arguments = {
+            .tokens = preprocessor_vector_take(preprocessor, sizeof(struct token)),
+            .offsets = preprocessor_vector_take(preprocessor, sizeof(int)),
+            .expanded = expanded
+    };
+
+    struct preprocessor_hideset* close_hideset = NULL;
+    if (!preprocessor_collect_arguments(preprocessor, reader, definition, &arguments, &close_hideset))
+    {
+        if (!reader->isolated)
+        {
+            PREPROCESSOR_ERROR(preprocessor, token, "Unterminated argument list invoking macro \"%s\"", definition->name);
+        }
+        // 单独展开时参数列表可能在之后的内容中结束，这样的结果不能缓存
+        reader->incomplete = true;
+        vector_push(out, token);
+        preprocessor_push_tokens(out, vector_data_ptr(arguments.tokens), vector_count(arguments.tokens));
+    }
+    else
+    {
+        preprocessor_check_argument_count(preprocessor, definition, &arguments, token);
+        struct preprocessor_hideset* hideset = preprocessor_hideset_intersect(preprocessor, token->hideset, close_hideset);
+        hideset = preprocessor_hideset_add(preprocessor, hideset, definition->name);
+        struct vector* result = preprocessor_substitute(preprocessor, definition, &arguments, token);
+        preprocessor_reader_push(preprocessor, reader, vector_data_ptr(result), vector_count(result), hideset, result);
+    }
+
+    for (int i = 0; i < definition->param_count; i++)
+    {
+        if (expanded[i])
+        {
+            preprocessor_vector_give(preprocessor, expanded[i]);
+        }
+    }
+    preprocessor_vector_give(preprocessor, arguments.tokens);
+    preprocessor_vector_give(preprocessor, arguments.offsets);
+}
+
+/**
+ * @brief 使用缓存的完整展开结果展开对象式宏
+ * 对象式宏的展开结果只依赖于宏定义表，所以在宏定义表不变时可以重复使用。
+ * 如果展开结果的最后一个token是函数式宏名，它可能和之后的(组成调用，这样的结果不能缓存
+ * @param preprocessor 预处理器
+ * @param definition 对象式宏定义
+ * @param out 展开结果输出到这里
+ * @return 如果使用了缓存则返回true
+ */
+static bool preprocessor_expand_cached(struct preprocessor* preprocessor, struct preprocessor_definition* definition, struct vector* out)
+{
+    if (definition->expansion_generation != preprocessor->generation + 1)
+    {
+        struct preprocessor_hideset* hideset = preprocessor_hideset_add(preprocessor, NULL, definition->name);
+        struct vector* replacement = NULL;
+        struct token* tokens = definition->tokens;
+        int count = definition->token_count;
+        if (definition->has_operators)
+        {
+            replacement = preprocessor_substitute(preprocessor, definition, NULL, NULL);
+            tokens = vector_data_ptr(replacement);
+            count = vector_count(replacement);
+        }
+
+        struct vector* result = preprocessor_vector_take(preprocessor, sizeof(struct token));
+        bool cacheable = preprocessor_expand_isolated(preprocessor, tokens, count, hideset, result);
+        struct token* last = vector_back_or_null(result);
+        struct preprocessor_definition* last_definition = last ? preprocessor_expandable_definition(preprocessor, last) : NULL;
+        if (last_definition && last_definition->function_like)
+        {
+            cacheable = false;
+        }
+
+        free(definition->expansion);
+        definition->expansion = NULL;
+        definition->expansion_count = 0;
+        if (cacheable && !vector_empty(result))
+        {
+            definition->expansion_count = vector_count(result);
+            definition->expansion = malloc(sizeof(struct token) * definition->expansion_count);
+            memcpy(definition->expansion, vector_data_ptr(result), sizeof(struct token) * definition->expansion_count);
+        }
+        definition->expansion_cacheable = cacheable;
+        definition->expansion_generation = preprocessor->generation + 1;
+
+        preprocessor_vector_give(preprocessor, result);
+        if (replacement)
+        {
+            preprocessor_vector_give(preprocessor, replacement);
+        }
+    }
+
+    if (!definition->expansion_cacheable)
+    {
+        return false;
+    }
+    preprocessor_push_tokens(out, definition->expansion, definition->expansion_count);
+    return true;
+}
+
+/**
+ * @brief 处理读取到的一个token，如果它是可以展开的宏名则展开，否则输出
+ * @param preprocessor 预处理器
+ * @param reader 输入
+ * @param token 读取到的token
+ * @param out 输出
+ */
+static void preprocessor_expand_token(struct preprocessor* preprocessor, struct preprocessor_reader* reader, struct token* token, struct vector* out)
+{
+    struct preprocessor_definition* definition = preprocessor_expandable_definition(preprocessor, token);
+    if (!definition)
+    {
+        token_vector_push(out, token);
+        return;
+    }
+
+    if (definition->function_like)
+    {
+        struct token* next = preprocessor_reader_peek_significant(reader);
+        if (!next || !token_is_operator(next, "("))
+        {
+            if (!next)
+            {
+                reader->incomplete = true;
+            }
+            // 后面没有(的函数式宏名不展开
+            token_vector_push(out, token);
+            return;
+        }
+        preprocessor_expand_function(preprocessor, reader, definition, token, out);
+        return;
+    }
+
+    // 直接来自源文件的宏名才可以使用缓存，否则结果还需要加上它的隐藏集合
+    if (!token->hideset && preprocessor_expand_cached(preprocessor, definition, out))
+    {
+        return;
+    }
+
+    struct preprocessor_hideset* hideset = preprocessor_hideset_add(preprocessor, token->hideset, definition->name);
+    if (definition->has_operators)
+    {
+        struct vector* result = preprocessor_substitute(preprocessor, definition, NULL, token);
+        preprocessor_reader_push(preprocessor, reader, vector_data_ptr(result), vector_count(result), hideset, result);
+        return;
+    }
+    // 宏的值直接作为输入，不需要复制
+    preprocessor_reader_push(preprocessor, reader, definition->tokens, definition->token_count, hideset, NULL);
+}
+
+/**
+ * @brief 释放宏定义中不在内存池中的部分
+ */
+static void preprocessor_definition_free(struct preprocessor_definition* definition)
+{
+    free(definition->expansion);
+}
+
+/**
+ * @brief 处理#define指令
+ * 宏名和(之间没有空白时是函数式宏，之后直到)是参数列表，剩下直到行尾的token是宏的值
+ */
+static void preprocessor_handle_define(struct preprocessor* preprocessor, struct vector* line)
+{
+    struct token* directive = preprocessor_line_token(line, 0);
+    struct token* name_token = preprocessor_line_token(line, 1);
+    const char* name = preprocessor_token_name(name_token);
+    if (!name)
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive, "Macro names must be identifiers");
+    }
+
+    struct preprocessor_definition* definition = arena_alloc(preprocessor->arena, sizeof(struct preprocessor_definition));
+    definition->name = name;
+    int index = 2;
+    struct token* token = preprocessor_line_token(line, index);
+    if (token && token_is_operator(token, "(") && !name_token->whitespace)
+    {
+        definition->function_like = true;
+        const char* params[vector_count(line)];
+        index++;
+        while (true)
+        {
+            token = preprocessor_line_token(line, index);
+            if (!token)
+            {
+                PREPROCESSOR_ERROR(preprocessor, name_token, "Missing ')' in macro parameter list");
+            }
+            if (definition->param_count == 0 && token_is_symbol(token, ')'))
+            {
+                index++;
+                break;
+            }
+
+            struct token* dot2 = preprocessor_line_token(line, index + 1);
+            struct token* dot3 = preprocessor_line_token(line, index + 2);
+            if (token_is_operator(token, ".") && dot2 && dot3 && token_is_operator(dot2, ".") && token_is_operator(dot3, "."))
+            {
+                definition->variadic = true;
+                params[definition->param_count++] = intern_string("__VA_ARGS__");
+                index += 3;
+                token = preprocessor_line_token(line, index);
+                if (!token || !token_is_symbol(token, ')'))
+                {
+                    PREPROCESSOR_ERROR(preprocessor, name_token, "Missing ')' after \"...\"");
+                }
+                index++;
+                break;
+            }
+
+            const char* param = preprocessor_token_name(token);
+            if (!param)
+            {
+                PREPROCESSOR_ERROR(preprocessor, token, "Invalid macro parameter");
+            }
+            params[definition->param_count++] = param;
+            index++;
+
+            token = preprocessor_line_token(line, index);
+            if (token && token_is_symbol(token, ')'))
+            {
+                index++;
+                break;
+            }
+            if (!token || !token_is_operator(token, ","))
+            {
+                PREPROCESSOR_ERROR(preprocessor, name_token, "Expected ',' or ')' in macro parameter list");
+            }
+            index++;
+        }
+        definition->params = arena_memdup(preprocessor->arena, params, sizeof(const char*) * definition->param_count);
+    }
+
+    definition->token_count = vector_count(line) - index;
+    definition->tokens = arena_alloc(preprocessor->arena, sizeof(struct token) * definition->token_count);
+    for (int i = 0; i < definition->token_count; i++)
+    {
+        definition->tokens[i] = *preprocessor_line_token(line, index + i);
+        if (token_is_symbol(&definition->tokens[i], '#'))
+        {
+            definition->has_operators = true;
+        }
+    }
+
+    struct preprocessor_definition* old_definition = preprocessor_get_definition(preprocessor, name);
+    if (old_definition)
+    {
+        preprocessor_definition_free(old_definition);
+    }
+    hashmap_set(preprocessor->definitions, name, definition);
+    preprocessor->generation++;
+}
+
+/**
+ * @brief 处理#undef指令
+ */
+static void preprocessor_handle_undef(struct preprocessor* preprocessor, struct vector* line)
+{
+    struct token* directive = preprocessor_line_token(line, 0);
+    const char* name = preprocessor_token_name(preprocessor_line_token(line, 1));
+    if (!name)
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive, "Macro names must be identifiers");
+    }
+    struct preprocessor_definition* definition = preprocessor_get_definition(preprocessor, name);
+    if (definition)
+    {
+        preprocessor_definition_free(definition);
+        hashmap_remove(preprocessor->definitions, name);
+        preprocessor->generation++;
+    }
+}
+
+/**
+ * @brief 当前是否处于需要输出token的状态
+ */
+static bool preprocessor_is_active(struct preprocessor* preprocessor)
+{
+    if (vector_empty(preprocessor->conditions))
+    {
+        return true;
+    }
+    struct preprocessor_condition* condition = vector_back(preprocessor->conditions);
+    return condition->active;
+}
+
+/**
+ * #if/#elif表达式的求值状态
+ * tokens: 替换了defined并完成宏展开的表达式
+ * count: token的数量
+ * index: 下一个被读取的token
+ * directive: 指令名，表达式中没有token可以指出错误位置时使用它
+ */
+struct preprocessor_expression
+{
+    struct preprocessor* preprocessor;
+    struct token* tokens;
+    int count;
+    int index;
+    struct token* directive;
+};
+
+static long long preprocessor_expression_conditional(struct preprocessor_expression* expression, bool live);
+
+/**
+ * @brief 查看表达式中的下一个token，不读取它
+ * @return 下一个token，表达式结束时返回NULL
+ */
+static struct token* preprocessor_expression_peek(struct preprocessor_expression* expression)
+{
+    if (expression->index >= expression->count)
+    {
+        return NULL;
+    }
+    return &expression->tokens[expression->index];
+}
+
+/**
+ * @brief 获取报告错误的位置：下一个token，表达式已经结束时是最后一个token
+ */
+static struct token* preprocessor_expression_error_token(struct preprocessor_expression* expression)
+{
+    struct token* token = preprocessor_expression_peek(expression);
+    if (token)
+    {
+        return token;
+    }
+    return expression->count > 0 ? &expression->tokens[expression->count - 1] : expression->directive;
+}
+
+/**
+ * @brief 获取二元运算符的优先级，数字越大结合得越紧
+ * @return 优先级，不是二元运算符时返回0
+ */
+static int preprocessor_binary_precedence(struct token* token)
+{
+    if (!token || token->type != TOKEN_TYPE_OPERATOR)
+    {
+        return 0;
+    }
+    static const struct
+    {
+        const char* op;
+        int precedence;
+    } operators[] = {
+            {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5},
+            {"==", 6}, {"!=", 6},
+            {"<", 7}, {">", 7}, {"<=", 7}, {">=", 7},
+            {"<<", 8}, {">>", 8},
+            {"+", 9}, {"-", 9},
+            {"*", 10}, {"/", 10}, {"%", 10}
+    };
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        if (S_EQ(token->sval, operators[i].op))
+        {
+            return operators[i].precedence;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 计算一个二元运算，按二进制补码回绕，不会触发有符号溢出
+ * @param expression 表达式
+ * @param op 运算符
+ * @param left 左操作数
+ * @param right 右操作数
+ * @param live 结果是否会被使用，短路求值跳过的部分中除以0不是错误
+ */
+static long long preprocessor_binary_apply(struct preprocessor_expression* expression, struct token* op, long long left, long long right, bool live)
+{
+    unsigned long long a = left;
+    unsigned long long b = right;
+    const char* name = op->sval;
+    if (S_EQ(name, "/") || S_EQ(name, "%"))
+    {
+        if (right == 0)
+        {
+            if (live)
+            {
+                PREPROCESSOR_ERROR(expression->preprocessor, op, "Division by zero in #if");
+            }
+            return 0;
+        }
+        // LLONG_MIN / -1溢出
+        if (right == -1)
+        {
+            return S_EQ(name, "/") ? (long long) (0 - a) : 0;
+        }
+        return S_EQ(name, "/") ? left / right : left % right;
+    }
+    if (S_EQ(name, "<<") || S_EQ(name, ">>"))
+    {
+        if (right < 0 || right > 63)
+        {
+            return 0;
+        }
+        return S_EQ(name, "<<") ? (long long) (a << right) : left >> right;
+    }
+    if (S_EQ(name, "+"))
+    {
+        return (long long) (a + b);
+    }
+    if (S_EQ(name, "-"))
+    {
+        return (long long) (a - b);
+    }
+    if (S_EQ(name, "*"))
+    {
+        return (long long) (a * b);
+    }
+    if (S_EQ(name, "<"))
+    {
+        return left < right;
+    }
+    if (S_EQ(name, ">"))
+    {
+        return left > right;
+    }
+    if (S_EQ(name, "<="))
+    {
+        return left <= right;
+    }
+    if (S_EQ(name, ">="))
+    {
+        return left >= right;
+    }
+    if (S_EQ(name, "=="))
+    {
+        return left == right;
+    }
+    if (S_EQ(name, "!="))
+    {
+        return left != right;
+    }
+    if (S_EQ(name, "&"))
+    {
+        return (long long) (a & b);
+    }
+    if (S_EQ(name, "^"))
+    {
+        return (long long) (a ^ b);
+    }
+    if (S_EQ(name, "|"))
+    {
+        return (long long) (a | b);
+    }
+    if (S_EQ(name, "&&"))
+    {
+        return left && right;
+    }
+    return left || right;
+}
+
+/**
+ * @brief 计算一元表达式：数字、标识符、括号以及! ~ - +
+ */
+static long long preprocessor_expression_unary(struct preprocessor_expression* expression, bool live)
+{
+    struct token* token = preprocessor_expression_peek(expression);
+    if (!token)
+    {
+        PREPROCESSOR_ERROR(expression->preprocessor, preprocessor_expression_error_token(expression), "Expected value in #if expression");
+    }
+    expression->index++;
+
+    if (token->type == TOKEN_TYPE_NUMBER)
+    {
+        return (long long) token->llnum;
+    }
+    // 展开之后剩下的标识符当作0，与C17相同，true也不例外
+    if (preprocessor_token_name(token))
+    {
+        return 0;
+    }
+    if (token_is_operator(token, "("))
+    {
+        long long value = preprocessor_expression_conditional(expression, live);
+        struct token* close = preprocessor_expression_peek(expression);
+        if (!close || !token_is_symbol(close, ')'))
+        {
+            PREPROCESSOR_ERROR(expression->preprocessor, preprocessor_expression_error_token(expression), "Missing ')' in #if expression");
+        }
+        expression->index++;
+        return value;
+    }
+
+    if (token->type == TOKEN_TYPE_OPERATOR)
+    {
+        if (S_EQ(token->sval, "!"))
+        {
+            return !preprocessor_expression_unary(expression, live);
+        }
+        if (S_EQ(token->sval, "~"))
+        {
+            return (long long) ~(unsigned long long) preprocessor_expression_unary(expression, live);
+        }
+        if (S_EQ(token->sval, "-"))
+        {
+            return (long long) (0 - (unsigned long long) preprocessor_expression_unary(expression, live));
+        }
+        if (S_EQ(token->sval, "+"))
+        {
+            return preprocessor_expression_unary(expression, live);
+        }
+    }
+    PREPROCESSOR_ERROR(expression->preprocessor, token, "Invalid token in #if expression");
+    return 0;
+}
+
+/**
+ * @brief 按优先级计算二元表达式，只处理优先级不低于min_precedence的运算符
+ */
+static long long preprocessor_expression_binary(struct preprocessor_expression* expression, int min_precedence, bool live)
+{
+    long long left = preprocessor_expression_unary(expression, live);
+    while (true)
+    {
+        struct token* op = preprocessor_expression_peek(expression);
+        int precedence = preprocessor_binary_precedence(op);
+        if (precedence == 0 || precedence < min_precedence)
+        {
+            return left;
+        }
+        expression->index++;
+        // &&和||的右边只在需要时才会被求值
+        bool right_live = live;
+        if (S_EQ(op->sval, "&&"))
+        {
+            right_live = live && left;
+        }
+        else if (S_EQ(op->sval, "||"))
+        {
+            right_live = live && !left;
+        }
+        long long right = preprocessor_expression_binary(expression, precedence + 1, right_live);
+        left = preprocessor_binary_apply(expression, op, left, right, live);
+    }
+}
+
+/**
+ * @brief 计算条件表达式a ? b : c，没有条件运算符时就是二元表达式
+ */
+static long long preprocessor_expression_conditional(struct preprocessor_expression* expression, bool live)
+{
+    long long condition = preprocessor_expression_binary(expression, 1, live);
+    struct token* token = preprocessor_expression_peek(expression);
+    if (!token || !token_is_operator(token, "?"))
+    {
+        return condition;
+    }
+    expression->index++;
+    long long if_true = preprocessor_expression_conditional(expression, live && condition);
+    token = preprocessor_expression_peek(expression);
+    if (!token || !token_is_symbol(token, ':'))
+    {
+        PREPROCESSOR_ERROR(expression->preprocessor, preprocessor_expression_error_token(expression), "Expected ':' in #if expression");
+    }
+    expression->index++;
+    long long if_false = preprocessor_expression_conditional(expression, live && !condition);
+    return condition ? if_true : if_false;
+}
+
+/**
+ * @brief 计算#if/#elif的条件
+ * 先把defined X和defined(X)替换为1或0，再展开其余的宏，最后按C的运算符优先级求值，
+ * 展开之后剩下的标识符当作0
+ * @param preprocessor 预处理器
+ * @param line 指令行
+ * @return 条件是否成立
+ */
+static bool preprocessor_evaluate(struct preprocessor* preprocessor, struct vector* line)
+{
+    struct token* directive = preprocessor_line_token(line, 0);
+    struct vector* input = preprocessor_vector_take(preprocessor, sizeof(struct token));
+    for (size_t index = 1; index < vector_count(line); index++)
+    {
+        struct token* token = preprocessor_line_token(line, index);
+        if (!token_is_identifier(token, "defined"))
+        {
+            vector_push(input, token);
+            continue;
+        }
+
+        struct token* name = preprocessor_line_token(line, index + 1);
+        bool parenthesized = name && token_is_operator(name, "(");
+        if (parenthesized)
+        {
+            name = preprocessor_line_token(line, index + 2);
+        }
+        if (!preprocessor_token_name(name))
+        {
+            PREPROCESSOR_ERROR(preprocessor, token, "Operator \"defined\" requires an identifier");
+        }
+        if (parenthesized)
+        {
+            struct token* close = preprocessor_line_token(line, index + 3);
+            if (!close || !token_is_symbol(close, ')'))
+            {
+                PREPROCESSOR_ERROR(preprocessor, token, "Missing ')' after \"defined\"");
+            }
+        }
+
+        struct token number = *token;
+        number.type = TOKEN_TYPE_NUMBER;
+        number.llnum = preprocessor_get_definition(preprocessor, name->sval) != NULL;
+        number.num.type = NUMBER_TYPE_NORMAl;
+        vector_push(input, &number);
+        index += parenthesized ? 3 : 1;
+    }
+
+    struct vector* expanded = preprocessor_vector_take(preprocessor, sizeof(struct token));
+    preprocessor_expand_isolated(preprocessor, vector_data_ptr(input), vector_count(input), NULL, expanded);
+    preprocessor_vector_give(preprocessor, input);
+    struct preprocessor_expression expression = {
+            .preprocessor = preprocessor,
+            .tokens = vector_data_ptr(expanded),
+            .count = vector_count(expanded),
+            .index = 0,
+            .directive = directive
+    };
+    if (expression.count == 0)
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive, "#if with no expression");
+    }
+
+    long long value = preprocessor_expression_conditional(&expression, true);
+    if (expression.index != expression.count)
+    {
+        PREPROCESSOR_ERROR(preprocessor, preprocessor_expression_error_token(&expression), "Missing binary operator in #if expression");
+    }
+    preprocessor_vector_give(preprocessor, expanded);
+    return value != 0;
+}
+
+/**
+ * @brief 压入一个新的条件编译块
+ * @param preprocessor 预处理器
+ * @param value 条件是否成立
+ */
+static void preprocessor_push_condition(struct preprocessor* preprocessor, bool value)
+{
+    bool parent_active = preprocessor_is_active(preprocessor);
+    struct preprocessor_condition condition = {
+            .active = parent_active && value,
+            .taken = value,
+            .parent_active = parent_active,
+            .seen_else = false
+    };
+    vector_push(preprocessor->conditions, &condition);
+}
+
+/**
+ * @brief 处理条件编译相关的指令，在不输出的区域内也需要处理它们以正确匹配嵌套
+ * @param preprocessor 预处理器
+ * @param directive 指令名
+ * @param line 指令行
+ * @param condition_base 当前文件开始时条件编译栈的深度，#endif不能越过它
+ * @return 如果是条件编译指令则返回true
+ */
+static bool preprocessor_handle_condition(struct preprocessor* preprocessor, const char* directive, struct vector* line, size_t condition_base)
+{
+    struct token* directive_token = preprocessor_line_token(line, 0);
+    bool is_ifdef = S_EQ(directive, "ifdef");
+    if (is_ifdef || S_EQ(directive, "ifndef"))
+    {
+        bool value = false;
+        if (preprocessor_is_active(preprocessor))
+        {
+            const char* name = preprocessor_token_name(preprocessor_line_token(line, 1));
+            if (!name)
+            {
+                PREPROCESSOR_ERROR(preprocessor, directive_token, "#%s expects a macro name", directive);
+            }
+            bool defined = preprocessor_get_definition(preprocessor, name) != NULL;
+            value = is_ifdef ? defined : !defined;
+        }
+        preprocessor_push_condition(preprocessor, value);
+        return true;
+    }
+
+    if (S_EQ(directive, "if"))
+    {
+        bool value = preprocessor_is_active(preprocessor) && preprocessor_evaluate(preprocessor, line);
+        preprocessor_push_condition(preprocessor, value);
+        return true;
+    }
+
+    bool is_elif = S_EQ(directive, "elif");
+    bool is_else = S_EQ(directive, "else");
+    bool is_endif = S_EQ(directive, "endif");
+    if (!is_elif && !is_else && !is_endif)
+    {
+        return false;
+    }
+
+    if (vector_count(preprocessor->conditions) <= condition_base)
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive_token, "#%s without #if", directive);
+    }
+
+    struct preprocessor_condition* condition = vector_back(preprocessor->conditions);
+    if (is_endif)
+    {
+        vector_pop(preprocessor->conditions);
+        return true;
+    }
+
+    if (condition->seen_else)
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive_token, "#%s after #else", directive);
+    }
+
+    if (is_else)
+    {
+        condition->seen_else = true;
+        condition->active = condition->parent_active && !condition->taken;
+        condition->taken = true;
+        return true;
+    }
+
+    if (!condition->parent_active || condition->taken)
+    {
+        condition->active = false;
+        return true;
+    }
+    condition->active = preprocessor_evaluate(preprocessor, line);
+    condition->taken = condition->active;
+    return true;
+}
+
+/**
+ * @brief 处理#error和#warning，诊断信息包含指令名之后的整行内容，#error终止编译
+ * @param preprocessor 预处理器
+ * @param directive 指令名
+ * @param line 指令行
+ */
+static void preprocessor_handle_diagnostic(struct preprocessor* preprocessor, const char* directive, struct vector* line)
+{
+    struct buffer text;
+    struct buffer* buffer = &text;
+    buffer_init(buffer);
+    buffer_write(buffer, '#');
+    buffer_write_str(buffer, directive);
+    for (size_t i = 1; i < vector_count(line); i++)
+    {
+        struct token* token = preprocessor_line_token(line, i);
+        if (i == 1 || preprocessor_line_token(line, i - 1)->whitespace)
+        {
+            buffer_write(buffer, ' ');
+        }
+        token_write_spelling(token, buffer);
+    }
+    buffer_write(buffer, 0x00);
+
+    struct token* directive_token = preprocessor_line_token(line, 0);
+    if (S_EQ(directive, "error"))
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive_token, "%s", (char*) buffer_ptr(buffer));
+    }
+    preprocessor->compiler->pos = directive_token->pos;
+    compiler_warning(preprocessor->compiler, "%s", (char*) buffer_ptr(buffer));
+    buffer_release(buffer);
+}
+
+/**
+ * @brief 处理一条预处理指令
+ * @param preprocessor 预处理器
+ * @param tokens 指令所在的token向量
+ * @param index 指令开头的'#'所在的位置
+ * @param dir 当前文件所在的目录
+ * @param condition_base 当前文件开始时条件编译栈的深度
+ * @return 指令之后第一个token的位置
+ */
+static int preprocessor_handle_directive(struct preprocessor* preprocessor, struct vector* tokens, int index, const char* dir, size_t condition_base)
+{
+    struct vector* line = vector_create(sizeof(struct token*));
+    int next = preprocessor_read_directive_line(tokens, index, line);
+    struct token* directive_token = preprocessor_line_token(line, 0);
+    const char* directive = preprocessor_token_name(directive_token);
+
+    if (!directive_token || preprocessor_handle_condition(preprocessor, directive, line, condition_base)
+        || !preprocessor_is_active(preprocessor))
+    {
+        // 空指令，条件编译指令，或者处于不输出的区域
+        vector_free(line);
+        return next;
+    }
+
+    if (S_EQ(directive, "include"))
+    {
+        preprocessor_handle_include(preprocessor, line, dir);
+    }
+    else if (S_EQ(directive, "define"))
+    {
+        preprocessor_handle_define(preprocessor, line);
+    }
+    else if (S_EQ(directive, "undef"))
+    {
+        preprocessor_handle_undef(preprocessor, line);
+    }
+    else if (S_EQ(directive, "error") || S_EQ(directive, "warning"))
+    {
+        preprocessor_handle_diagnostic(preprocessor, directive, line);
+    }
+    else if (!S_EQ(directive, "pragma") && !S_EQ(directive, "line"))
+    {
+        PREPROCESSOR_ERROR(preprocessor, directive_token, "Invalid preprocessing directive");
+    }
+    vector_free(line);
+    return next;
+}
+
+/**
+ * @brief 跳过不输出的区域，直接停在下一条预处理指令的'#'上，中间的token不会被读取或展开
+ * @param reader 输入，只有栈底的输入段
+ * @param base 栈底的输入段
+ */
+static void preprocessor_skip_inactive(struct preprocessor_reader* reader, struct preprocessor_span* base)
+{
+    while (base->index < base->count)
+    {
+        struct token* next = &base->tokens[base->index];
+        if ((reader->at_line_start || token_is_line_start(next)) && token_is_symbol(next, '#'))
+        {
+            return;
+        }
+        preprocessor_reader_track_line(reader, next);
+        base->index++;
+    }
+}
+
+/**
+ * @brief 预处理token向量中的一部分，输出到编译过程的token向量中
+ * @param preprocessor 预处理器
+ * @param tokens 待处理的token向量
+ * @param start 第一个被处理的token的位置
+ * @param end 最后一个被处理的token之后的位置
+ * @param dir 这些token所在的文件的目录
+ */
+static void preprocessor_handle_tokens(struct preprocessor* preprocessor, struct vector* tokens, int start, int end, const char* dir)
+{
+    size_t condition_base = vector_count(preprocessor->conditions);
+    struct preprocessor_reader reader;
+    preprocessor_reader_init(preprocessor, &reader, vector_data_ptr(tokens), end, NULL, false);
+    ((struct preprocessor_span*) vector_at(reader.spans, 0))->index = start;
+    // 宏展开需要连续的输出，先展开到这里再追加到编译过程的token中
+    struct vector* output = preprocessor_vector_take(preprocessor, sizeof(struct token));
+    struct vector_checkpoint output_empty = vector_checkpoint(output);
+    struct token token;
+    while (true)
+    {
+        // 只有宏展开的结果都读完之后才会遇到预处理指令。不产生换行token时，
+        // 行尾的宏调用展开完之后紧接着就是下一行的'#'，要先弹出读完的展开结果
+        preprocessor_reader_drop_finished(preprocessor, &reader);
+        if (vector_count(reader.spans) == 1)
+        {
+            struct preprocessor_span* base = vector_at(reader.spans, 0);
+            if (base->index >= base->count)
+            {
+                break;
+            }
+
+            struct token* next = &base->tokens[base->index];
+            if ((reader.at_line_start || token_is_line_start(next)) && token_is_symbol(next, '#'))
+            {
+                int index = preprocessor_handle_directive(preprocessor, tokens, base->index, dir, condition_base);
+                base = vector_at(reader.spans, 0);
+                base->index = index;
+                reader.at_line_start = true;
+                continue;
+            }
+            if (!preprocessor_is_active(preprocessor))
+            {
+                preprocessor_skip_inactive(&reader, base);
+                continue;
+            }
+        }
+
+        if (!preprocessor_reader_next(preprocessor, &reader, &token))
+        {
+            break;
+        }
+        preprocessor_expand_token(preprocessor, &reader, &token, output);
+        segmented_vector_push_multiple(preprocessor->compiler->token_vec, vector_data_ptr(output), vector_count(output));
+        vector_rollback(output, output_empty);
+    }
+    preprocessor_vector_give(preprocessor, output);
+    preprocessor_reader_free(preprocessor, &reader);
+
+    if (vector_count(preprocessor->conditions) != condition_base)
+    {
+        compiler_error(preprocessor->compiler, "Unterminated conditional directive");
+    }
+}
+
+/**
+ * @brief 定义命令行中-D给出的宏，每个定义只在第一次使用时进行一次词法分析
+ * @param preprocessor 预处理器
+ */
+void preprocessor_apply_command_line_definitions(struct preprocessor* preprocessor)
+{
+    if (!command_line_definitions)
+    {
+        return;
+    }
+
+    static struct token define_token = {
+            .type = TOKEN_TYPE_IDENTIFIER,
+            .sval = "define"
+    };
+    struct vector* line = vector_create(sizeof(struct token*));
+    for (size_t i = 0; i < vector_count(command_line_definitions); i++)
+    {
+        if (i >= vector_count(command_line_tokens))
+        {
+            const char* source = vector_peek_ptr_at(command_line_definitions, i);
+            struct lex_process* lex_process = token_build_for_string(preprocessor->compiler, source);
+            if (!lex_process)
+            {
+                compiler_error(preprocessor->compiler, "Invalid macro definition \"%s\"", source);
+            }
+            // 这些token在编译之间共享，不能引用当前编译过程的文件名
+            struct vector* tokens = lex_process->token_vec;
+            for (size_t j = 0; j < vector_count(tokens); j++)
+            {
+                ((struct token*) vector_at(tokens, j))->pos.filename = "<command line>";
+            }
+            vector_push(command_line_tokens, &tokens);
+            lex_process->token_vec = NULL;
+            buffer_free(lex_process_private(lex_process));
+            lex_process_free(lex_process);
+        }
+
+        struct vector* tokens = vector_peek_ptr_at(command_line_tokens, i);
+        struct token* token = &define_token;
+        vector_clear(line);
+        vector_push(line, &token);
+        for (size_t j = 0; j < vector_count(tokens); j++)
+        {
+            token = vector_at(tokens, j);
+            vector_push(line, &token);
+        }
+        preprocessor_handle_define(preprocessor, line);
+    }
+    vector_free(line);
+}
+
+/**
+ * @brief 获取命令行中-D给出的宏定义
+ * @return 元素为"NAME VALUE"形式的const char*的向量，没有定义时返回NULL
+ */
+struct vector* preprocessor_command_line_definitions()
+{
+    return command_line_definitions;
+}
+
+/**
+ * @brief 获取-I给出的头文件查找目录
+ * @return 元素为const char*的向量，没有时返回NULL
+ */
+struct vector* preprocessor_include_dirs()
+{
+    return include_dirs;
+}
+
+/**
+ * @brief 获取一个头文件的token，不在头文件缓存中时进行词法分析并加入缓存
+ * @param compiler 编译过程，头文件按它的编译选项进行词法分析
+ * @param path 头文件的绝对路径
+ * @return 头文件的token向量，无法打开时返回NULL
+ */
+struct vector* preprocessor_header_tokens(struct compile_process* compiler, const char* path)
+{
+    if (!compiler->preprocessor)
+    {
+        compiler->preprocessor = preprocessor_create(compiler);
+    }
+    if (!header_cache)
+    {
+        header_cache = hashmap_create();
+        include_lookup_cache = hashmap_create();
+    }
+    struct preprocessor_header* header = hashmap_get(header_cache, path);
+    if (!header)
+    {
+        header = preprocessor_load_header(compiler->preprocessor, path);
+    }
+    return header ? header->tokens : NULL;
+}
+
+/**
+ * @brief 找出文件开头连续的#include指令，它们之间只能有注释和空行
+ * @param tokens 文件的原始token向量
+ * @param includes 保存找到的指令，元素为struct preprocessor_include_directive
+ * @return 最后一条#include指令之后第一个token的位置，没有时为0
+ */
+int preprocessor_scan_include_prefix(struct vector* tokens, struct vector* includes)
+{
+    struct vector* line = vector_create(sizeof(struct token*));
+    int count = vector_count(tokens);
+    int end = 0;
+    int i = 0;
+    while (i < count)
+    {
+        struct token* token = vector_at(tokens, i);
+        if (token_is_newline(token) || token_is_comment(token))
+        {
+            i++;
+            continue;
+        }
+        if (!token_is_symbol(token, '#'))
+        {
+            break;
+        }
+
+        int next = preprocessor_read_directive_line(tokens, i, line);
+        struct token* directive = preprocessor_line_token(line, 0);
+        struct token* target = preprocessor_line_token(line, 1);
+        if (!directive || !token_is_keyword(directive, "include") || !target
+            || target->type != TOKEN_TYPE_STRING || vector_count(line) != 2)
+        {
+            break;
+        }
+
+        struct preprocessor_include_directive include = {
+                .name = target->sval,
+                .angle_brackets = target->flag & TOKEN_FLAG_ANGLE_BRACKETS,
+                .end = next
+        };
+        vector_push(includes, &include);
+        end = next;
+        i = next;
+    }
+    vector_free(line);
+    return end;
+}
+
+/**
+ * @brief 预处理文件开头的一部分token，用于生成预编译头文件
+ * @param compiler 编译过程
+ * @param tokens 词法分析得到的原始token向量
+ * @param end 处理到这个位置为止
+ * @return 预处理结果
+ */
+int preprocessor_run_prefix(struct compile_process* compiler, struct vector* tokens, int end)
+{
+    if (!compiler->preprocessor)
+    {
+        compiler->preprocessor = preprocessor_create(compiler);
+    }
+    compiler->token_vec = segmented_vector_create(sizeof(struct token));
+    preprocessor_apply_command_line_definitions(compiler->preprocessor);
+    char* dir = preprocessor_dirname(compiler->cfile.abs_path);
+    preprocessor_handle_tokens(compiler->preprocessor, tokens, 0, end, dir);
+    free(dir);
+    return PREPROCESSOR_ALL_OK;
+}
+
+/**
+ * @brief 预处理一个翻译单元
+ * @param compiler 编译过程
+ * @param tokens 词法分析得到的原始token向量
+ * @return 预处理结果，预处理之后的token保存在compiler->token_vec中
+ */
+int preprocessor_run(struct compile_process* compiler, struct vector* tokens)
+{
+    if (!compiler->preprocessor)
+    {
+        compiler->preprocessor = preprocessor_create(compiler);
+    }
+    compiler->token_vec = segmented_vector_create(sizeof(struct token));
+
+    char* dir = preprocessor_dirname(compiler->cfile.abs_path);
+    // 有可用的预编译头文件时从它保存的状态开始，跳过文件开头的#include
+    int start = pch_restore(compiler, tokens, dir);
+    if (start == 0)
+    {
+        preprocessor_apply_command_line_definitions(compiler->preprocessor);
+    }
+    preprocessor_handle_tokens(compiler->preprocessor, tokens, start, vector_count(tokens), dir);
+    free(dir);
+    return PREPROCESSOR_ALL_OK;
+}
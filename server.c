@@ -0,0 +1,285 @@
+//
+// Description: 常驻的编译服务，监听Unix socket，由一组预先启动的worker进程处理编译请求。
+// 每个worker在请求之间保留驻留字符串、头文件token缓存和#include查找缓存，省去每次启动进程和冷缓存的开销
+// Created by kery on 2024/3/18.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// 服务收到SIGINT或SIGTERM后置为true
+static volatile sig_atomic_t server_stopping = 0;
+
+/**
+ * @brief 读取恰好len个字节
+ * @return 是否读取成功，对方提前关闭连接时返回false
+ */
+static bool server_read_all(int fd, void* data, size_t len)
+{
+    char* ptr = data;
+    while (len > 0)
+    {
+        ssize_t res = read(fd, ptr, len);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (res <= 0)
+        {
+            return false;
+        }
+        ptr += res;
+        len -= res;
+    }
+    return true;
+}
+
+/**
+ * @brief 接收请求的长度和客户端的stderr
+ * @param fd 连接
+ * @param len 保存请求的长度
+ * @param err_fd 保存客户端的stderr，没有随请求发送时为-1
+ * @return 是否接收成功
+ */
+static bool server_receive_header(int fd, uint32_t* len, int* err_fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = len, .iov_len = sizeof(*len)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *err_fd = -1;
+    ssize_t res = recvmsg(fd, &msg, 0);
+    if (res <= 0)
+    {
+        return false;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        memcpy(err_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    // 长度可能被拆成多次到达
+    return server_read_all(fd, (char*) len + res, sizeof(*len) - res);
+}
+
+/**
+ * @brief 编译一个请求中的所有文件，参数和命令行驱动相同，但不能使用标准输入和标准输出
+ * @param args 命令行参数
+ * @param count 参数的数量
+ * @return 编译失败的文件数量，参数错误时为-1
+ */
+static int server_compile(char** args, int count)
+{
+    struct compile_driver* driver = compile_driver_create();
+    int res = compile_driver_parse(driver, count, args) ? 0 : -1;
+    for (size_t i = 0; res == 0 && i < vector_count(driver->inputs); i++)
+    {
+        struct compile_driver_input* input = vector_at(driver->inputs, i);
+        if (S_EQ(input->input, COMPILE_PROCESS_STDIO_NAME) || S_EQ(input->output, COMPILE_PROCESS_STDIO_NAME) ||
+            (driver->dependencies && !driver->dependency_file))
+        {
+            fprintf(stderr, "The compile server cannot use stdin or stdout\n");
+            res = -1;
+        }
+    }
+    if (res == 0)
+    {
+        preprocessor_revalidate_headers();
+        res = compile_driver_run(driver);
+    }
+    compile_driver_free(driver);
+    return res;
+}
+
+/**
+ * @brief 处理一个连接上的请求
+ * @param fd 连接
+ */
+static void server_handle_connection(int fd)
+{
+    uint32_t len;
+    int err_fd;
+    if (!server_receive_header(fd, &len, &err_fd))
+    {
+        return;
+    }
+
+    int32_t res = -1;
+    char* data = NULL;
+    if (len > 0 && len <= COMPILE_SERVER_MAX_REQUEST)
+    {
+        data = malloc(len);
+    }
+    if (data && server_read_all(fd, data, len) && data[len - 1] == '\0')
+    {
+        struct vector* args = vector_create(sizeof(char*));
+        for (char* ptr = data; ptr < data + len; ptr += strlen(ptr) + 1)
+        {
+            vector_push(args, &ptr);
+        }
+
+        // 错误信息写入客户端的stderr，编译完成后恢复
+        int saved_stderr = dup(STDERR_FILENO);
+        if (err_fd >= 0)
+        {
+            dup2(err_fd, STDERR_FILENO);
+        }
+        const char* cwd = vector_peek_ptr_at(args, 0);
+        if (chdir(cwd) == 0)
+        {
+            res = server_compile((char**) vector_data_ptr(args) + 1, vector_count(args) - 1);
+        }
+        else
+        {
+            fprintf(stderr, "Compile server cannot enter directory %s\n", cwd);
+        }
+        fflush(stderr);
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+        vector_free(args);
+    }
+
+    if (write(fd, &res, sizeof(res)) != sizeof(res))
+    {
+        // 客户端已经断开，没有人需要这个结果
+    }
+    free(data);
+    if (err_fd >= 0)
+    {
+        close(err_fd);
+    }
+}
+
+/**
+ * @brief worker进程的主循环，和其他worker一起在同一个socket上accept
+ * @param listen_fd 监听的socket
+ */
+static void server_worker(int listen_fd)
+{
+    // 客户端提前断开时不能因为SIGPIPE退出
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    while (true)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            exit(-1);
+        }
+        server_handle_connection(fd);
+        close(fd);
+    }
+}
+
+/**
+ * @brief 启动一个worker进程
+ * @return worker的进程号，失败时为-1
+ */
+static pid_t server_spawn_worker(int listen_fd)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        server_worker(listen_fd);
+    }
+    return pid;
+}
+
+static void server_handle_stop(int sig)
+{
+    server_stopping = 1;
+}
+
+/**
+ * @brief 运行编译服务，直到收到SIGINT或SIGTERM
+ * @param socket_path 监听的Unix socket路径
+ * @param workers worker进程的数量，小于1时使用CPU的数量
+ * @return 0表示正常退出，-1表示无法启动服务
+ */
+int compile_server_run(const char* socket_path, int workers)
+{
+    if (workers < 1)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? cpus : 1;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0)
+    {
+        perror("Failed to start the compile server");
+        return -1;
+    }
+
+    struct sigaction action = {0};
+    action.sa_handler = server_handle_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pid_t* pids = calloc(workers, sizeof(pid_t));
+    for (int i = 0; i < workers; i++)
+    {
+        pids[i] = server_spawn_worker(listen_fd);
+    }
+
+    // worker因为编译错误退出后重新启动一个，保持worker的数量
+    while (!server_stopping)
+    {
+        pid_t pid = wait(NULL);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < workers && !server_stopping; i++)
+        {
+            if (pids[i] == pid)
+            {
+                pids[i] = server_spawn_worker(listen_fd);
+            }
+        }
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (pids[i] > 0)
+        {
+            kill(pids[i], SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0);
+    free(pids);
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
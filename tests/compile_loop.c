@@ -0,0 +1,51 @@
+//
+// Compiles the same file many times in one process, the way the compile server and the driver do,
+// and fails if memory still allocated through helpers/alloc.c grows after the first compile.
+// Usage: compile_loop FILE [ITERATIONS]   (make check-compile-loop also runs it under a ulimit -v ceiling)
+//
+
+#include "compiler.h"
+#include "helpers/alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s FILE [ITERATIONS]\n", argv[0]);
+        return 2;
+    }
+    const char* file_name = argv[1];
+    long iterations = argc > 2 ? strtol(argv[2], NULL, 10) : 10000;
+    memory_tracking_enable(true);
+
+    // The first compile fills the header cache and the string table, both live for the whole process
+    if (compile_file(file_name, "/dev/null", COMPILE_PROCESS_FLAG_COMPACT_TOKENS) != COMPILER_FILE_COMPILED_OK)
+    {
+        fprintf(stderr, "Failed to compile %s\n", file_name);
+        return 1;
+    }
+    struct memory_stats first;
+    memory_stats_get(&first);
+
+    for (long i = 1; i < iterations; i++)
+    {
+        if (compile_file(file_name, "/dev/null", COMPILE_PROCESS_FLAG_COMPACT_TOKENS) != COMPILER_FILE_COMPILED_OK)
+        {
+            fprintf(stderr, "Failed to compile %s on iteration %ld\n", file_name, i);
+            return 1;
+        }
+    }
+    struct memory_stats last;
+    memory_stats_get(&last);
+
+    printf("compile_loop: %ld compiles, %zu bytes live after the first, %zu after the last, peak %zu\n",
+           iterations, first.live, last.live, last.peak);
+    if (last.live > first.live)
+    {
+        fprintf(stderr, "compile_loop: %zu bytes leaked over %ld compiles\n", last.live - first.live, iterations - 1);
+        return 1;
+    }
+    return 0;
+}
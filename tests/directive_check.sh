@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Regression checks for directives that follow a macro call at the end of a line.
+# Every case is compiled in the default compact mode and with -fkeep-comments, and the exit status is compared.
+# Usage: directive_check.sh COMPILER   (make check-directives)
+#
+
+compiler=${1:-./main}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+# check NAME EXPECTED SOURCE: EXPECTED is "ok" when the compile must succeed, "fail" when it must fail
+check()
+{
+    printf '%b' "$3" > "$dir/$1.c"
+    for flags in "" "-fkeep-comments"; do
+        if "$compiler" $flags "$dir/$1.c" -o "$dir/$1.s" 2>/dev/null; then
+            result=ok
+        else
+            result=fail
+        fi
+        if [ "$result" != "$2" ]; then
+            echo "directive_check: $1 ${flags:-(compact)}: expected $2, got $result" >&2
+            failures=$((failures + 1))
+        fi
+    done
+}
+
+check error_after_call fail '#define f(x) x\nint y = f(1)\n#error boom\n;\n'
+check error_after_nested_call fail '#define f(x) x\n#define A f\nint y = A(1)\n#error boom\n;\n'
+check define_after_call ok '#define f(x) x\nint y = f(1);\nint z = f(2)\n#define B 1\n;\n#if B != 1\n#error B was not defined\n#endif\n'
+check define_after_stringize ok '#define str(x) #x\n#define xstr(x) str(x)\nconst char* s = xstr(a)\n#define B 1\n;\n#if B != 1\n#error B was not defined\n#endif\n'
+check include_after_call fail '#define EXPORT(x) x\nEXPORT(int a)\n#include "missing.h"\n;\n'
+check if_after_call ok '#define f(x) x\nint y = f(1)\n#if 0\n#error inactive\n#endif\n;\n'
+
+if [ "$failures" -ne 0 ]; then
+    echo "directive_check: $failures failure(s)" >&2
+    exit 1
+fi
+echo "directive_check: ok"
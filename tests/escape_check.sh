@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Checks for escape sequences in string and character constants: values that do not fit in a byte must be
+# reported instead of being truncated.
+# Usage: escape_check.sh COMPILER   (make check-escapes)
+#
+
+compiler=${1:-./main}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+# check NAME EXPECTED SOURCE [MESSAGE]: EXPECTED is "ok" when the compile must succeed, "fail" when it must
+# fail, and a failing compile must print MESSAGE when one is given
+check()
+{
+    printf '%s\n' "$3" > "$dir/$1.c"
+    if "$compiler" "$dir/$1.c" -o "$dir/$1.s" 2>"$dir/$1.err"; then
+        result=ok
+    else
+        result=fail
+    fi
+    if [ "$result" != "$2" ]; then
+        echo "escape_check: $1: expected $2, got $result" >&2
+        failures=$((failures + 1))
+    elif [ -n "$4" ] && ! grep -q "$4" "$dir/$1.err"; then
+        echo "escape_check: $1: missing \"$4\" in:" >&2
+        cat "$dir/$1.err" >&2
+        failures=$((failures + 1))
+    fi
+}
+
+check hex_max ok 'const char* s = "\xff\x00\x7F";'
+check hex_leading_zeros ok 'const char* s = "\x00000041";'
+check hex_out_of_range fail 'const char* s = "\x1234";' 'hex escape sequence out of range'
+check hex_just_out_of_range fail 'const char* s = "\x100";' 'hex escape sequence out of range'
+check hex_wraps fail 'const char* s = "\x10000000000000000041";' 'hex escape sequence out of range'
+check hex_char_out_of_range fail "int c = '\\x1ff';" 'hex escape sequence out of range'
+check octal_max ok 'const char* s = "\377\0\1234";'
+check octal_out_of_range fail 'const char* s = "\777";' 'octal escape sequence out of range'
+check octal_just_out_of_range fail 'const char* s = "\400";' 'octal escape sequence out of range'
+check ucn_ok ok 'const char* s = "é\U0001F600";'
+check ucn_out_of_range fail 'const char* s = "\U00110000";' 'Invalid universal character name'
+check ucn_surrogate fail 'const char* s = "\uD800";' 'Invalid universal character name'
+
+if [ "$failures" -ne 0 ]; then
+    echo "escape_check: $failures failure(s)" >&2
+    exit 1
+fi
+echo "escape_check: ok"
@@ -0,0 +1,162 @@
+//
+// Checks for helpers/gap_buffer.c: inserts, erases and gap moves at both edges, growth with the gap
+// at the front, in the middle and at the end, and random splices compared against a plain array.
+// Build with -fsanitize=address (make check-gap-buffer) so writes past the buffer fail loudly.
+//
+
+#include "helpers/gap_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+/**
+ * A plain array the gap buffer is compared against
+ */
+struct model
+{
+    int* values;
+    size_t count;
+};
+
+static void model_splice(struct model* model, size_t index, size_t erase_count, const int* values, size_t count)
+{
+    size_t capacity = model->count + (count > erase_count ? count - erase_count : 0);
+    model->values = realloc(model->values, (capacity + 1) * sizeof(int));
+    memmove(&model->values[index + count], &model->values[index + erase_count], (model->count - index - erase_count) * sizeof(int));
+    memcpy(&model->values[index], values, count * sizeof(int));
+    model->count = model->count - erase_count + count;
+}
+
+/**
+ * Checks that the gap buffer holds the same values as the model, through gap_buffer_at and gap_buffer_data
+ */
+static void check_matches(struct gap_buffer* buffer, struct model* model)
+{
+    CHECK(gap_buffer_count(buffer) == model->count);
+    if (gap_buffer_count(buffer) != model->count)
+    {
+        return;
+    }
+    for (size_t i = 0; i < model->count; i++)
+    {
+        CHECK(*(int*) gap_buffer_at(buffer, i) == model->values[i]);
+    }
+    int* data = gap_buffer_data(buffer);
+    CHECK(model->count == 0 || memcmp(data, model->values, model->count * sizeof(int)) == 0);
+}
+
+/**
+ * Applies a splice to both the gap buffer and the model and compares them
+ */
+static void splice(struct gap_buffer* buffer, struct model* model, size_t index, size_t erase_count, const int* values, size_t count)
+{
+    gap_buffer_splice(buffer, index, erase_count, values, count);
+    model_splice(model, index, erase_count, values, count);
+    check_matches(buffer, model);
+}
+
+static void range(int* values, int first, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        values[i] = first + (int) i;
+    }
+}
+
+static void check_edges()
+{
+    struct gap_buffer* buffer = gap_buffer_create(sizeof(int));
+    struct model model = {0};
+    int values[1024];
+    check_matches(buffer, &model);
+
+    // Fill the initial gap exactly, then one more element forces the first growth with the gap at the end
+    range(values, 0, GAP_BUFFER_MIN_GAP);
+    splice(buffer, &model, 0, 0, values, GAP_BUFFER_MIN_GAP);
+    CHECK(buffer->gap_start == buffer->gap_end);
+    range(values, 1000, 1);
+    splice(buffer, &model, model.count, 0, values, 1);
+
+    // Insert at the front, the gap moves over every element
+    range(values, 2000, 10);
+    splice(buffer, &model, 0, 0, values, 10);
+    // Grow while the gap is at the front, the tail must move to the end of the larger block
+    range(values, 3000, 500);
+    splice(buffer, &model, 0, 0, values, 500);
+    // Grow while the gap is in the middle
+    range(values, 4000, 1024);
+    splice(buffer, &model, model.count / 2, 0, values, 1024);
+
+    // Erase at the front, at the end and in the middle
+    splice(buffer, &model, 0, 7, NULL, 0);
+    splice(buffer, &model, model.count - 9, 9, NULL, 0);
+    splice(buffer, &model, 100, 300, NULL, 0);
+    // Move the gap from the front to the end and back without editing
+    splice(buffer, &model, model.count, 0, NULL, 0);
+    splice(buffer, &model, 0, 0, NULL, 0);
+    // Replace a range with a larger and a smaller one
+    range(values, 5000, 50);
+    splice(buffer, &model, 20, 10, values, 50);
+    splice(buffer, &model, 20, 50, values, 5);
+
+    // Erase everything, then build up again with pushes
+    splice(buffer, &model, 0, model.count, NULL, 0);
+    for (int i = 0; i < 300; i++)
+    {
+        gap_buffer_push(buffer, &i);
+        model_splice(&model, model.count, 0, &i, 1);
+    }
+    check_matches(buffer, &model);
+
+    gap_buffer_free(buffer);
+    free(model.values);
+}
+
+/**
+ * Random splices at random positions, the positions come from a fixed seed so failures are reproducible
+ */
+static void check_random()
+{
+    struct gap_buffer* buffer = gap_buffer_create(sizeof(int));
+    struct model model = {0};
+    int values[200];
+    unsigned int seed = 12345;
+    for (int round = 0; round < 5000 && failures == 0; round++)
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t index = model.count ? (seed >> 8) % (model.count + 1) : 0;
+        seed = seed * 1103515245 + 12345;
+        size_t erase_count = model.count - index ? (seed >> 8) % (model.count - index + 1) % 50 : 0;
+        seed = seed * 1103515245 + 12345;
+        size_t count = (seed >> 8) % 200;
+        range(values, round * 1000, count);
+        splice(buffer, &model, index, erase_count, values, count);
+    }
+    gap_buffer_free(buffer);
+    free(model.values);
+}
+
+int main()
+{
+    check_edges();
+    check_random();
+    if (failures)
+    {
+        fprintf(stderr, "gap_buffer_check: %i failure(s)\n", failures);
+        return 1;
+    }
+    printf("gap_buffer_check: ok\n");
+    return 0;
+}
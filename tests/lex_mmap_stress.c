@@ -0,0 +1,168 @@
+//
+// Stress test for inputs larger than 2^32 bytes: generates a multi-gigabyte source file, maps it with mmap
+// and lexes it through a next_span input source, then checks the token count, the values and the line numbers.
+// Usage: lex_mmap_stress FILE [GIGABYTES]   (make stress-lex-mmap, opt-in, needs the disk space and a few minutes)
+// The file is removed afterwards. Lines are mostly a long // comment so the token vector stays small
+// while every byte offset past 4 GB still goes through the lexer's window and position bookkeeping.
+//
+
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STRESS_LINE_LENGTH 4096
+#define STRESS_TOKENS_PER_LINE 5
+
+/**
+ * The mapped input, read from index onwards
+ */
+struct mmap_input
+{
+    const char* data;
+    size_t len;
+    size_t index;
+};
+
+static int mmap_next_char(struct lex_process* process)
+{
+    struct mmap_input* input = lex_process_private(process);
+    return input->index < input->len ? (unsigned char) input->data[input->index++] : EOF;
+}
+
+static int mmap_peek_char(struct lex_process* process)
+{
+    struct mmap_input* input = lex_process_private(process);
+    return input->index < input->len ? (unsigned char) input->data[input->index] : EOF;
+}
+
+static void mmap_push_char(struct lex_process* process, int c)
+{
+    struct mmap_input* input = lex_process_private(process);
+    // The lexer only ever pushes back the character it has just read
+    if (c != EOF && input->index > 0)
+    {
+        input->index--;
+    }
+}
+
+static const char* mmap_next_span(struct lex_process* process, size_t* len)
+{
+    struct mmap_input* input = lex_process_private(process);
+    *len = input->len - input->index;
+    return &input->data[input->index];
+}
+
+static void mmap_advance(struct lex_process* process, size_t len)
+{
+    struct mmap_input* input = lex_process_private(process);
+    input->index += len;
+}
+
+static struct lex_process_functions mmap_functions = {
+        .next_char = mmap_next_char,
+        .peek_char = mmap_peek_char,
+        .push_char = mmap_push_char,
+        .next_span = mmap_next_span,
+        .advance = mmap_advance
+};
+
+/**
+ * Writes lines of the form "int vN = LINE; // xxx...", each exactly STRESS_LINE_LENGTH bytes
+ * @return the number of lines written, 0 on failure
+ */
+static size_t stress_generate(const char* path, size_t gigabytes)
+{
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+    {
+        return 0;
+    }
+    size_t lines = (gigabytes << 30) / STRESS_LINE_LENGTH;
+    char line[STRESS_LINE_LENGTH + 1];
+    for (size_t i = 0; i < lines; i++)
+    {
+        int n = snprintf(line, sizeof(line), "int v%zu = %zu; // ", i % 1000, i);
+        memset(&line[n], 'x', STRESS_LINE_LENGTH - 1 - n);
+        line[STRESS_LINE_LENGTH - 1] = '\n';
+        if (fwrite(line, 1, STRESS_LINE_LENGTH, fp) != STRESS_LINE_LENGTH)
+        {
+            fclose(fp);
+            return 0;
+        }
+    }
+    return fclose(fp) == 0 ? lines : 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s FILE [GIGABYTES]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    size_t gigabytes = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+    size_t lines = stress_generate(path, gigabytes);
+    if (lines == 0)
+    {
+        fprintf(stderr, "Cannot generate %s\n", path);
+        remove(path);
+        return 2;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        remove(path);
+        return 2;
+    }
+    struct mmap_input input = {.len = st.st_size, .index = 0};
+    input.data = mmap(NULL, input.len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (input.data == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map %s\n", path);
+        remove(path);
+        return 2;
+    }
+    madvise((void*) input.data, input.len, MADV_SEQUENTIAL);
+
+    struct compile_process* process = compile_process_create(path, NULL, COMPILE_PROCESS_FLAG_COMPACT_TOKENS);
+    struct lex_process* lex_process = lex_process_create(process, &mmap_functions, &input);
+    bool ok = lex(lex_process) == LEXICAL_ANALYSIS_ALL_OK;
+    munmap((void*) input.data, input.len);
+    remove(path);
+
+    struct vector* tokens = lex_process->token_vec;
+    size_t count = vector_count(tokens);
+    if (ok && count != lines * STRESS_TOKENS_PER_LINE)
+    {
+        fprintf(stderr, "Expected %zu tokens, got %zu\n", lines * STRESS_TOKENS_PER_LINE, count);
+        ok = false;
+    }
+    // Spot check the numbers and lines at the start, around the 2 GB and 4 GB marks and at the end
+    size_t samples[] = {0, ((size_t) 2 << 30) / STRESS_LINE_LENGTH, ((size_t) 4 << 30) / STRESS_LINE_LENGTH, lines - 1};
+    for (int i = 0; ok && i < 4; i++)
+    {
+        if (samples[i] >= lines)
+        {
+            continue;
+        }
+        struct token* number = vector_at(tokens, samples[i] * STRESS_TOKENS_PER_LINE + 3);
+        if (number->type != TOKEN_TYPE_NUMBER || number->llnum != samples[i] || number->pos.line != (int) samples[i] + 1)
+        {
+            fprintf(stderr, "Wrong token on line %zu\n", samples[i] + 1);
+            ok = false;
+        }
+    }
+    printf("lex_mmap_stress: %zu GB, %zu lines, %zu tokens: %s\n", gigabytes, lines, count, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
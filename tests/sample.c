@@ -0,0 +1,26 @@
+/*
+ * Sample input used by the check targets in the Makefile.
+ * It exercises the lexer and the preprocessor: includes, macros, conditionals and literals.
+ */
+#include "sample.h"
+
+#if SAMPLE_VERSION >= 2 && defined(SAMPLE_SQUARE)
+int sample_area = SAMPLE_SQUARE(SAMPLE_VERSION);
+#else
+#error "sample.h is too old"
+#endif
+
+#if 0
+this group isn't compiled, "not even this
+#endif
+
+const char* sample_name = SAMPLE_STR(sample) "\t\x41\n";
+char sample_letter = 'k';
+long sample_mask = 0xff00 | 0b1010;
+int SAMPLE_CAT(sample_, counter) = 10;
+
+int sample_sum(struct sample_point* p)
+{
+    // Line comment
+    return p->x + p->y;
+}
@@ -0,0 +1,15 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#define SAMPLE_VERSION 3
+#define SAMPLE_SQUARE(x) ((x) * (x))
+#define SAMPLE_STR(x) #x
+#define SAMPLE_CAT(a, b) a ## b
+
+struct sample_point
+{
+    int x;
+    int y;
+};
+
+#endif
@@ -0,0 +1,80 @@
+//
+// Microbenchmark of the typed token vector accessors from helpers/typed_vector.h against the generic vector API.
+// Build with optimisations (make bench-vector uses -O2), at -O0 nothing is inlined and both paths cost the same.
+// Usage: vector_bench [TOKENS] [ROUNDS]
+//
+
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Prints the cost per element of one benchmark, best of all rounds
+ */
+static void bench_report(const char* name, double best, size_t tokens)
+{
+    printf("%-16s %6.2f ns/token\n", name, best * 1e9 / tokens);
+}
+
+int main(int argc, char** argv)
+{
+    size_t tokens = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+    struct token token = {.type = TOKEN_TYPE_NUMBER};
+    double best[4] = {1e9, 1e9, 1e9, 1e9};
+    // Keeps the iteration loops from being optimised away
+    unsigned long long checksum = 0;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        struct vector* generic = vector_create(sizeof(struct token));
+        double start = bench_now();
+        for (size_t i = 0; i < tokens; i++)
+        {
+            token.llnum = i;
+            vector_push(generic, &token);
+        }
+        double pushed = bench_now();
+        for (size_t i = 0; i < vector_count(generic); i++)
+        {
+            checksum += ((struct token*) vector_at(generic, i))->llnum;
+        }
+        double iterated = bench_now();
+        best[0] = pushed - start < best[0] ? pushed - start : best[0];
+        best[1] = iterated - pushed < best[1] ? iterated - pushed : best[1];
+        vector_free(generic);
+
+        struct vector* typed = token_vector_create();
+        start = bench_now();
+        for (size_t i = 0; i < tokens; i++)
+        {
+            token.llnum = i;
+            token_vector_push(typed, &token);
+        }
+        pushed = bench_now();
+        for (size_t i = 0; i < token_vector_count(typed); i++)
+        {
+            checksum += token_vector_at(typed, i)->llnum;
+        }
+        iterated = bench_now();
+        best[2] = pushed - start < best[2] ? pushed - start : best[2];
+        best[3] = iterated - pushed < best[3] ? iterated - pushed : best[3];
+        vector_free(typed);
+    }
+
+    printf("%zu tokens of %zu bytes, best of %d rounds (checksum %llu)\n", tokens, sizeof(struct token), rounds, checksum);
+    bench_report("generic push", best[0], tokens);
+    bench_report("typed push", best[2], tokens);
+    bench_report("generic iterate", best[1], tokens);
+    bench_report("typed iterate", best[3], tokens);
+    return 0;
+}
@@ -0,0 +1,135 @@
+//
+// Regression checks for the insert paths of helpers/vector.c.
+// Build with -fsanitize=address (make check-vector) so writes past the buffer fail loudly.
+//
+
+#include "helpers/vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+static struct vector* vector_of_range(int first, int count)
+{
+    struct vector* vector = vector_create(sizeof(int));
+    for (int i = 0; i < count; i++)
+    {
+        int value = first + i;
+        vector_push(vector, &value);
+    }
+    return vector;
+}
+
+/**
+ * Checks that the vector holds exactly the given values in order
+ */
+static void check_contents(struct vector* vector, const int* expected, int count)
+{
+    CHECK(vector_count(vector) == (size_t) count);
+    for (int i = 0; i < count && i < (int) vector_count(vector); i++)
+    {
+        CHECK(*(int*) vector_at(vector, i) == expected[i]);
+    }
+}
+
+/**
+ * Inserting more elements at the front than the spare capacity holds moves the whole tail past the old end
+ */
+static void check_insert_front_beyond_capacity()
+{
+    struct vector* vector = vector_of_range(100, 15);
+    int values[10];
+    for (int i = 0; i < 10; i++)
+    {
+        values[i] = i;
+    }
+    vector_push_multiple_at(vector, 0, values, 10);
+
+    int expected[25];
+    for (int i = 0; i < 10; i++)
+    {
+        expected[i] = i;
+    }
+    for (int i = 0; i < 15; i++)
+    {
+        expected[10 + i] = 100 + i;
+    }
+    check_contents(vector, expected, 25);
+    vector_free(vector);
+}
+
+static void check_insert_middle_beyond_capacity()
+{
+    struct vector* vector = vector_of_range(0, 19);
+    int values[40];
+    for (int i = 0; i < 40; i++)
+    {
+        values[i] = 1000 + i;
+    }
+    vector_push_multiple_at(vector, 7, values, 40);
+
+    int expected[59];
+    int n = 0;
+    for (int i = 0; i < 7; i++)
+    {
+        expected[n++] = i;
+    }
+    for (int i = 0; i < 40; i++)
+    {
+        expected[n++] = 1000 + i;
+    }
+    for (int i = 7; i < 19; i++)
+    {
+        expected[n++] = i;
+    }
+    check_contents(vector, expected, n);
+    vector_free(vector);
+}
+
+static void check_push_at_repeatedly()
+{
+    struct vector* vector = vector_create(sizeof(int));
+    int expected[200];
+    for (int i = 0; i < 200; i++)
+    {
+        int value = 199 - i;
+        vector_push_at(vector, 0, &value);
+        expected[i] = i;
+    }
+    check_contents(vector, expected, 200);
+    vector_free(vector);
+}
+
+static void check_pop_multiple_at()
+{
+    struct vector* vector = vector_of_range(0, 30);
+    vector_pop_multiple_at(vector, 5, 20);
+    int expected[10] = {0, 1, 2, 3, 4, 25, 26, 27, 28, 29};
+    check_contents(vector, expected, 10);
+    vector_free(vector);
+}
+
+int main()
+{
+    check_insert_front_beyond_capacity();
+    check_insert_middle_beyond_capacity();
+    check_push_at_repeatedly();
+    check_pop_multiple_at();
+    if (failures)
+    {
+        fprintf(stderr, "vector_check: %i failure(s)\n", failures);
+        return 1;
+    }
+    printf("vector_check: ok\n");
+    return 0;
+}
@@ -4,6 +4,8 @@
 //
 
 #include "compiler.h"
+#include "helpers/buffer.h"
+#include "helpers/vector.h"
 
 /**
  * @brief 检测该token是否是一个关键字
@@ -15,3 +17,197 @@ bool token_is_keyword(struct token* token, const char* value)
 {
     return token->type == TOKEN_TYPE_KEYWORD && S_EQ(token->sval, value);
 }
+
+/**
+ * @brief 检测该token是否是一个指定名字的标识符
+ * @param token
+ * @param value
+ * @return
+ */
+bool token_is_identifier(struct token* token, const char* value)
+{
+    return token->type == TOKEN_TYPE_IDENTIFIER && S_EQ(token->sval, value);
+}
+
+/**
+ * @brief 检测该token是否是一个指定的符号
+ * @param token
+ * @param c
+ * @return
+ */
+bool token_is_symbol(struct token* token, char c)
+{
+    return token->type == TOKEN_TYPE_SYMBOL && token->cval == c;
+}
+
+/**
+ * @brief 检测该token是否是一个指定的运算符
+ * @param token
+ * @param value
+ * @return
+ */
+bool token_is_operator(struct token* token, const char* value)
+{
+    return token->type == TOKEN_TYPE_OPERATOR && S_EQ(token->sval, value);
+}
+
+bool token_is_newline(struct token* token)
+{
+    return token->type == TOKEN_TYPE_NEWLINE;
+}
+
+bool token_is_comment(struct token* token)
+{
+    return token->type == TOKEN_TYPE_COMMENT;
+}
+
+/**
+ * @brief token是否位于一行的开头，只在不产生换行token时记录
+ */
+bool token_is_line_start(struct token* token)
+{
+    return token->flag & TOKEN_FLAG_LINE_START;
+}
+
+/**
+ * @brief 把字符串常量解码之后的一个字节重新转义写入缓冲区，转义的写法GNU汇编器也能识别
+ * @param buffer 缓冲区
+ * @param c 字节
+ */
+void token_write_escaped(struct buffer* buffer, unsigned char c)
+{
+    switch (c)
+    {
+        case '"':
+        case '\\':
+            buffer_write(buffer, '\\');
+            buffer_write(buffer, c);
+            break;
+        case '\n':
+            buffer_write_n(buffer, "\\n", 2);
+            break;
+        case '\t':
+            buffer_write_n(buffer, "\\t", 2);
+            break;
+        case '\r':
+            buffer_write_n(buffer, "\\r", 2);
+            break;
+        default:
+            if (c < 0x20 || c == 0x7F)
+            {
+                // 八进制转义最多三位，不会吞掉后面的数字
+                buffer_write(buffer, '\\');
+                buffer_write(buffer, '0' + (c >> 6));
+                buffer_write(buffer, '0' + ((c >> 3) & 7));
+                buffer_write(buffer, '0' + (c & 7));
+                break;
+            }
+            buffer_write(buffer, c);
+    }
+}
+
+/**
+ * @brief 将token的拼写写入缓冲区，用于宏的#和##运算符
+ * 数字以十进制写出，字符串中的引号、反斜杠和控制字符会被重新转义
+ * @param token
+ * @param buffer
+ */
+void token_write_spelling(struct token* token, struct buffer* buffer)
+{
+    switch (token->type)
+    {
+        case TOKEN_TYPE_IDENTIFIER:
+        case TOKEN_TYPE_KEYWORD:
+        case TOKEN_TYPE_OPERATOR:
+            buffer_write_str(buffer, token->sval);
+            break;
+        case TOKEN_TYPE_SYMBOL:
+            buffer_write(buffer, token->cval);
+            break;
+        case TOKEN_TYPE_NUMBER:
+            buffer_write_uint(buffer, token->llnum);
+            break;
+        case TOKEN_TYPE_STRING:
+            if (token->flag & TOKEN_FLAG_ANGLE_BRACKETS)
+            {
+                buffer_write(buffer, '<');
+                buffer_write_str(buffer, token->sval);
+                buffer_write(buffer, '>');
+                break;
+            }
+            buffer_write(buffer, '"');
+            for (const char* c = token->sval; *c; c++)
+            {
+                token_write_escaped(buffer, *c);
+            }
+            buffer_write(buffer, '"');
+            break;
+        case TOKEN_TYPE_NEWLINE:
+            buffer_write(buffer, '\n');
+            break;
+    }
+}
+
+/**
+ * @brief 连接相邻的字符串常量，"a" "b"变为"ab"，中间的换行和注释被忽略
+ * 在预处理之后进行，这样宏展开得到的字符串也会被连接。字符串已经解码过转义，直接连接内容即可
+ * @param tokens 预处理之后的token，原地修改
+ */
+void token_concatenate_strings(struct segmented_vector* tokens)
+{
+    size_t count = segmented_vector_count(tokens);
+    struct buffer* buffer = NULL;
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        struct token* token = segmented_vector_at(tokens, i);
+        struct token* merged = segmented_vector_at(tokens, out++);
+        *merged = *token;
+        if (merged->type != TOKEN_TYPE_STRING || (merged->flag & TOKEN_FLAG_ANGLE_BRACKETS))
+        {
+            continue;
+        }
+
+        // 找出后面紧跟的所有字符串
+        size_t last = i;
+        for (size_t j = i + 1; j < count; j++)
+        {
+            struct token* next = segmented_vector_at(tokens, j);
+            if (next->type == TOKEN_TYPE_STRING && !(next->flag & TOKEN_FLAG_ANGLE_BRACKETS))
+            {
+                last = j;
+            }
+            else if (next->type != TOKEN_TYPE_NEWLINE && next->type != TOKEN_TYPE_COMMENT)
+            {
+                break;
+            }
+        }
+        if (last == i)
+        {
+            continue;
+        }
+
+        if (!buffer)
+        {
+            buffer = buffer_create();
+        }
+        buffer->len = 0;
+        for (size_t j = i; j <= last; j++)
+        {
+            struct token* part = segmented_vector_at(tokens, j);
+            if (part->type == TOKEN_TYPE_STRING)
+            {
+                buffer_write_str(buffer, part->sval);
+            }
+        }
+        merged->sval = intern_string_n(buffer->data, buffer->len);
+        merged->whitespace = ((struct token*) segmented_vector_at(tokens, last))->whitespace;
+        i = last;
+    }
+
+    if (buffer)
+    {
+        buffer_free(buffer);
+    }
+    segmented_vector_truncate(tokens, out);
+}
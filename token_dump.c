@@ -0,0 +1,335 @@
+//
+// Description: 把词法分析得到的token向量保存到文件中，之后可以不经过词法分析直接读回
+// Created by kery on 2024/3/21.
+//
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/buffer.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * 二进制token文件的格式，所有整数都是本机字节序，文件只在同一种机器之间使用
+ * 文件由一个struct token_dump_header开头，之后依次是：
+ *
+ * strings: 每个字符串在string_data中的偏移，uint64_t，共string_count个
+ * string_data: 以0结尾的字符串，共string_data_size字节，之后补0到8字节对齐
+ * tokens: struct token_dump_record，共token_count个
+ *
+ * token通过编号引用字符串，相同的字符串只保存一次，TOKEN_DUMP_NO_STRING表示NULL。
+ * 字符串类型的token(标识符、关键字、运算符、字符串、注释)的value是sval的编号，其他token的value是llnum。
+ * 宏展开的隐藏集合不会被保存，文件只用于保存词法分析的结果
+ */
+#define TOKEN_DUMP_MAGIC "KTOK"
+#define TOKEN_DUMP_VERSION 1
+#define TOKEN_DUMP_NO_STRING UINT32_MAX
+
+struct token_dump_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t token_count;
+    uint64_t string_count;
+    uint64_t string_data_size;
+};
+
+struct token_dump_record
+{
+    int32_t type;
+    int32_t flag;
+    int32_t line;
+    int32_t col;
+    uint32_t filename;
+    uint32_t between_brackets;
+    int32_t num_type;
+    uint8_t whitespace;
+    uint8_t reserved[3];
+    uint64_t value;
+};
+
+/**
+ * 写入时使用的状态
+ * strings: 字符串->编号+1
+ * offsets: 每个字符串在data中的偏移
+ * data: 字符串的内容
+ */
+struct token_dump_writer
+{
+    struct hashmap* strings;
+    struct vector* offsets;
+    struct vector* data;
+};
+
+/**
+ * @brief token的值是否是字符串
+ */
+static bool token_dump_has_string(int type)
+{
+    return type == TOKEN_TYPE_IDENTIFIER || type == TOKEN_TYPE_KEYWORD || type == TOKEN_TYPE_OPERATOR
+           || type == TOKEN_TYPE_STRING || type == TOKEN_TYPE_COMMENT;
+}
+
+/**
+ * @brief 获取一个字符串的编号，第一次遇到的字符串加入字符串表
+ * @param writer 写入状态
+ * @param str 字符串，可以为NULL
+ * @return 字符串编号
+ */
+static uint32_t token_dump_string(struct token_dump_writer* writer, const char* str)
+{
+    if (!str)
+    {
+        return TOKEN_DUMP_NO_STRING;
+    }
+
+    uintptr_t id = (uintptr_t) hashmap_get(writer->strings, str);
+    if (id)
+    {
+        return id - 1;
+    }
+
+    uint64_t offset = vector_count(writer->data);
+    for (const char* c = str; ; c++)
+    {
+        vector_push(writer->data, (void*) c);
+        if (*c == 0x00)
+        {
+            break;
+        }
+    }
+    vector_push(writer->offsets, &offset);
+    id = vector_count(writer->offsets);
+    hashmap_set(writer->strings, str, (void*) id);
+    return id - 1;
+}
+
+/**
+ * @brief 把token向量以二进制格式写入文件
+ * @param tokens token向量，元素为struct token
+ * @param filename 输出文件的路径
+ * @return 是否写入成功
+ */
+bool token_dump_write(struct vector* tokens, const char* filename)
+{
+    struct token_dump_writer writer = {
+            .strings = hashmap_create(),
+            .offsets = vector_create(sizeof(uint64_t)),
+            .data = vector_create(sizeof(char))
+    };
+    struct vector* records = vector_create(sizeof(struct token_dump_record));
+    for (size_t i = 0; i < vector_count(tokens); i++)
+    {
+        struct token* token = vector_at(tokens, i);
+        struct token_dump_record record = {
+                .type = token->type,
+                .flag = token->flag,
+                .line = token->pos.line,
+                .col = token->pos.col,
+                .filename = token_dump_string(&writer, token->pos.filename),
+                .between_brackets = token_dump_string(&writer, token->between_brackets),
+                .num_type = token->num.type,
+                .whitespace = token->whitespace,
+                .value = token->llnum
+        };
+        if (token_dump_has_string(token->type))
+        {
+            record.value = token_dump_string(&writer, token->sval);
+        }
+        vector_push(records, &record);
+    }
+
+    struct token_dump_header header = {
+            .magic = TOKEN_DUMP_MAGIC,
+            .version = TOKEN_DUMP_VERSION,
+            .token_count = vector_count(records),
+            .string_count = vector_count(writer.offsets),
+            .string_data_size = vector_count(writer.data)
+    };
+    static const char padding[8] = {0};
+    bool ok = false;
+    FILE* file = fopen(filename, "wb");
+    if (file)
+    {
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(vector_data_ptr(writer.offsets), sizeof(uint64_t), header.string_count, file);
+        fwrite(vector_data_ptr(writer.data), 1, header.string_data_size, file);
+        fwrite(padding, 1, (8 - header.string_data_size % 8) % 8, file);
+        fwrite(vector_data_ptr(records), sizeof(struct token_dump_record), header.token_count, file);
+        ok = !ferror(file);
+        ok = fclose(file) == 0 && ok;
+    }
+
+    hashmap_free(writer.strings);
+    vector_free(writer.offsets);
+    vector_free(writer.data);
+    vector_free(records);
+    return ok;
+}
+
+/**
+ * @brief 获取token类型的名字
+ */
+static const char* token_dump_type_name(int type)
+{
+    static const char* names[] = {
+            [TOKEN_TYPE_IDENTIFIER] = "identifier",
+            [TOKEN_TYPE_KEYWORD] = "keyword",
+            [TOKEN_TYPE_OPERATOR] = "operator",
+            [TOKEN_TYPE_SYMBOL] = "symbol",
+            [TOKEN_TYPE_NUMBER] = "number",
+            [TOKEN_TYPE_STRING] = "string",
+            [TOKEN_TYPE_COMMENT] = "comment",
+            [TOKEN_TYPE_NEWLINE] = "newline"
+    };
+    if (type < 0 || type >= (int) (sizeof(names) / sizeof(names[0])) || !names[type])
+    {
+        return "unknown";
+    }
+    return names[type];
+}
+
+/**
+ * @brief 把token向量以文本格式写入，每行一个token，用于查看和比较
+ * 格式为"行:列 类型 值"，之后如果token后面有空白则加上" ws"，字符串被重新转义并加上引号
+ * @param tokens token向量，元素为struct token
+ * @param fp 输出文件
+ */
+void token_dump_write_text(struct vector* tokens, FILE* fp)
+{
+    struct buffer* buffer = buffer_create();
+    for (size_t i = 0; i < vector_count(tokens); i++)
+    {
+        struct token* token = vector_at(tokens, i);
+        fprintf(fp, "%i:%i %s ", token->pos.line, token->pos.col, token_dump_type_name(token->type));
+        struct token string;
+        if (token->type == TOKEN_TYPE_COMMENT)
+        {
+            // 注释没有拼写，和字符串一样转义输出内容
+            string = *token;
+            string.type = TOKEN_TYPE_STRING;
+            string.flag = 0;
+            token = &string;
+        }
+        buffer->len = 0;
+        if (token->type != TOKEN_TYPE_NEWLINE)
+        {
+            token_write_spelling(token, buffer);
+        }
+        fwrite(buffer_ptr(buffer), 1, buffer->len, fp);
+        fputs(token->whitespace ? " ws\n" : "\n", fp);
+    }
+    buffer_free(buffer);
+}
+
+/**
+ * @brief 获取一个字符串编号对应的字符串
+ * @return 字符串，编号越界时返回false
+ */
+static bool token_dump_read_string(const char** strings, uint64_t count, uint32_t id, const char** str)
+{
+    if (id == TOKEN_DUMP_NO_STRING)
+    {
+        *str = NULL;
+        return true;
+    }
+    if (id >= count)
+    {
+        return false;
+    }
+    *str = strings[id];
+    return true;
+}
+
+/**
+ * @brief 读取一个二进制token文件，重建token向量，不需要重新进行词法分析
+ * 所有字符串都被驻留，和词法分析得到的token一样可以直接比较指针
+ * @param filename token文件的路径
+ * @return token向量，文件格式不对时返回NULL
+ */
+struct vector* token_dump_read(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct token_dump_header))
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    // 检查每一段都在文件范围内，计算时避免溢出
+    const struct token_dump_header* header = (const struct token_dump_header*) data;
+    size_t available = size - sizeof(*header);
+    bool valid = memcmp(header->magic, TOKEN_DUMP_MAGIC, 4) == 0 && header->version == TOKEN_DUMP_VERSION
+                 && header->string_count <= available / sizeof(uint64_t);
+    size_t string_data_offset = sizeof(*header) + (valid ? header->string_count * sizeof(uint64_t) : 0);
+    valid = valid && header->string_data_size <= size - string_data_offset;
+    size_t padded_size = valid ? (header->string_data_size + 7) & ~(size_t) 7 : 0;
+    size_t records_offset = string_data_offset + padded_size;
+    valid = valid && records_offset <= size
+            && header->token_count <= (size - records_offset) / sizeof(struct token_dump_record)
+            && (header->string_data_size == 0 || data[string_data_offset + header->string_data_size - 1] == 0x00);
+    if (!valid)
+    {
+        munmap((void*) data, size);
+        return NULL;
+    }
+
+    const uint64_t* offsets = (const uint64_t*) (data + sizeof(*header));
+    const char* string_data = data + string_data_offset;
+    const char** strings = malloc((header->string_count + 1) * sizeof(const char*));
+    for (uint64_t i = 0; i < header->string_count && valid; i++)
+    {
+        valid = offsets[i] < header->string_data_size;
+        strings[i] = valid ? intern_string(&string_data[offsets[i]]) : NULL;
+    }
+
+    struct vector* tokens = vector_create(sizeof(struct token));
+    const struct token_dump_record* records = (const struct token_dump_record*) (data + records_offset);
+    for (uint64_t i = 0; i < header->token_count && valid; i++)
+    {
+        const struct token_dump_record* record = &records[i];
+        struct token token = {
+                .type = record->type,
+                .flag = record->flag,
+                .pos.line = record->line,
+                .pos.col = record->col,
+                .num.type = record->num_type,
+                .whitespace = record->whitespace,
+                .llnum = record->value
+        };
+        valid = token_dump_read_string(strings, header->string_count, record->filename, &token.pos.filename)
+                && token_dump_read_string(strings, header->string_count, record->between_brackets, &token.between_brackets);
+        if (valid && token_dump_has_string(record->type))
+        {
+            valid = record->value <= UINT32_MAX
+                    && token_dump_read_string(strings, header->string_count, record->value, &token.sval);
+        }
+        vector_push(tokens, &token);
+    }
+
+    free(strings);
+    munmap((void*) data, size);
+    if (!valid)
+    {
+        vector_free(tokens);
+        return NULL;
+    }
+    return tokens;
+}